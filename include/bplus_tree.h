@@ -1,60 +1,347 @@
-#pragma once
-
-#include <string>
-#include <vector>
-#include <cstdint>
-#include "page.h"
-#include "buffer_pool.h"
-#include "page_manager.h"
-
-using namespace std;
-
-struct Node;
-
-class BPlusTree {
-public:
-    // constructor, order is max number of keys in each node
-    BPlusTree(BufferPool* buffer_pool, PageManager* page_manager, int order = 3);
-
-    // insert a key-value pair into the tree
-    bool insert(const string& key, uint64_t value);
-
-    // search for key, return file position (0 if not found)
-    uint64_t search(const string& key);
-
-private:
-    BufferPool* buffer_pool_;
-    PageManager* page_manager_;  // for allocating pages
-    uint32_t root_page_id_;  // page ID instead of pointer, 0 means empty tree
-    int order_;
-
-    // insert helper, returns page id of the new right child if split, otherwise 0
-    uint32_t insertHelper(uint32_t page_id, const string& key, uint64_t value, string& promotedKey, uint32_t& newRightChildPage);
-    // search helpers
-    uint32_t findLeaf(const string& key);
-    
-    // page-based node operations
-    void loadNode(uint32_t page_id, Node& node);
-    void saveNode(uint32_t page_id, const Node& node);
-    uint32_t allocateNode(bool is_leaf);
-    
-    // persistence for root_page_id_
-    void loadRootPageId();
-    void saveRootPageId();
-
-};
-
-struct Node {
-    bool is_leaf;
-    vector<string> keys;
-    vector<uint64_t> values; // for leaf nodes, values are file positions
-    vector<uint32_t> children_page_ids; // internal nodes
-    uint32_t next_page_id; // for leaf nodes, points to next leaf node in linked list
-    uint32_t page_id;
-
-    Node(bool leaf = false) : is_leaf(leaf), next_page_id(0), page_id(0) {}
-
-    void serializeToPage(Page& page) const; // write node data to page
-    void deserializeFromPage(const Page& page); // read node data from page
-
-};
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <atomic>
+#include <shared_mutex>
+#include "page.h"
+#include "buffer_pool.h"
+#include "page_manager.h"
+#include "version_latch.h"
+#include "leaf_filter.h"
+
+using namespace std;
+
+struct Node;
+
+// longest key the tree accepts, a page always holds several of them so splits work
+constexpr uint32_t MAX_KEY_SIZE = 512;
+
+// insert and search are safe from many threads at once (optimistic lock coupling, see version_latch.h):
+// lookups take no latches and restart if a node they read changed, inserts latch only the leaf and the
+// ancestors that may split with it; insertBatch excludes everything else while it runs
+// iterators and scans read one leaf at a time and may or may not see concurrent inserts
+class BPlusTree {
+public:
+    class Iterator;
+
+    // constructor
+    // order = 0: nodes split when their page is full (fanout follows key length)
+    // order > 0: nodes also split once they reach order keys (small orders make deep trees, for testing)
+    BPlusTree(BufferPool* buffer_pool, PageManager* page_manager, int order = 0);
+
+    // insert a key-value pair into the tree
+    // returns false if the key is longer than MAX_KEY_SIZE
+    bool insert(const string& key, uint64_t value);
+
+    // search for key, return file position (0 if not found)
+    uint64_t search(const string& key);
+
+    // batch versions: the batch is sorted and every node on the way is visited once for all the keys below it
+    // insertBatch is the same as insert() for each pair (in batch order), all entries landing in one leaf
+    // are merged with a single load/save and the resulting splits are applied together
+    // returns how many pairs were inserted (keys longer than MAX_KEY_SIZE are skipped)
+    size_t insertBatch(const vector<pair<string, uint64_t>>& entries);
+    // values for keys, in the same order (0 where a key isn't found)
+    vector<uint64_t> searchBatch(const vector<string>& keys);
+
+    // remove one entry with key, returns false if there is none
+    // a leaf that gets too empty borrows from or merges with a sibling (up the tree as needed),
+    // the root collapses when it's left with one child, freed pages go back to the PageManager
+    // runs concurrently like insert unless it has to rebalance, then it's a whole-tree operation
+    bool remove(const string& key);
+
+    // merge runs of sparse neighbouring nodes (children of the same parent) into as few nodes as fit,
+    // level by level, and free the emptied pages; a whole-tree operation, returns how many pages were freed
+    size_t compact();
+
+    // pages the tree's nodes are on, parents before children (page 0 isn't a node); a whole-tree operation
+    vector<uint32_t> pageIds();
+
+    // ordered iteration over the leaf chain (see Iterator below)
+    // first entry with key >= key (invalid iterator if there is none)
+    Iterator lowerBound(const string& key);
+    // entry with exactly this key (invalid iterator if it isn't there)
+    Iterator seek(const string& key);
+    // smallest / largest entry
+    Iterator first();
+    Iterator last();
+
+    // call callback for every entry with begin <= key < end, in key order (empty end: no upper bound)
+    // stops early if callback returns false, returns how many entries were visited
+    size_t scan(const string& begin, const string& end, const function<bool(const string&, uint64_t)>& callback);
+
+    // per-leaf Bloom filters (see leaf_filter.h): search/searchBatch skip the leaf page for keys its filter rules out
+    // rate: false positive rate filters are sized for (default 1%, 0 = off), memory: cap on all filters (default 16MB)
+    void setFilterFalsePositiveRate(double rate) { leaf_filters_.setFalsePositiveRate(rate); }
+    void setFilterMemoryLimit(size_t bytes) { leaf_filters_.setMemoryLimit(bytes); }
+    size_t filterMemoryUsage() const { return leaf_filters_.memoryUsage(); }
+
+private:
+    friend class BulkLoader;  // builds nodes and installs the root directly
+
+    class WriteLatches;
+    class Exclusive;
+
+    // how full compact() packs nodes
+    static constexpr double COMPACT_FILL = 0.9;
+
+    // deepest path descend() records (page 0 + every level), far more than 2^32 pages need
+    static constexpr size_t MAX_HEIGHT = 40;
+
+    // nodes from page 0 (which stands in for the root's parent) down to a leaf, with the versions they were read at
+    struct Path {
+        uint32_t page_ids[MAX_HEIGHT];
+        uint64_t versions[MAX_HEIGHT];
+        size_t size = 0;
+    };
+
+    BufferPool* buffer_pool_;
+    PageManager* page_manager_;  // for allocating pages
+    atomic<uint32_t> root_page_id_;  // page ID instead of pointer, 0 means empty tree (changes under page 0's latch)
+    int order_;
+
+    VersionLatchTable latches_;
+    LeafFilterTable leaf_filters_;  // only leaves have filters; dropped when the tree frees or allocates a page
+    shared_mutex exclusive_mutex_;  // inserts hold it shared, whole-tree operations exclusive
+    atomic<uint64_t> tree_version_;  // odd while a whole-tree operation runs, readers check it didn't move
+
+    // optimistic descent to the leaf for key (and its value if value isn't nullptr)
+    // returns false if a writer changed a node on the way (restart)
+    bool descend(const string& key, Path& path, uint64_t* value);
+    // one optimistic insert attempt, false means restart
+    bool tryInsert(const string& key, uint64_t value);
+
+    // remove: an optimistic attempt on the leaf alone, and the rebalancing descent when that's not enough
+    enum class RemoveAttempt { Restart, NotFound, Removed, Underfull };
+    RemoveAttempt tryRemove(const string& key);
+    // returns true if the node at page_id is underfull afterwards, removed says whether key was found
+    bool removeHelper(uint32_t page_id, const string& key, bool& removed);
+    // merge children left_index and left_index + 1 of parent into the left one if the result fits in limit bytes
+    // (and isn't full), otherwise with redistribute spread their entries evenly over both
+    // returns true if they were merged (the right page is freed and parent updated)
+    bool joinChildren(Node& parent, size_t left_index, uint32_t limit, bool redistribute);
+    // replace a root that has a single child by that child (an empty root leaf by an empty tree)
+    void collapseRoot();
+    size_t compactHelper(uint32_t page_id);
+    // page_id and every page below it, appended to page_ids
+    void collectPages(uint32_t page_id, vector<uint32_t>& page_ids);
+    // true if node takes one more separator without splitting, whatever its length
+    bool canAbsorb(const Node& node) const;
+    // tree version once no whole-tree operation is running
+    uint64_t stableTreeVersion() const;
+
+    // insert helper, returns page id of the new right child if split, otherwise 0
+    uint32_t insertHelper(uint32_t page_id, const string& key, uint64_t value, string& promotedKey, uint32_t& newRightChildPage);
+    // batch helpers, order holds count indexes into entries/keys sorted by key
+    // the node at page_id reports the pages it split off (and the separator left of each) in separators/new_pages
+    void insertBatchHelper(uint32_t page_id, const vector<pair<string, uint64_t>>& entries, const size_t* order, size_t count,
+        vector<string>& separators, vector<uint32_t>& new_pages);
+    // parent_id/parent_version: the node page_id was found in (lock coupling, keys fall back to search() on a change)
+    void searchBatchHelper(uint32_t page_id, uint32_t parent_id, uint64_t parent_version,
+        const vector<string>& keys, const size_t* order, size_t count, vector<uint64_t>& results);
+    // save node at page_id, first cutting it into as many nodes as it takes for none to be full
+    void splitAndSave(uint32_t page_id, Node& node, vector<string>& separators, vector<uint32_t>& new_pages);
+    void splitPieces(Node& node, vector<Node>& pieces, vector<string>& separators) const;
+    // one cut at splitIndex: middle is the separator to push up (a leaf split keeps it, an internal one moves it up)
+    void splitNode(const Node& node, Node& left, Node& right, string& middle) const;
+    // same, cut before key split_index (1 .. num keys - 1 for a leaf, 1 .. num keys - 2 for an internal node)
+    void splitNodeAt(const Node& node, int split_index, Node& left, Node& right, string& middle) const;
+
+    // split decisions
+    bool isFull(const Node& node) const;
+    // node is empty enough to borrow or merge
+    bool isUnderfull(const Node& node) const;
+    int splitIndex(const Node& node) const;
+    // shortest key that is > left and <= right, pushed up instead of the whole right key (suffix truncation)
+    static string separator(const string& left, const string& right);
+
+    // search helpers
+    uint32_t findLeaf(const string& key);
+    // leftmost or rightmost leaf
+    uint32_t edgeLeaf(bool leftmost);
+    
+    // page-based node operations
+    void loadNode(uint32_t page_id, Node& node);
+    void saveNode(uint32_t page_id, const Node& node);
+    uint32_t allocateNode(bool is_leaf);
+    
+    // persistence for root_page_id_
+    void loadRootPageId();
+    void saveRootPageId();
+
+};
+
+// latches one insert holds, released when it goes away
+// pages whose latches share a slot are locked once
+class BPlusTree::WriteLatches {
+public:
+    WriteLatches(VersionLatchTable& table) : table_(table), size_(0) {}
+    ~WriteLatches() {
+        for (size_t i = 0; i < size_; i++) {
+            table_.unlock(page_ids_[i]);
+        }
+    }
+
+    WriteLatches(const WriteLatches&) = delete;
+    WriteLatches& operator=(const WriteLatches&) = delete;
+
+    // lock page if its latch is still at version (read on the way down), false means restart
+    bool lock(uint32_t page_id, uint64_t version) {
+        for (size_t i = 0; i < size_; i++) {
+            if (VersionLatchTable::slot(page_ids_[i]) == VersionLatchTable::slot(page_id)) {
+                return versions_[i] == version;
+            }
+        }
+        if (size_ == MAX_HEIGHT + 1 || !table_.tryUpgrade(page_id, version)) {
+            return false;
+        }
+        page_ids_[size_] = page_id;
+        versions_[size_] = version;
+        size_++;
+        return true;
+    }
+
+    // lock page at whatever version it's at now (a node we hold points at it), false if it's taken
+    bool lockCurrent(uint32_t page_id) {
+        for (size_t i = 0; i < size_; i++) {
+            if (VersionLatchTable::slot(page_ids_[i]) == VersionLatchTable::slot(page_id)) {
+                return true;
+            }
+        }
+        return lock(page_id, table_.version(page_id));
+    }
+
+private:
+    VersionLatchTable& table_;
+    uint32_t page_ids_[MAX_HEIGHT + 1];  // a path plus the leaf's right neighbour
+    uint64_t versions_[MAX_HEIGHT + 1];
+    size_t size_;
+};
+
+// whole-tree operations (batch insert, bulk load): waits for inserts to drain and keeps new ones out,
+// lookups running meanwhile see the tree version move and restart
+class BPlusTree::Exclusive {
+public:
+    Exclusive(BPlusTree* tree) : tree_(tree), lock_(tree->exclusive_mutex_) {
+        tree_->tree_version_.fetch_add(1);
+    }
+    ~Exclusive() {
+        tree_->tree_version_.fetch_add(1);
+    }
+
+    Exclusive(const Exclusive&) = delete;
+    Exclusive& operator=(const Exclusive&) = delete;
+
+private:
+    BPlusTree* tree_;
+    unique_lock<shared_mutex> lock_;
+};
+
+// slotted page layout of a node (offsets into the page, after the page header):
+//   node header: is_leaf u8, num_keys u16, next/prev leaf u32, leftmost child u32, heap start u16, prefix length u16
+//   slot directory: one u16 cell offset per key, in key order
+//   prefix: the bytes every key in the node starts with, stored once at the very end of the page
+//   cells, packed below the prefix: suffix length u16, key bytes after the prefix,
+//   value u64 (leaf) or right child u32 (internal)
+constexpr uint32_t NODE_IS_LEAF = PAGE_HEADER_SIZE;
+constexpr uint32_t NODE_NUM_KEYS = PAGE_HEADER_SIZE + 2;
+constexpr uint32_t NODE_NEXT_PAGE = PAGE_HEADER_SIZE + 4;
+constexpr uint32_t NODE_PREV_PAGE = PAGE_HEADER_SIZE + 8;
+constexpr uint32_t NODE_LEFTMOST_CHILD = PAGE_HEADER_SIZE + 12;
+constexpr uint32_t NODE_HEAP_START = PAGE_HEADER_SIZE + 16;
+constexpr uint32_t NODE_PREFIX_LEN = PAGE_HEADER_SIZE + 18;
+constexpr uint32_t NODE_SLOTS = PAGE_HEADER_SIZE + 20;
+constexpr uint32_t SLOT_SIZE = 2;
+
+struct Node {
+    bool is_leaf;
+    vector<string> keys;
+    vector<uint64_t> values; // for leaf nodes, values are file positions
+    vector<uint32_t> children_page_ids; // internal nodes
+    uint32_t next_page_id; // for leaf nodes, points to next leaf node in linked list
+    uint32_t prev_page_id; // for leaf nodes, points to previous leaf node (reverse scans)
+    uint32_t page_id;
+
+    Node(bool leaf = false) : is_leaf(leaf), next_page_id(0), prev_page_id(0), page_id(0) {}
+
+    void serializeToPage(Page& page) const; // write node data to page
+    void deserializeFromPage(const Page& page); // read node data from page
+
+    // length of the prefix all keys share (stored once per page, cells only hold the rest)
+    uint32_t prefixLength() const;
+    // bytes cell i takes in the page with prefix_len bytes cut off its key, and bytes the whole node takes serialized
+    uint32_t cellSize(size_t i, uint32_t prefix_len = 0) const;
+    uint32_t byteSize() const;
+
+};
+
+// read-only view of a node straight on its page, for lookups
+// binary-searches the slot directory and compares keys in place, no allocation and no copy;
+// the page must stay pinned while the view is in use (Node is still used to modify nodes)
+class NodeView {
+public:
+    NodeView(const Page& page);
+
+    bool isLeaf() const { return is_leaf_; }
+    uint16_t numKeys() const { return num_keys_; }
+    uint32_t nextPageId() const { return page_.readUint32(NODE_NEXT_PAGE); }
+    uint32_t prevPageId() const { return page_.readUint32(NODE_PREV_PAGE); }
+
+    // compares key with the key in slot i (<0, 0, >0 like string::compare)
+    int compare(const string& key, uint16_t i) const;
+
+    // first slot whose key is >= key / > key (numKeys() if there is none)
+    uint16_t lowerBound(const string& key) const;
+    uint16_t upperBound(const string& key) const;
+
+    // whole key in slot i (prefix + suffix), just the prefix for a corrupt cell
+    string key(uint16_t i) const;
+
+    // value of leaf slot i, child i of an internal node (0..numKeys(), 0 = corrupt cell)
+    uint64_t value(uint16_t i) const;
+    uint32_t child(uint16_t i) const;
+
+    // child to follow for key: the first child whose key range can hold it
+    uint32_t childFor(const string& key) const { return child(upperBound(key)); }
+
+private:
+    const Page& page_;
+    bool is_leaf_;
+    uint16_t num_keys_;
+    uint16_t prefix_len_;
+
+    // bounds-checked cell of slot i, false if the slot points outside the page
+    bool cell(uint16_t i, uint32_t& offset, uint16_t& key_len) const;
+    // key against the node prefix only, and the part of key after the prefix against slot i's suffix
+    int comparePrefix(const string& key) const;
+    int compareSuffix(const string& key, uint16_t i) const;
+};
+
+// cursor over the leaf chain, forward (next) and backward (prev)
+// holds a copy of one leaf at a time, nothing stays pinned between calls, so the caller may
+// keep it around while doing other work (entries inserted meanwhile may or may not be seen)
+class BPlusTree::Iterator {
+public:
+    Iterator() : tree_(nullptr), index_(0) {}
+
+    bool valid() const { return tree_ != nullptr && index_ >= 0 && index_ < static_cast<int>(leaf_.keys.size()); }
+    const string& key() const { return leaf_.keys[index_]; }
+    uint64_t value() const { return leaf_.values[index_]; }
+
+    // move to the next / previous entry, the iterator becomes invalid past either end
+    void next();
+    void prev();
+
+private:
+    friend class BPlusTree;
+
+    BPlusTree* tree_;
+    Node leaf_;
+    int index_;
+
+    // load a leaf and have the kernel start reading the one after it in the scan direction
+    void loadLeaf(uint32_t page_id, bool forward);
+};
@@ -1,44 +1,309 @@
-#pragma once
-
-#include "page.h"
-#include "page_manager.h"
-#include <unordered_map>
-#include <list>
-#include <cstdint>
-
-using namespace std;
-
-class BufferPool {
-public:
-    BufferPool(PageManager* page_manager, size_t max_pages = 100);
-    ~BufferPool();
-
-    // get a page
-    void getPage(uint32_t page_id, Page& page);
-
-    // save/modify a page
-    void savePage(uint32_t page_id, const Page& page);
-
-    // pin/unpin pages
-    void pinPage(uint32_t page_id);
-    void unpinPage(uint32_t page_id);
-
-    void flushAll();
-
-private:
-    PageManager* page_manager_;
-    unordered_map<uint32_t, Page> cache_; // page_id->page (actual cache)
-    unordered_map<uint32_t, bool> pinned_;
-    unordered_map<uint32_t, bool> dirty_;
-    list<uint32_t> lru_list_;
-    unordered_map<uint32_t, list<uint32_t>::iterator> lru_map_; // page_id->iterator in LRU list, for fast access
-    size_t max_pages_;
-
-    // evict a page when cache is full
-    void evictPage(uint32_t page_id);
-
-    // helper methods
-    void moveToFront(uint32_t page_id);
-    void flushPage(uint32_t page_id);
-
-};
\ No newline at end of file
+#pragma once
+
+#include "page.h"
+#include "page_manager.h"
+#include "log_manager.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+using namespace std;
+
+class BufferPool;
+
+// RAII handle for reading a cached page in place
+// the frame stays pinned (can't be evicted) until the guard is destroyed or released
+class ReadPageGuard {
+public:
+    ReadPageGuard() : buffer_pool_(nullptr), page_(nullptr), page_id_(0), frame_id_(0) {}
+    ReadPageGuard(BufferPool* buffer_pool, uint32_t page_id, uint32_t frame_id, Page* page);
+    ~ReadPageGuard();
+
+    // guards are move-only, a copy would unpin the frame twice
+    ReadPageGuard(const ReadPageGuard&) = delete;
+    ReadPageGuard& operator=(const ReadPageGuard&) = delete;
+    ReadPageGuard(ReadPageGuard&& other) noexcept;
+    ReadPageGuard& operator=(ReadPageGuard&& other) noexcept;
+
+    // direct access to the cached bytes (no copy)
+    const Page& page() const { return *page_; }
+    const char* data() const { return page_->data; }
+    uint32_t pageId() const { return page_id_; }
+    bool valid() const { return page_ != nullptr; }
+
+    // unpin early, guard is empty afterwards
+    void release();
+
+private:
+    BufferPool* buffer_pool_;
+    Page* page_;
+    uint32_t page_id_;
+    uint32_t frame_id_;
+};
+
+// RAII handle for modifying a cached page in place
+// marks the page dirty and unpins it when destroyed or released
+class WritePageGuard {
+public:
+    WritePageGuard() : buffer_pool_(nullptr), page_(nullptr), page_id_(0), frame_id_(0) {}
+    WritePageGuard(BufferPool* buffer_pool, uint32_t page_id, uint32_t frame_id, Page* page);
+    ~WritePageGuard();
+
+    WritePageGuard(const WritePageGuard&) = delete;
+    WritePageGuard& operator=(const WritePageGuard&) = delete;
+    WritePageGuard(WritePageGuard&& other) noexcept;
+    WritePageGuard& operator=(WritePageGuard&& other) noexcept;
+
+    Page& page() { return *page_; }
+    char* data() { return page_->data; }
+    uint32_t pageId() const { return page_id_; }
+    bool valid() const { return page_ != nullptr; }
+
+    void release();
+
+private:
+    BufferPool* buffer_pool_;
+    Page* page_;
+    uint32_t page_id_;
+    uint32_t frame_id_;
+};
+
+// thread-safe page cache, split into hash-partitioned instances
+// each partition has its own latch, page table and clock hand; each frame has a reader/writer latch
+// (read guards share the frame latch, write guards hold it exclusively)
+// a background cleaner thread writes dirty pages back (sorted by page id, neighbours coalesced)
+// whenever more than the dirty watermark are dirty, so eviction almost always finds a clean frame
+// with a LogManager every page written through a guard is logged (redo) and stamped with its LSN,
+// the log is forced up to a page's LSN before the page itself is written (WAL-before-data)
+class BufferPool {
+public:
+    // num_partitions = 0 picks one based on hardware threads and pool size
+    // log_manager: optional write-ahead log, recovery runs here before anything is cached
+    // (the log manager has to outlive the pool)
+    BufferPool(PageManager* page_manager, size_t max_pages = 100, size_t num_partitions = 0, LogManager* log_manager = nullptr);
+    ~BufferPool();
+
+    // no copying, the pool owns its frame array
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // get a pinned, read-latched page, no copy is made
+    // waits while every frame in the page's partition is pinned (empty guard only if there is no PageManager)
+    // if the PageManager is in ReadOnlyMmap mode the guard points straight into the mapping (no frame at all)
+    ReadPageGuard fetchPage(uint32_t page_id);
+
+    // get a pinned, write-latched page, page is marked dirty when the guard goes away
+    // always an empty guard in ReadOnlyMmap mode
+    WritePageGuard fetchPageWrite(uint32_t page_id);
+
+    // get a page (copies the whole frame, prefer fetchPage)
+    void getPage(uint32_t page_id, Page& page);
+
+    // save/modify a page (copies the whole frame, prefer fetchPageWrite)
+    void savePage(uint32_t page_id, const Page& page);
+
+    // read count pages starting at first_page_id into the pool ahead of use, as one batch of async reads
+    // pages already cached or past end of file are skipped, at most half the pool is filled per call
+    // the pool also does this by itself when it sees misses on consecutive page ids (read-ahead)
+    void prefetch(uint32_t first_page_id, uint32_t count);
+
+    // pin/unpin pages
+    void pinPage(uint32_t page_id);
+    void unpinPage(uint32_t page_id);
+
+    // forget a cached page whose contents no longer matter (it was freed), without writing it back,
+    // so the page can be written around the pool; true unless the frame is pinned or being flushed
+    bool discardPage(uint32_t page_id);
+
+    // most frames allowed to be dirty before the cleaner starts writing (default: a quarter of the pool)
+    void setDirtyWatermark(size_t max_dirty_frames);
+
+    // write every dirty page back
+    // with a LogManager this is a checkpoint: log forced first, page file synced, then the log cut up to
+    // the oldest change still only in the log (emptied if every page could be written)
+    void flushAll();
+
+    // log size past which the cleaner checkpoints on its own (default CHECKPOINT_LOG_BYTES)
+    void setCheckpointLogSize(uint64_t bytes);
+
+    // pages written by this thread between begin and end are logged as one record (see AtomicOperation)
+    // they can't be evicted or flushed until then; an operation writing more than half a partition's
+    // frames is logged in pieces instead
+    void beginOperation();
+    void endOperation();
+
+    // give a page the caller no longer references back to the PageManager
+    // inside an operation the free waits until the operation is logged, and the saved free map only
+    // picks it up once that record is durable (see PageManager::freePage)
+    void freePage(uint32_t page_id);
+
+private:
+    friend class ReadPageGuard;
+    friend class WritePageGuard;
+
+    static constexpr uint32_t INVALID_PAGE_ID = UINT32_MAX;
+    static constexpr uint32_t INVALID_FRAME_ID = UINT32_MAX;
+
+    // dirty pages handed to the I/O engine per flush batch
+    static constexpr size_t FLUSH_BATCH_SIZE = 128;
+
+    // consecutive misses on neighbouring pages before read-ahead starts, and how far it reads
+    static constexpr uint32_t READAHEAD_TRIGGER = 4;
+    static constexpr uint32_t READAHEAD_PAGES = 32;
+
+    // how often the cleaner looks at the pool when nobody wakes it
+    static constexpr chrono::milliseconds CLEANER_INTERVAL{100};
+
+    // log size that makes the cleaner checkpoint, keeps the log (and recovery) bounded under steady writes
+    static constexpr uint64_t CHECKPOINT_LOG_BYTES = 16 << 20;
+
+    // how often a miss yields waiting for a frame to become evictable, then how long it sleeps between tries
+    static constexpr int VICTIM_RETRIES = 64;
+    static constexpr chrono::microseconds VICTIM_BACKOFF{200};
+
+    // page table slot, 8 slots per cache line
+    struct PageTableEntry {
+        uint32_t page_id;
+        uint32_t frame_id;
+    };
+
+    // one slice of the pool, owns frames [frame_begin, frame_end)
+    // latch protects everything in here plus frame_page_ids_/referenced_/flushing_ of its frames
+    struct alignas(64) Partition {
+        mutex latch;
+        uint32_t frame_begin = 0;
+        uint32_t frame_end = 0;
+        uint32_t clock_hand = 0;
+        vector<uint32_t> free_frames;  // frames never used yet (stack)
+
+        // flat open-addressing page table (linear probing), page_id->frame_id
+        vector<PageTableEntry> page_table;
+        uint32_t table_mask = 0;
+    };
+
+    PageManager* page_manager_;
+    LogManager* log_manager_;
+    size_t max_pages_;
+    size_t num_partitions_;
+    size_t operation_limit_;  // pages an open operation may hold before it is logged in pieces
+    unique_ptr<Partition[]> partitions_;
+    mutex flush_mutex_;  // serializes flushAll and the cleaner
+
+    // contiguous, page-aligned frame array (allocated once)
+    Page* frames_;
+
+    // per-frame metadata, struct-of-arrays so the clock sweep stays in a few cache lines
+    vector<uint32_t> frame_page_ids_;  // frame->page_id (INVALID_PAGE_ID if free)
+    vector<uint8_t> referenced_;  // clock reference bit
+    vector<uint8_t> flushing_;  // being written back (flushAll batch or eviction), nobody else may write it or evict it (an older write could land last)
+    unique_ptr<atomic<uint32_t>[]> pin_counts_;  // only raised under the partition latch
+    unique_ptr<atomic<uint8_t>[]> dirty_;  // only set while the frame is write-latched
+    unique_ptr<atomic<uint32_t>[]> write_counts_;  // bumped on every dirty release, lets flushAll spot writes made during its I/O
+    unique_ptr<atomic<uint32_t>[]> operation_refs_;  // open operations holding unlogged changes to the frame, can't be evicted or flushed
+    unique_ptr<atomic<uint64_t>[]> recovery_lsns_;  // while dirty: no logged change to the page below this LSN is missing on disk
+    unique_ptr<shared_mutex[]> frame_latches_;
+
+    // sequential miss detection for read-ahead (a heuristic, races between threads only cost accuracy)
+    atomic<uint32_t> last_miss_page_;
+    atomic<uint32_t> sequential_misses_;
+
+    // background writeback
+    atomic<size_t> dirty_count_;
+    atomic<size_t> dirty_watermark_;
+    atomic<uint64_t> checkpoint_log_bytes_;
+    atomic<uint64_t> checkpoint_log_base_;  // log size the last checkpoint left (it can't always cut everything)
+    thread cleaner_;
+    mutex cleaner_mutex_;
+    condition_variable cleaner_wake_;
+    bool cleaner_stop_;
+
+    Partition& partitionFor(uint32_t page_id);
+
+    // page table helpers (caller holds the partition latch)
+    uint32_t slotFor(const Partition& partition, uint32_t page_id) const;
+    uint32_t lookup(const Partition& partition, uint32_t page_id) const;
+    void tableInsert(Partition& partition, uint32_t page_id, uint32_t frame_id);
+    void tableErase(Partition& partition, uint32_t page_id);
+
+    // find the frame for page_id and pin it, bringing it in on a miss
+    // the disk read happens outside the partition latch with the frame write-latched,
+    // so anyone else asking for the page waits on the frame latch, not the partition
+    // returns with the frame latched (shared or exclusive); while every frame is pinned it waits for one to free up
+    // (INVALID_FRAME_ID only without a page manager)
+    uint32_t fetchFrame(uint32_t page_id, bool exclusive, bool read_from_disk);
+
+    // pick an unpinned clean frame in the partition and unmap it, writing back dirty victims
+    // called and returns with the partition latch held (latch is dropped during writeback)
+    uint32_t findVictim(Partition& partition, unique_lock<mutex>& partition_latch);
+
+    // called by guards when they go away
+    void releasePage(uint32_t frame_id, bool exclusive, bool is_dirty);
+
+    // release a write-latched frame after a change: log it now, or remember it for the
+    // thread's open operation, then mark dirty and unpin
+    void releaseWritten(uint32_t frame_id, uint32_t page_id);
+
+    // log the pages of a finished operation as one record
+    void logOperation(vector<uint32_t>& page_ids);
+
+    // write a pinned frame back if dirty (takes the shared frame latch), caller has set flushing_
+    void flushFrame(uint32_t frame_id);
+
+    // copies of dirty frames waiting to be written by flushAll
+    struct FlushBatch {
+        vector<uint32_t> frame_ids;
+        vector<uint32_t> page_ids;
+        vector<uint32_t> write_counts;  // write_counts_ of each frame when it was copied
+        vector<const Page*> pages;
+
+        void reserve(size_t n) { frame_ids.reserve(n); page_ids.reserve(n); write_counts.reserve(n); pages.reserve(n); }
+        void clear() { frame_ids.clear(); page_ids.clear(); write_counts.clear(); pages.clear(); }
+    };
+
+    // copy up to max_frames dirty frames into batches and write them (caller holds flush_mutex_)
+    // returns true if frames had to be skipped: unlogged changes (open operations) or an eviction writing them back
+    bool writeDirtyFrames(size_t max_frames);
+
+    // write back what can be written, sync, and cut the log below the oldest change still missing on disk
+    // (caller holds flush_mutex_, needs a LogManager and a PageManager)
+    void checkpoint();
+
+    // true once the log has grown checkpoint_log_bytes_ past what the last checkpoint left
+    bool logNeedsCheckpoint() const;
+
+    void cleanerLoop();
+
+    // called after every miss, reads ahead once misses look like a sequential scan
+    void readAhead(uint32_t page_id);
+
+    // hand a batch of page copies to the disk sorted by page id (runs of neighbours as one pwritev,
+    // the rest through the async I/O path), clear dirty bits of frames
+    // that weren't written to meanwhile, and empty the batch
+    void writeBatch(FlushBatch& batch);
+
+};
+
+// groups every page the current thread writes through the pool while it's alive into one log record,
+// so recovery applies all of them or none (a B+ tree split never comes back half done)
+// does nothing if the pool has no LogManager
+class AtomicOperation {
+public:
+    explicit AtomicOperation(BufferPool* buffer_pool) : buffer_pool_(buffer_pool) {
+        if (buffer_pool_) buffer_pool_->beginOperation();
+    }
+    ~AtomicOperation() {
+        if (buffer_pool_) buffer_pool_->endOperation();
+    }
+
+    AtomicOperation(const AtomicOperation&) = delete;
+    AtomicOperation& operator=(const AtomicOperation&) = delete;
+
+private:
+    BufferPool* buffer_pool_;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "bplus_tree.h"
+#include "page.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// builds a BPlusTree bottom-up from keys that arrive already sorted
+// leaves are packed left to right to the fill factor, every finished node hands its first key
+// (as a separator) and page id up to the level above, which fills the same way
+// each level holds its last finished node back until the next one is done, so finish() can even out the
+// last two when the last one would be underfull (no non-root node ends up with too few keys)
+// pages go straight to the PageManager in sequential batches, nothing goes through the buffer pool
+//
+// finish() replaces the tree's contents: the new root is installed in page 0 and the old tree's pages are
+// freed (given back once page 0 no longer points at them). nobody else may use the tree while it's being loaded
+class BulkLoader {
+public:
+    // fill_factor: how full a node gets before the next one starts (0.1 - 1.0), leaving room
+    // means later inserts don't split right away
+    BulkLoader(BPlusTree* tree, double fill_factor = 0.9);
+
+    // writes nothing if finish() wasn't called (the tree is unchanged)
+    ~BulkLoader() = default;
+
+    BulkLoader(const BulkLoader&) = delete;
+    BulkLoader& operator=(const BulkLoader&) = delete;
+
+    // append the next pair, keys must be strictly increasing
+    // returns false (and ignores the pair) if the key is out of order or longer than MAX_KEY_SIZE
+    bool add(const string& key, uint64_t value);
+
+    // write the last nodes, build the levels above up to a single root, make it all durable and install the root
+    // returns false if it was already called
+    bool finish();
+
+    // number of pairs added so far
+    size_t size() const { return count_; }
+
+private:
+    // one node being filled per level, level 0 is the leaf
+    struct Level {
+        Node node;
+        uint32_t key_bytes = 0;  // sum of key lengths, so the node size is known without walking it
+        string low_separator;  // separator between this node and its left sibling, goes up when it's written
+        Node held;  // the node finished before this one, not written yet (its page id already went up)
+        uint32_t held_page_id = 0;  // 0: none
+    };
+
+    static constexpr size_t WRITE_BATCH = 64;  // pages written per sequential batch
+
+    BPlusTree* tree_;
+    PageManager* page_manager_;
+    uint32_t byte_limit_;  // node size the fill factor allows
+    vector<Level> levels_;
+    uint32_t leaf_page_id_;  // page the current leaf will be written to (known early for the next links)
+    uint32_t prev_leaf_page_id_;
+    string last_key_;
+    size_t count_;
+    bool finished_;
+
+    // pages reserved ahead as one extent past the end of the file, [extent_next_, extent_end_) still unused
+    uint32_t extent_next_;
+    uint32_t extent_end_;
+
+    // finished pages waiting to be written
+    vector<uint32_t> pending_ids_;
+    vector<Page> pending_pages_;
+
+    // true if key (plus its value or child) still fits in level's node
+    bool fits(const Level& level, const string& key) const;
+
+    // add a separator and the child right of it to the node at level, writing the node first if it's full
+    void addChild(size_t level, string separator, uint32_t child_page_id);
+
+    // finish the leaf, next_page_id is the leaf after it
+    void writeLeaf(uint32_t next_page_id);
+
+    // the node at level is done and goes to page_id: queue the one held back before it, hold this one
+    void holdNode(size_t level, uint32_t page_id);
+
+    // if the level's last node is underfull, share the keys of it and the held node evenly
+    // returns false if both went into the held node instead (an even split would still be underfull), the last node is gone then
+    bool balanceLast(size_t level);
+
+    // serialize a node into the write batch
+    void queueNode(uint32_t page_id, const Node& node);
+    void writePending();
+
+    uint32_t allocatePage();
+};
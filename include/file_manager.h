@@ -1,42 +1,100 @@
-#pragma once // header guard to prevent multiple includes in compilation
-
-#include "page.h"
-#include <string>
-#include <fstream> // for file input/output
-#include <cstdint> // gives fixed width integers
-using namespace std;
-
-class FileManager {
-public:
-    // constructor, opens the file
-    FileManager(const string& filename);
-
-    // destructor, closes the file
-    ~FileManager();
-
-    // read data from specific position in the file
-    // position: where to start reading (byte offset)
-    // size: how many bytes to read
-    // returns: the data read as a string
-    string read(size_t position, size_t size);
-
-    // write data to end of the file
-    // data: the data to write
-    // returns: the position where data was written
-    uint64_t write(const string& data);
-
-    // get file size
-    // returns: size of file in bytes
-    uint64_t size();
-
-    // read page by page ID
-    void readPage(uint32_t page_id, Page& page);
-
-    // write page by page ID
-    void writePage(uint32_t page_id, const Page& page);
-
-private:
-    string filename_; // store the filename
-    fstream file_; // the file stream object
-};
-
+#pragma once // header guard to prevent multiple includes in compilation
+
+#include "page.h"
+#include "io_engine.h"
+#include <string>
+#include <cstdint> // gives fixed width integers
+#include <atomic>
+#include <mutex>
+#include <memory>
+using namespace std;
+
+// how many page I/Os a batch keeps in flight
+constexpr unsigned IO_QUEUE_DEPTH = 64;
+
+// page file built on a raw file descriptor and positional I/O (pread/pwrite/pwritev)
+// there is no shared file position, so any number of threads can read and write at once
+class FileManager {
+public:
+    // constructor, opens the file
+    // read_only: open an existing file without write access, writes are ignored
+    // direct_io: bypass the OS page cache (O_DIRECT), falls back to buffered I/O if the filesystem refuses it
+    FileManager(const string& filename, bool read_only = false, bool direct_io = false);
+
+    // destructor, closes the file
+    ~FileManager();
+
+    // no copying, we own the file descriptor
+    FileManager(const FileManager&) = delete;
+    FileManager& operator=(const FileManager&) = delete;
+
+    // read data from specific position in the file
+    // position: where to start reading (byte offset)
+    // size: how many bytes to read
+    // returns: the data read as a string (zero-filled past end of file)
+    string read(size_t position, size_t size);
+
+    // read size bytes at position straight into out (zero-filled past end of file)
+    void readAt(uint64_t position, char* out, size_t size);
+
+    // write data to end of the file
+    // data: the data to write
+    // returns: the position where data was written
+    uint64_t write(const string& data);
+
+    // write size bytes at position (anywhere, not just the end), the file grows to cover them
+    void writeAt(uint64_t position, const char* data, size_t size);
+
+    // get file size
+    // returns: size of file in bytes (cached, no syscall)
+    uint64_t size();
+
+    // read page by page ID, straight into page.data
+    void readPage(uint32_t page_id, Page& page);
+
+    // write page by page ID
+    void writePage(uint32_t page_id, const Page& page);
+
+    // write count pages with consecutive IDs starting at first_page_id in one pwritev
+    void writePages(uint32_t first_page_id, const Page* const* pages, size_t count);
+
+    // read/write a batch of pages with arbitrary IDs, keeping up to IO_QUEUE_DEPTH requests in flight
+    // a page that can't be read comes back cleared, with failed[i] set if failed is given
+    void readPageBatch(const uint32_t* page_ids, Page* const* pages, size_t count, uint8_t* failed = nullptr);
+    void writePageBatch(const uint32_t* page_ids, const Page* const* pages, size_t count);
+
+    // flush written data to stable storage (fdatasync)
+    void sync();
+
+    // cut the file down to size bytes (appends continue from there)
+    void truncate(uint64_t size);
+
+    // tell the kernel a byte range will be read soon (posix_fadvise WILLNEED), returns right away
+    // no-op in direct mode, there is no page cache to fill
+    void adviseWillNeed(uint64_t offset, uint64_t length);
+
+    // true if the file really is open with O_DIRECT
+    bool directIo() const { return direct_io_; }
+
+private:
+    string filename_; // store the filename
+    int fd_; // the file descriptor, -1 if open failed
+    bool read_only_;
+    bool direct_io_;
+    atomic<uint64_t> size_; // logical file size (end of last write)
+    uint64_t allocated_size_; // bytes reserved on disk with fallocate, may run past size_
+    mutex extend_mutex_; // protects allocated_size_
+    unique_ptr<IoEngine> io_engine_; // async batch I/O (io_uring or thread pool)
+    mutex io_engine_mutex_; // one batch at a time goes through the engine
+    mutex bounce_mutex_; // serializes read-modify-write of partial blocks in direct mode
+
+    // byte-granular I/O in direct mode, staged through an aligned bounce buffer
+    void readBounced(uint64_t position, char* out, size_t size);
+    void writeBounced(uint64_t position, const char* in, size_t size);
+
+    // reserve disk space up to at least end, in large chunks so writes at the tail don't fragment
+    void reserve(uint64_t end);
+
+    // move size_ forward to end if it is past it
+    void growSize(uint64_t end);
+};
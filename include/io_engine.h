@@ -0,0 +1,94 @@
+#pragma once
+
+#include "page.h"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sys/uio.h>
+
+using namespace std;
+
+// one page-sized read or write at a byte offset
+struct IoRequest {
+    uint64_t offset = 0;
+    Page* page = nullptr;  // source for writes, destination for reads
+    bool is_write = false;
+    int result = 0;  // after completion: bytes transferred, or -errno (a failed read leaves the page zeroed)
+    struct iovec iov;  // owned by the request, must stay put until it completes
+};
+
+// asynchronous batched page I/O on a file descriptor
+// uses io_uring when the kernel allows it, otherwise a small pool of threads doing pread/pwrite
+// submit/complete are meant for one thread at a time (callers serialize batches)
+class IoEngine {
+public:
+    // queue_depth: how many requests may be in flight at once
+    // use_uring = false forces the thread pool (for kernels/sandboxes without io_uring)
+    IoEngine(int fd, unsigned queue_depth = 64, bool use_uring = true);
+    ~IoEngine();
+
+    IoEngine(const IoEngine&) = delete;
+    IoEngine& operator=(const IoEngine&) = delete;
+
+    // queue up to count requests, returns how many were accepted (limited by free queue slots)
+    // requests the kernel refuses to take are finished synchronously before this returns
+    size_t submit(IoRequest* const* requests, size_t count);
+
+    // wait until at least min_completions requests finished, returns how many were reaped
+    // reaped requests have their result filled in (short transfers are finished synchronously, failed ones
+    // are retried synchronously once)
+    size_t complete(size_t min_completions);
+
+    // run a whole batch, keeping up to queue_depth requests in flight, returns once all are done
+    void run(IoRequest* const* requests, size_t count);
+
+    size_t inFlight() const { return in_flight_; }
+    unsigned queueDepth() const { return queue_depth_; }
+    bool usingUring() const { return ring_fd_ >= 0; }
+
+private:
+    int fd_;
+    unsigned queue_depth_;
+    size_t in_flight_;
+
+    // io_uring state (ring_fd_ < 0 means the thread pool is used)
+    int ring_fd_;
+    void* sq_ring_;
+    void* cq_ring_;
+    size_t sq_ring_size_;
+    size_t cq_ring_size_;
+    void* sqes_;
+    size_t sqes_size_;
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    void* cqes_;
+
+    bool setupUring();
+    void teardownUring();
+    size_t submitUring(IoRequest* const* requests, size_t count);
+    size_t completeUring(size_t min_completions);
+
+    // thread pool fallback
+    vector<thread> workers_;
+    mutex pool_mutex_;
+    condition_variable work_ready_;
+    condition_variable work_done_;
+    deque<IoRequest*> pending_;
+    size_t finished_;  // completed but not reaped yet
+    bool stopping_;
+
+    void startPool(unsigned threads);
+    void workerLoop();
+
+    // synchronous pread/pwrite of whatever is left of a request, a read that fails is zeroed
+    void finishSync(IoRequest* request, size_t already_done);
+};
@@ -1,38 +1,208 @@
-#pragma once
-
-#include <string>
-#include <unordered_map> // hash map for key-value pairs
-#include <cstdint> // gives fixed width integers
-#include "page_manager.h"
-#include <utility> // for pair
-#include "buffer_pool.h"
-
-using namespace std;
-
-class KVStore {
-public:
-
-    // constructor
-    KVStore(const string& filename); 
-
-    // destructor
-    ~KVStore();
-
-    // put 
-    bool put(const string& key, const string& value);
-
-    // get
-    string get(const string& key);
-
-    // remove
-    bool remove(const string& key);
-
-private:
-    PageManager page_manager_;
-    BufferPool* buffer_pool_;
-    unordered_map<string, pair<uint32_t, uint32_t>> index_; // key -> (page_id, offset)
-    void rebuildIndex();
-    uint32_t current_page_id_;
-    uint32_t current_offset_;
-};
-
+#pragma once
+
+#include <string>
+#include <unordered_map> // hash map for key-value pairs
+#include <cstdint> // gives fixed width integers
+#include "page_manager.h"
+#include <utility> // for pair
+#include <functional>
+#include <memory>
+#include <map>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "buffer_pool.h"
+#include "bplus_tree.h"
+
+using namespace std;
+
+// where KVStore keeps its key -> (page_id, offset) index
+enum class KVIndexMode {
+    Memory,  // hash map in RAM, rebuilt by scanning every data page on open
+    BTree  // BPlusTree in the same file and buffer pool: O(1) open, memory bounded by the pool, ordered keys
+};
+
+class KVStore {
+public:
+    // streams one big value into its overflow pages (see putStream), committing publishes it under the key
+    // a writer dropped without commit() publishes nothing (its pages are freed in BTree mode)
+    class ValueWriter {
+    public:
+        ValueWriter() = default;
+        ValueWriter(ValueWriter&& other) noexcept;
+        ValueWriter& operator=(ValueWriter&& other) noexcept;
+        ~ValueWriter();
+
+        // append the next chunk, false if it runs past the size given to putStream
+        bool write(const char* data, size_t size);
+        bool write(const string& data) { return write(data.data(), data.size()); }
+
+        // publish the value, false unless exactly the promised size was written
+        bool commit();
+
+        bool valid() const { return store_ != nullptr; }
+
+    private:
+        friend class KVStore;
+        ValueWriter(KVStore* store, const string& key, uint64_t size);
+        // write the filled pages out in one sequential write
+        bool writePages();
+
+        KVStore* store_ = nullptr;
+        string key_;
+        uint64_t size_ = 0;
+        uint64_t written_ = 0;
+        uint32_t first_page_id_ = 0; // the value's extent
+        uint32_t page_count_ = 0;
+        uint32_t next_page_id_ = 0; // extent page pages_[0] goes to
+        vector<Page> pages_; // filled, not yet written
+    };
+
+    // constructor
+    // mode only applies to a new file, an existing file is reopened in the mode it was created with
+    KVStore(const string& filename, KVIndexMode mode = KVIndexMode::Memory); 
+
+    // destructor
+    ~KVStore();
+
+    // the mode the file is in
+    KVIndexMode indexMode() const { return tree_ ? KVIndexMode::BTree : KVIndexMode::Memory; }
+
+    // put 
+    bool put(const string& key, const string& value);
+
+    // get
+    string get(const string& key);
+
+    // values larger than a quarter page are kept in an extent of overflow pages, the record only points at it
+    // length bytes of key's value from offset on (shorter at the end of the value), reads only the pages that range covers
+    string getRange(const string& key, uint64_t offset, size_t length);
+
+    // size of key's value (0 if there is none)
+    uint64_t valueSize(const string& key);
+
+    // put a value of size bytes in chunks, without ever holding all of it (invalid writer if the key is too long)
+    ValueWriter putStream(const string& key, uint64_t size);
+
+    // remove
+    bool remove(const string& key);
+
+    // call callback for every key with begin <= key < end (empty end: no upper bound) in key order
+    // stops early if callback returns false, returns how many keys were visited
+    // BTree mode walks the tree's leaves, Memory mode has to sort the whole index first
+    // the store is locked while it runs, callback must not call back into it
+    size_t scan(const string& begin, const string& end, const function<bool(const string&, const string&)>& callback);
+
+    // incremental compaction, BTree mode only (Memory mode can't tell a live record from a dead one on disk)
+    // a data page whose garbage (bytes not held by live records) is at least min_garbage_ratio of the page gets
+    // its live records copied to the append page and is freed; pages left with no live record are freed right away
+    // compacts up to max_pages pages, most garbage first, returns how many it compacted
+    size_t compact(size_t max_pages = SIZE_MAX, double min_garbage_ratio = 0.5);
+
+    // the same in a background thread, copying at most bytes_per_second; foreground operations wait for
+    // at most one page's worth of copying at a time
+    bool startCompaction(uint64_t bytes_per_second, double min_garbage_ratio = 0.5);
+    void stopCompaction();
+
+    // index snapshot, Memory mode only (BTree mode's index is on disk already)
+    // writes index_ and the append position to <file>.idx in one sequential pass, after flushing the data pages
+    // it points into; the next open loads it and replays only the records appended after it
+    // (removes are kept across a restart once a snapshot without the key is taken)
+    bool checkpoint();
+
+    // take a snapshot by itself every time this many bytes have been written since the last one
+    // (0 = only on checkpoint(); a snapshot is always taken at close if anything changed)
+    void setCheckpointInterval(uint64_t bytes);
+
+    // bytes held by live records, and the data pages holding them (BTree mode; a reopened store only knows
+    // once a compaction step has surveyed what's on disk)
+    uint64_t liveBytes();
+    size_t dataPageCount();
+
+private:
+    PageManager page_manager_;
+    BufferPool* buffer_pool_;
+    unordered_map<string, pair<uint32_t, uint32_t>> index_; // key -> (page_id, offset), Memory mode
+    unique_ptr<BPlusTree> tree_; // key -> page_id << 32 | offset, BTree mode (page 0 is its metadata page)
+    // scan data pages from (first_page_id, first_offset) on, adding their records to index_
+    void rebuildIndex(uint32_t first_page_id, uint32_t first_offset);
+    // value of the record at (page_id, offset)
+    string readValue(uint32_t page_id, uint32_t offset);
+
+    // where an overflowing value lives
+    struct OverflowPointer {
+        uint32_t first_page_id = 0;
+        uint32_t page_count = 0;
+        uint64_t size = 0;
+    };
+    // read the record's inline value, or its overflow pointer (returns true then)
+    bool readRecordValue(uint32_t page_id, uint32_t offset, string& value, OverflowPointer& overflow);
+    string readOverflow(const OverflowPointer& overflow, uint64_t offset, size_t length);
+    void freeOverflow(const OverflowPointer& overflow);
+    bool findRecord(const string& key, uint32_t& page_id, uint32_t& offset);
+    bool commitValue(ValueWriter& writer);
+    void abandonValue(ValueWriter& writer);
+    // same, caller holds mutex_
+    void abandonLocked(ValueWriter& writer);
+    uint32_t current_page_id_;
+    uint32_t current_offset_;
+    mutex mutex_; // one operation at a time, the compactor takes it once per step
+
+    // compaction bookkeeping (BTree mode)
+    unordered_map<uint32_t, uint32_t> live_bytes_; // data page -> bytes of live records on it
+    set<pair<uint32_t, uint32_t>> by_garbage_; // (garbage bytes, page) for every page in live_bytes_
+    uint64_t total_live_bytes_;
+    // what was on disk at open is counted from the tree in key order, a batch per step; keys below
+    // survey_cursor_ are counted, puts and removes of keys above it are left for the survey to see
+    // (a new file has nothing to survey and counts from the first put)
+    bool surveyed_;
+    string survey_cursor_;
+    // overflow extents of values still being written (first page -> page count), the sweep leaves them alone
+    map<uint32_t, uint32_t> open_extents_;
+
+    thread compactor_;
+    mutex compactor_mutex_;
+    condition_variable compactor_wake_;
+    bool compactor_stop_;
+    uint64_t compactor_rate_;
+    double compactor_ratio_;
+
+    // index snapshot
+    string index_filename_;
+    uint64_t checkpoint_interval_;
+    uint64_t bytes_since_checkpoint_; // record bytes appended (or removes) the last snapshot doesn't have
+
+    // <file>.mode holds a tag in BTree mode and is missing in Memory mode
+    string mode_filename_;
+    static bool saveMode(const string& mode_filename, KVIndexMode mode);
+    static KVIndexMode loadMode(const string& mode_filename);
+
+    bool checkpointLocked();
+    // load the snapshot into index_ and set where the replay starts, leaves both alone if there's no usable one
+    void loadCheckpoint(uint32_t& first_page_id, uint32_t& first_offset);
+
+    bool putLocked(const string& key, const string& value);
+    // append a record (value inline, or an overflow pointer) and point the index at it
+    // free_old_overflow: the key's previous value's overflow pages go (not when compaction moves a record)
+    bool putRecord(const string& key, const char* value, uint32_t value_len, bool overflow, bool free_old_overflow);
+    // true if a record with this key and inline value fits in a data page
+    bool recordFits(uint32_t key_len, uint32_t inline_value_len) const;
+    bool tracked(const string& key) const { return tree_ && (surveyed_ || key < survey_cursor_); }
+    // change page's live bytes by delta, a page that drops to none (and isn't the append page) is freed
+    void addLive(uint32_t page_id, int64_t delta);
+    // count the next max_keys keys of the survey, returns bytes of index entries visited
+    // the last step also sweeps the file (see sweepDeadPages)
+    size_t surveyStep(size_t max_keys);
+    // free every data page the survey found no live record on (all its records died before the survey
+    // got to their keys, e.g. in an earlier session), returns bytes of pages read
+    size_t sweepDeadPages();
+    // page with the most garbage, at least min_garbage_ratio of a page (0 if none)
+    uint32_t pickVictim(double min_garbage_ratio);
+    // copy the page's live records forward, returns bytes copied
+    size_t compactPage(uint32_t page_id);
+    // one survey batch or one page, returns the work done in bytes (0 = nothing to do)
+    size_t compactionStep(double min_garbage_ratio);
+    void compactorLoop();
+};
+
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// in-memory blocked Bloom filters, one per leaf page, so a lookup for a key that isn't there can stop
+// before the leaf is fetched
+// a filter is an array of 64-byte blocks: a key picks one block and sets its probe bits in there, so a check
+// touches one cache line. filters are never saved: a leaf without one (after a restart, or past the memory
+// limit) just gets read, and a lookup that reads it builds its filter
+// "no" is only trusted while the leaf's version latch stays put, everyone who changes a filter holds that latch
+// (or has the whole tree); Bloom filters can't forget, so removed keys stay in until the next rebuild
+class LeafFilterTable {
+public:
+    LeafFilterTable();
+
+    LeafFilterTable(const LeafFilterTable&) = delete;
+    LeafFilterTable& operator=(const LeafFilterTable&) = delete;
+
+    // false positive rate new filters are sized for (0 turns filtering off), drops the filters built so far
+    void setFalsePositiveRate(double rate);
+    double falsePositiveRate() const { return rate_; }
+
+    // most bytes all filters together may take; leaves past it go without a filter
+    void setMemoryLimit(size_t bytes);
+    size_t memoryLimit() const { return memory_limit_; }
+    size_t memoryUsage() const { return memory_usage_; }
+
+    // false only if key is certainly not on the leaf; true if it may be, or if the page has no filter
+    // wants_filter (optional): set to true if the page has no filter but filtering is on and there is memory left for one
+    bool mayContain(uint32_t page_id, const string& key, bool* wants_filter = nullptr) const;
+
+    // replace the leaf's filter with one holding exactly keys
+    // unchanged: checked under the table's lock right before the filter goes in (filters built from a page
+    // read without latches pass the leaf's version check, so a write in between can't be lost)
+    void build(uint32_t page_id, const vector<string>& keys, const function<bool()>& unchanged = nullptr);
+
+    // add key to the leaf's filter, if it has one (a filter that outgrows its size is dropped, the next read rebuilds it)
+    void add(uint32_t page_id, const string& key);
+
+    // forget the page's filter (page freed, or no longer a leaf)
+    void drop(uint32_t page_id);
+    void clear();
+
+private:
+    static constexpr size_t SHARDS = 64;
+    static constexpr uint32_t BLOCK_BITS = 512;
+    static constexpr size_t FILTER_OVERHEAD = 64;  // map node and vector header, roughly
+
+    struct Filter {
+        vector<uint64_t> bits;
+        uint32_t blocks = 0;
+        uint32_t probes = 0;
+        uint32_t keys = 0;
+        uint32_t capacity = 0;  // keys it was sized for
+    };
+
+    struct Shard {
+        mutable shared_mutex mutex;
+        unordered_map<uint32_t, Filter> filters;
+    };
+
+    unique_ptr<Shard[]> shards_;
+    atomic<double> rate_;
+    atomic<double> bits_per_key_;
+    atomic<size_t> memory_limit_;
+    atomic<size_t> memory_usage_;
+
+    Shard& shard(uint32_t page_id) const { return shards_[page_id % SHARDS]; }
+    static size_t filterBytes(const Filter& filter) { return filter.bits.size() * 8 + FILTER_OVERHEAD; }
+
+    static void insertKey(Filter& filter, uint64_t hash);
+    static bool containsKey(const Filter& filter, uint64_t hash);
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "file_manager.h"
+#include "page.h"
+#include <string>
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+class PageManager;
+
+// write-ahead log of page-level redo records
+// every record carries full after-images of one or more pages and an LSN (log sequence number);
+// the pages are stamped with that LSN so the buffer pool can make sure the log reaches disk
+// before the page does (WAL-before-data)
+//
+// file layout: a header page (magic, first LSN still in the log), then records back to back
+// record: [magic 4][page count 4][lsn 8][checksum 4] then page count x ([page id 4][page image])
+class LogManager {
+public:
+    // opens (or creates) the log file
+    LogManager(const string& filename);
+
+    // appends whatever is still buffered and makes it durable
+    ~LogManager();
+
+    LogManager(const LogManager&) = delete;
+    LogManager& operator=(const LogManager&) = delete;
+
+    // log after-images of count pages as one record (applied all or nothing on recovery)
+    // stamps every page with the record's LSN before copying it, returns that LSN
+    // the record is only buffered, it's durable after flush(lsn)/commit()
+    uint64_t logPages(const uint32_t* page_ids, Page* const* pages, size_t count);
+
+    // block until every record up to lsn is on disk
+    // group commit: one thread writes and fdatasyncs everything buffered so far,
+    // threads that arrive meanwhile wait for it and are usually covered by the same sync
+    void flush(uint64_t lsn);
+
+    // make everything logged so far durable, returns the LSN it covered
+    uint64_t commit();
+
+    // redo every intact record into the page file, drop a torn tail, then checkpoint
+    // run once at startup before the page file is used (BufferPool does this)
+    void recover(PageManager* page_manager);
+
+    // drop every record up to lsn once the page file holds what they cover (and is synced)
+    // records after lsn stay: if any of them are in the file already, they are copied behind a new header
+    // into a temp file that is renamed over the log (logging waits meanwhile)
+    // returns true if anything was dropped
+    bool truncate(uint64_t lsn);
+
+    uint64_t flushedLsn();
+    uint64_t lastLsn();
+
+    // bytes in the log, written or still buffered (no locking)
+    uint64_t size() const { return size_; }
+
+private:
+    static constexpr uint32_t LOG_MAGIC = 0x57414C31;  // "WAL1"
+    static constexpr uint32_t RECORD_HEADER_SIZE = 20;
+
+    string filename_;
+    unique_ptr<FileManager> file_;  // replaced when truncate() rewrites the log
+    mutex mutex_;
+    condition_variable flushed_;  // signalled when a group flush lands
+    string buffer_;  // records appended but not written yet
+    uint64_t log_end_;  // file offset buffer_ goes to (the end of the file once every group has landed)
+    deque<pair<uint64_t, uint64_t>> records_;  // lsn and file offset of every record since the last truncate
+    atomic<uint64_t> size_;  // log_end_ plus what is buffered
+    uint64_t next_lsn_;
+    uint64_t flushed_lsn_;  // every record up to here is durable
+    bool flushing_;  // a thread is writing a group right now
+
+    // rewrite the header page of file so the log starts at first_lsn
+    static void writeHeader(FileManager& file, uint64_t first_lsn);
+
+    // fsync the directory holding the log, so a rename is durable
+    void syncDirectory();
+
+    static uint32_t checksum(const char* data, size_t size);
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+// small LZ77 codec for page compression (same idea as the LZ4 block format, no dependency)
+// the stream is a run of sequences: token byte (high nibble literal count, low nibble match length - 4),
+// extra length bytes for either nibble that is 15 (255 = keep adding), the literals, then a 2-byte
+// little-endian match offset; the last sequence is literals only
+// one greedy pass with a 4096-entry hash table of 4-byte prefixes, matches reach back at most 64KB
+
+// compress size bytes of src into dst
+// returns: compressed size, or 0 if it doesn't fit in capacity bytes (store the data raw then)
+size_t lzCompress(const char* src, size_t size, char* dst, size_t capacity);
+
+// decompress size bytes of src into exactly out_size bytes at dst
+// returns: false if the stream is malformed or doesn't produce exactly out_size bytes (never reads or writes out of bounds)
+bool lzDecompress(const char* src, size_t size, char* dst, size_t out_size);
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "page.h"
+#include <string>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+// access hints passed to madvise
+enum class AccessPattern {
+    Normal,
+    Random,      // point lookups (B+ tree descents), no read-ahead
+    Sequential   // scans, aggressive read-ahead
+};
+
+// read-only memory mapping of a page file
+// pages are served as pointers straight into the mapping, a hit costs no syscall and no copy
+// a mapping reserves at least twice the previous one (past end of file, only the part the file covers is
+// handed out), so growth mostly just moves the end inside it; a remap happens once the file outgrows the
+// reservation, which keeps the number of mappings logarithmic in the file size and all of them together
+// under 4x the file's address space
+class MappedFile {
+public:
+    MappedFile(const string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool isOpen() const { return fd_ >= 0; }
+
+    // pointer to the mapped page, or nullptr if the page is past end of file
+    // if the page is past the current mapping, the file is checked for growth and remapped
+    // returned pointers stay valid until the MappedFile is destroyed (old mappings are kept on remap, see above)
+    const Page* page(uint32_t page_id);
+
+    // mapped file size in bytes
+    uint64_t size() const;
+
+    // madvise the whole mapping (also applied to later remaps)
+    void advise(AccessPattern pattern);
+
+    // ask the kernel to start reading count pages from first_page_id
+    void willNeed(uint32_t first_page_id, uint32_t count);
+
+private:
+    struct Mapping {
+        char* base;
+        uint64_t capacity;  // bytes mapped, may run past end of file
+        atomic<uint64_t> length;  // whole pages of the file inside the mapping, only grows
+
+        Mapping(char* mapped_base, uint64_t mapped_capacity, uint64_t file_length)
+            : base(mapped_base), capacity(mapped_capacity), length(file_length) {}
+    };
+
+    string filename_;
+    int fd_;
+    atomic<Mapping*> current_;  // readers only load this, remaps swap in a bigger one
+    vector<Mapping*> mappings_;  // every mapping ever made (each at least twice the last), unmapped in the destructor
+    mutex remap_mutex_;
+    AccessPattern pattern_;
+
+    // pick up growth of the file: within the reservation just move the end, past it map a bigger one
+    // returns the current mapping
+    Mapping* remap();
+    void applyAdvice(Mapping* mapping);
+};
@@ -1,40 +1,52 @@
-#pragma once
-
-#include <string>
-#include <cstdint> 
-#include <cstring>  // for memset, memcpy
-
-constexpr uint32_t PAGE_SIZE = 4096; // 4KB, constexpr for compile time constant
-
-using namespace std;
-
-class Page {
-public:
-    char data[PAGE_SIZE];
-
-    Page(bool clear = false);
-    ~Page();
-
-    // low-level read/write data to page
-    void writeBytes(uint32_t offset, const char* data, uint32_t size);
-    void readBytes(uint32_t offset, char* data, uint32_t size) const;
-
-    // type-safe helpers
-    void writeUint32(uint32_t offset, uint32_t value);
-    uint32_t readUint32(uint32_t offset) const;
-    
-    void writeUint64(uint32_t offset, uint64_t value);
-    uint64_t readUint64(uint32_t offset) const;
-    
-    void writeString(uint32_t offset, const string& str, uint32_t max_size);
-    string readString(uint32_t offset, uint32_t length) const;    
-
-    // utility functions
-    void clear();
-    char* getData(uint32_t offset);
-    const char* getData(uint32_t offset) const; 
-
-
-private:
-
+#pragma once
+
+#include <string>
+#include <cstdint> 
+#include <cstring>  // for memset, memcpy
+
+constexpr uint32_t PAGE_SIZE = 4096; // 4KB, constexpr for compile time constant
+
+// every page starts with an 8 byte header holding its LSN (log sequence number of the last logged change)
+// page contents (nodes, records, metadata) start after it
+constexpr uint32_t PAGE_HEADER_SIZE = 8;
+
+using namespace std;
+
+// aligned to PAGE_SIZE so a page can be handed to O_DIRECT reads/writes as is
+class alignas(PAGE_SIZE) Page {
+public:
+    char data[PAGE_SIZE];
+
+    Page(bool clear = false);
+    ~Page();
+
+    // low-level read/write data to page
+    void writeBytes(uint32_t offset, const char* data, uint32_t size);
+    void readBytes(uint32_t offset, char* data, uint32_t size) const;
+
+    // type-safe helpers
+    void writeUint16(uint32_t offset, uint16_t value);
+    uint16_t readUint16(uint32_t offset) const;
+
+    void writeUint32(uint32_t offset, uint32_t value);
+    uint32_t readUint32(uint32_t offset) const;
+    
+    void writeUint64(uint32_t offset, uint64_t value);
+    uint64_t readUint64(uint32_t offset) const;
+    
+    void writeString(uint32_t offset, const string& str, uint32_t max_size);
+    string readString(uint32_t offset, uint32_t length) const;    
+
+    // LSN of the last write-ahead log record that covers this page (0 = never logged)
+    uint64_t lsn() const;
+    void setLsn(uint64_t lsn);
+
+    // utility functions
+    void clear();
+    char* getData(uint32_t offset);
+    const char* getData(uint32_t offset) const; 
+
+
+private:
+
 };
\ No newline at end of file
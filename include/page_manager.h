@@ -1,29 +1,159 @@
-#pragma once
-
-#include "file_manager.h"
-#include "page.h"
-#include <string>
-#include <cstdint>
-using namespace std;
-
-class PageManager {
-public:
-    PageManager(const string& filename);
-    ~PageManager();
-    
-    // allocate a new page (returns page ID)
-    uint32_t allocatePage();
-    
-    // read a page from disk
-    void readPage(uint32_t page_id, Page& page);
-    
-    // write a page to disk
-    void writePage(uint32_t page_id, const Page& page);
-    
-    // free a page (add to free list - simple version for now)
-    void freePage(uint32_t page_id);
-    
-private:
-    FileManager file_manager_;
-    uint32_t next_page_id_;  // track next page to allocate
+#pragma once
+
+#include "file_manager.h"
+#include "mapped_file.h"
+#include "page.h"
+#include <string>
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+enum class OpenMode {
+    ReadWrite,
+    ReadWriteDirect,  // O_DIRECT, the buffer pool is the only cache (no double buffering in the OS page cache)
+    ReadOnlyMmap,  // map the file read-only, pages are served straight from the mapping
+    ReadWriteCompressed  // pages are LZ-compressed into variable-size slots, see below
+};
+
+// page compression: a page is compressed on its way to disk and stored in a slot of 1 to 8 512-byte sectors
+// (8 = it didn't compress, stored raw), and a page id -> slot map says where each page lives
+// the map is kept in memory and written to <filename>.map at every sync (temp file + rename, so it's always whole);
+// every write fills a new slot (never the one the page is in, a crash mid-write would tear it) and a slot a
+// page moved out of is only reused after the next map save, so the saved map never points at somebody else's
+// data or at a half-written slot; between syncs rewritten pages take extra sectors until the next map save
+// frees their old slots. readers above the page manager only ever see whole 4KB pages, the buffer pool
+// caches them uncompressed
+// a file created compressed stays compressed (it has a map) and one created without doesn't, whatever mode opens it
+constexpr uint32_t SLOT_SECTOR_SIZE = 512;
+constexpr uint32_t SLOT_MAX_SECTORS = PAGE_SIZE / SLOT_SECTOR_SIZE;
+
+class PageManager {
+public:
+    PageManager(const string& filename, OpenMode mode = OpenMode::ReadWrite);
+    ~PageManager();
+
+    // true in ReadOnlyMmap mode
+    bool isMapped() const { return mapped_file_ != nullptr; }
+
+    // true if ReadWriteDirect was asked for and the filesystem supports O_DIRECT
+    bool isDirect() const { return file_manager_.directIo(); }
+
+    // true if pages are stored compressed (the file was created in ReadWriteCompressed mode)
+    bool isCompressed() const { return compressed_; }
+
+    // bytes the written pages take up on disk (whole sectors in compressed mode, the file size otherwise)
+    uint64_t storedBytes();
+
+    // pointer into the mapping (ReadOnlyMmap mode only), nullptr past end of file
+    const Page* mappedPage(uint32_t page_id);
+
+    // madvise hint for the mapping (ReadOnlyMmap mode only)
+    void adviseAccess(AccessPattern pattern);
+
+    // have the kernel start reading count pages from first_page_id in the background
+    // (fadvise, or madvise in ReadOnlyMmap mode; nothing to do with O_DIRECT)
+    void adviseWillNeed(uint32_t first_page_id, uint32_t count);
+
+    // number of pages in the file (a partial last page counts)
+    uint32_t pageCount();
+    
+    // allocate a new page (returns page ID), reusing the lowest freed page if there is one
+    // reuse_freed = false: always a page past the end of the file (for writers that bypass the buffer pool,
+    // which may still cache a freed page)
+    uint32_t allocatePage(bool reuse_freed = true);
+
+    // allocate count pages with consecutive IDs (returns the first), so they can be read and written as one run
+    // takes the lowest run of freed pages long enough, else grows the file by count pages
+    uint32_t allocateExtent(uint32_t count, bool reuse_freed = true);
+
+    // make sure page_id is never handed out again by allocatePage (pages written behind our back, e.g. by log recovery)
+    void markAllocated(uint32_t page_id);
+    
+    // read a page from disk
+    void readPage(uint32_t page_id, Page& page);
+    
+    // write a page to disk
+    void writePage(uint32_t page_id, const Page& page);
+
+    // write a run of pages with consecutive IDs in one vectored write
+    void writePages(uint32_t first_page_id, const Page* const* pages, size_t count);
+
+    // read/write a batch of pages with arbitrary IDs, many I/Os in flight at once
+    // a page that can't be read comes back cleared, with failed[i] set if failed is given
+    void readPageBatch(const uint32_t* page_ids, Page* const* pages, size_t count, uint8_t* failed = nullptr);
+    void writePageBatch(const uint32_t* page_ids, const Page* const* pages, size_t count);
+
+    // make everything written so far durable (and save the page map in compressed mode)
+    void sync();
+    
+    // free a page (set its bit in the free map, allocatePage hands it out again)
+    // in compressed mode the page keeps its slot until it is written again: the saved map may still need it
+    // lsn: log record that unlinked the page; the free isn't saved by saveFreeSpace until that record is durable,
+    // so a crash can't leave a page both free and still referenced by the replayed tree (0 = no log, save any time)
+    void freePage(uint32_t page_id, uint64_t lsn = 0);
+
+    // number of free pages
+    size_t freePageCount();
+
+    // true if page_id is in the free map (waiting to be handed out again)
+    bool pageIsFree(uint32_t page_id);
+
+    // write the free map to the sidecar file (<filename>.fsm) and sync it, leaving out frees logged after durable_lsn
+    // the map is read back on open, so space freed before a restart is reused after it
+    void saveFreeSpace(uint64_t durable_lsn = UINT64_MAX);
+    
+private:
+    bool compressed_;  // decided before file_manager_ opens the file (compressed files are never opened O_DIRECT)
+    bool read_only_;
+    FileManager file_manager_;
+    unique_ptr<MappedFile> mapped_file_;  // set in ReadOnlyMmap mode
+    atomic<uint32_t> next_page_id_;  // track next page to allocate (atomic so threads can allocate concurrently)
+
+    // free map: one bit per page, set = free
+    mutex free_mutex_;
+    vector<uint64_t> free_bits_;
+    size_t free_hint_;  // no free bits in the words before this one
+    vector<pair<uint32_t, uint64_t>> pending_frees_;  // (page, lsn) freed by log records that may not be durable yet
+    atomic<size_t> free_count_;  // set bits, so allocatePage skips the mutex while nothing is free
+
+    unique_ptr<FileManager> free_space_file_;  // <filename>.fsm, not opened in ReadOnlyMmap mode
+    mutex save_mutex_;  // one saveFreeSpace / savePageMap at a time
+
+    // compressed mode: page id -> first sector << 4 | sector count (0 = never written)
+    mutex slot_mutex_;
+    vector<uint64_t> slots_;
+    vector<uint64_t> free_slots_[SLOT_MAX_SECTORS + 1];  // first sectors of free runs, by run length
+    vector<uint64_t> moved_slots_;  // slots pages moved out of since the map was last saved
+    uint64_t end_sector_;  // end of the last slot
+    uint64_t stored_sectors_;  // sectors in use
+    string page_map_filename_;
+
+    // true if filename is (or is about to be created as) a compressed file
+    static bool usesCompression(const string& filename, OpenMode mode);
+
+    // find room for sectors sectors: a free run of that length, else split a longer one, else the end of the file
+    // caller holds slot_mutex_
+    uint64_t takeSlot(uint32_t sectors);
+
+    // compressed page I/O
+    void readCompressed(uint32_t page_id, Page& page);
+    void writeCompressed(uint32_t page_id, const Page& page);
+
+    // write the page map to <filename>.map, then make the slots moved out of before it reusable
+    void savePageMap();
+
+    // read the page map back, every sector no page uses becomes a free run (runs longer than 8 sectors are split)
+    // returns: false if there is no usable map
+    bool loadPageMap();
+
+    // read the free map back from the sidecar (an unreadable or torn map is ignored, its pages just leak)
+    void loadFreeSpace();
+
+    // mark page_id free/used, caller holds free_mutex_
+    void setFree(uint32_t page_id);
+    void clearFree(uint32_t page_id);
+    bool isFree(uint32_t page_id) const;
 };
\ No newline at end of file
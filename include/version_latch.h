@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+using namespace std;
+
+// optimistic version latches for tree nodes (optimistic lock coupling)
+// a node's latch is a version word: even = free, odd = a writer holds it; unlocking moves it to the next even value
+// readers never write it: they remember the version, read the node, and check the version didn't move
+// writers upgrade the version they read to locked with a CAS, and restart if somebody got there first
+//
+// latches live in a fixed table indexed by page id instead of in the page or the frame, so they survive
+// eviction and cost no space on disk; two pages that share a slot just share a latch
+class VersionLatchTable {
+public:
+    VersionLatchTable() : slots_(new Slot[SLOTS]) {}
+
+    // slot a page's latch lives in (pages in the same slot share it)
+    static uint32_t slot(uint32_t page_id) { return page_id & (SLOTS - 1); }
+
+    // current version of page's latch, waits while a writer holds it
+    uint64_t readLock(uint32_t page_id) const {
+        const atomic<uint64_t>& version = slots_[slot(page_id)].version;
+        uint64_t current = version.load(memory_order_acquire);
+        while (isLocked(current)) {
+            this_thread::yield();
+            current = version.load(memory_order_acquire);
+        }
+        return current;
+    }
+
+    // true if nobody locked page's latch since readLock returned version
+    bool validate(uint32_t page_id, uint64_t version) const {
+        atomic_thread_fence(memory_order_acquire);
+        return slots_[slot(page_id)].version.load(memory_order_relaxed) == version;
+    }
+
+    // lock page's latch if it's still at version (no waiting, false means restart)
+    bool tryUpgrade(uint32_t page_id, uint64_t version) {
+        return !isLocked(version) &&
+            slots_[slot(page_id)].version.compare_exchange_strong(version, version + 1, memory_order_acquire);
+    }
+
+    // release a latch taken with tryUpgrade, readers that saw the old version will restart
+    void unlock(uint32_t page_id) {
+        slots_[slot(page_id)].version.fetch_add(1, memory_order_release);
+    }
+
+    // raw version, locked or not
+    uint64_t version(uint32_t page_id) const {
+        return slots_[slot(page_id)].version.load(memory_order_acquire);
+    }
+
+    static bool isLocked(uint64_t version) { return (version & 1) != 0; }
+
+private:
+    static constexpr uint32_t SLOTS = 1 << 14;
+
+    // one cache line per latch so writers on neighbouring pages don't bounce each other's line
+    struct alignas(64) Slot {
+        atomic<uint64_t> version{0};
+    };
+
+    unique_ptr<Slot[]> slots_;
+};
@@ -2,16 +2,46 @@
 #include "buffer_pool.h"
 #include "page_manager.h"
 #include <iostream>
+#include <algorithm>
+#include <thread>
 
 // create empty tree
 BPlusTree::BPlusTree(BufferPool* buffer_pool, PageManager* page_manager, 
-    int order) : buffer_pool_(buffer_pool), page_manager_(page_manager), order_(order), root_page_id_(0) {
+    int order) : buffer_pool_(buffer_pool), page_manager_(page_manager), root_page_id_(0), order_(order), tree_version_(0) {
     loadRootPageId();  // restore root_page_id_ from disk (page 0)
 }
 
 bool BPlusTree::insert(const string& key, uint64_t value) {
-    // handle empty tree case, create new root leaf node
-    if (root_page_id_ == 0) {
+    // longer keys would leave too few cells per page to split
+    if (key.size() > MAX_KEY_SIZE || !buffer_pool_) {
+        return false;
+    }
+
+    // inserts run side by side (node latches sort them out), only whole-tree operations keep them out
+    shared_lock<shared_mutex> shared(exclusive_mutex_);
+
+    // every page this insert touches (splits, new root, metadata) is logged as one unit
+    AtomicOperation operation(buffer_pool_);
+
+    while (!tryInsert(key, value)) {
+        this_thread::yield();  // lost a race with another writer, let it finish
+    }
+    return true;
+}
+
+bool BPlusTree::tryInsert(const string& key, uint64_t value) {
+    Path path;
+    if (!descend(key, path, nullptr)) {
+        return false;
+    }
+    WriteLatches latches(latches_);  // everything locked below is unlocked when this returns
+
+    // handle empty tree case, create new root leaf node (page 0 holds the root id, so it's the latch to take)
+    if (path.size == 1) {
+        if (!latches.lock(0, path.versions[0])) {
+            return false;
+        }
+
         // allocate new page for root (allocateNode will skip page 0 for metadata)
         root_page_id_ = allocateNode(true);
         
@@ -30,26 +60,69 @@ bool BPlusTree::insert(const string& key, uint64_t value) {
         return true;
     }
 
-    // load root node
-    Node root;
-    loadNode(root_page_id_, root);
+    // lock the leaf, most inserts end right here
+    size_t leaf = path.size - 1;
+    if (!latches.lock(path.page_ids[leaf], path.versions[leaf])) {
+        return false;
+    }
+    Node node;
+    loadNode(path.page_ids[leaf], node);
+    if (!node.is_leaf) {
+        return true;  // page couldn't be read (or tree is corrupt), nothing to insert into
+    }
+    int insertPos = upper_bound(node.keys.begin(), node.keys.end(), key) - node.keys.begin();
+    node.keys.insert(node.keys.begin() + insertPos, key);
+    node.values.insert(node.values.begin() + insertPos, value);
+    if (!isFull(node)) {
+        leaf_filters_.add(path.page_ids[leaf], key);
+        saveNode(path.page_ids[leaf], node);
+        return true;
+    }
 
-    // call recursive insert helper function to do actual insertion
+    // the leaf splits: lock its right neighbour (prev link changes) and every ancestor up to the first
+    // one with room for another separator, page 0 if the root may split too
+    if (node.next_page_id != 0 && !latches.lockCurrent(node.next_page_id)) {
+        return false;
+    }
+    size_t top = leaf;
+    while (top > 0) {
+        top--;
+        if (!latches.lock(path.page_ids[top], path.versions[top])) {
+            return false;
+        }
+        if (top == 0) {
+            break;
+        }
+        Node parent;
+        loadNode(path.page_ids[top], parent);
+        if (canAbsorb(parent)) {
+            break;
+        }
+    }
+
+    // everything from path[top] down is ours, the plain recursive insert does the rest
     string promotedKey;
     uint32_t newRightChildPageId;
+    if (top > 0) {
+        insertHelper(path.page_ids[top], key, value, promotedKey, newRightChildPageId);
+        return true;
+    }
+
+    // call recursive insert helper function to do actual insertion
     uint32_t resultPageId = insertHelper(root_page_id_, key, value, promotedKey, newRightChildPageId);
 
     // if result from insertHelper is not nullptr, split root and create new root
     if (resultPageId != 0) {
         uint32_t oldRootPageId = root_page_id_;
 
-        root_page_id_ = allocateNode(false); 
+        uint32_t newRootPageId = allocateNode(false);
         Node newRoot(false);  // create internal node directly, don't load
-        newRoot.page_id = root_page_id_;
+        newRoot.page_id = newRootPageId;
         newRoot.keys.push_back(promotedKey);
         newRoot.children_page_ids.push_back(oldRootPageId);
         newRoot.children_page_ids.push_back(newRightChildPageId);
-        saveNode(root_page_id_, newRoot);
+        saveNode(newRootPageId, newRoot);
+        root_page_id_ = newRootPageId;
         saveRootPageId();  // persist root_page_id_ to disk (page 0)
     }
 
@@ -66,7 +139,7 @@ uint32_t BPlusTree::insertHelper(uint32_t page_id, const string& key, uint64_t v
     if (node.is_leaf) {
         // insert key-value into leaf
         int insertPos = node.keys.size();
-        for (int i = 0; i < node.keys.size(); i++) {
+        for (int i = 0; i < static_cast<int>(node.keys.size()); i++) {
             if (node.keys[i] > key) {
                 insertPos = i;
                 break;
@@ -76,17 +149,18 @@ uint32_t BPlusTree::insertHelper(uint32_t page_id, const string& key, uint64_t v
         node.values.insert(node.values.begin() + insertPos, value);
 
         // if leaf not full, return 0
-        if (node.keys.size() < order_) {
+        if (!isFull(node)) {
+            leaf_filters_.add(page_id, key);
             saveNode(page_id, node);
             return 0;
         }
 
         // if leaf is full:
-        // -split leaf into two
-        int split_index = order_ / 2;
+        // -split leaf into two, about half the bytes on each side
+        int split_index = splitIndex(node);
 
-        // -set promotedKey (middle key)
-        promotedKey = node.keys[split_index];
+        // -set promotedKey: only as much of the right half's first key as it takes to tell it from the left half
+        promotedKey = separator(node.keys[split_index - 1], node.keys[split_index]);
 
         // -set new right child
         newRightChildPage = allocateNode(true);
@@ -94,19 +168,31 @@ uint32_t BPlusTree::insertHelper(uint32_t page_id, const string& key, uint64_t v
         loadNode(newRightChildPage, newRightChild);
         newRightChild.keys.assign(node.keys.begin() + split_index, node.keys.end()); // .assign() expects iterators to start and end
         newRightChild.values.assign(node.values.begin() + split_index, node.values.end());
-        saveNode(newRightChildPage, newRightChild);
 
         // -remove right half from node
         node.keys.erase(node.keys.begin() + split_index, node.keys.end());
         node.values.erase(node.values.begin() + split_index, node.values.end());
 
-        // -link leaves
+        // -link leaves (before saving, so both pages get the new links): node <-> newRightChild <-> oldNext
         uint32_t oldNext = node.next_page_id;
         node.next_page_id = newRightChildPage;
         newRightChild.next_page_id = oldNext;
+        newRightChild.prev_page_id = page_id;
 
+        // both halves get fresh filters (the left one drops the keys that moved)
+        leaf_filters_.build(newRightChildPage, newRightChild.keys);
+        leaf_filters_.build(page_id, node.keys);
+        saveNode(newRightChildPage, newRightChild);
         saveNode(page_id, node);
 
+        // -old next leaf now points back at the new right child
+        if (oldNext != 0) {
+            Node nextLeaf;
+            loadNode(oldNext, nextLeaf);
+            nextLeaf.prev_page_id = newRightChildPage;
+            saveNode(oldNext, nextLeaf);
+        }
+
         // -return new right child
         return newRightChildPage;
 
@@ -121,7 +207,7 @@ uint32_t BPlusTree::insertHelper(uint32_t page_id, const string& key, uint64_t v
         uint32_t resultPageId = 0;
         int childIndex = node.keys.size(); // default to last child
         
-        for (int i = 0; i < node.keys.size(); i++) {
+        for (int i = 0; i < static_cast<int>(node.keys.size()); i++) {
             if (key < node.keys[i]) {
                 childIndex = i;
                 break;
@@ -140,7 +226,7 @@ uint32_t BPlusTree::insertHelper(uint32_t page_id, const string& key, uint64_t v
         // if child split (returned new node)
         // -insert promoted key at correct position
         int insertPos = node.keys.size();
-        for (int i = 0; i < node.keys.size(); i++) {
+        for (int i = 0; i < static_cast<int>(node.keys.size()); i++) {
             if (node.keys[i] > promotedKey) {
                 insertPos = i;
                 break;
@@ -150,12 +236,12 @@ uint32_t BPlusTree::insertHelper(uint32_t page_id, const string& key, uint64_t v
         node.children_page_ids.insert(node.children_page_ids.begin() + insertPos + 1, newRightChildPage);
 
         // if not full, return nullptr
-        if (node.keys.size() < order_) {
+        if (!isFull(node)) {
             saveNode(page_id, node);
             return 0;
         }
-        // else it is full,split internal node
-        int split_index = order_ / 2;
+        // else it is full,split internal node (the middle key moves up)
+        int split_index = splitIndex(node);
         promotedKey = node.keys[split_index];
         newRightChildPage = allocateNode(false);
         Node newRightChild;
@@ -165,6 +251,7 @@ uint32_t BPlusTree::insertHelper(uint32_t page_id, const string& key, uint64_t v
         node.keys.erase(node.keys.begin() + split_index, node.keys.end());
         node.children_page_ids.erase(node.children_page_ids.begin() + split_index + 1, node.children_page_ids.end());
 
+        saveNode(newRightChildPage, newRightChild);
         saveNode(page_id, node);
 
         return newRightChildPage;
@@ -172,167 +259,1103 @@ uint32_t BPlusTree::insertHelper(uint32_t page_id, const string& key, uint64_t v
 }
 
 
-// search for key in tree. if found, return value, else return 0
-uint64_t BPlusTree::search(const string& key) {
+size_t BPlusTree::insertBatch(const vector<pair<string, uint64_t>>& entries) {
+    // sort (stable, so equal keys keep batch order like one insert() after another), dropping overlong keys
+    vector<size_t> order;
+    order.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].first.size() <= MAX_KEY_SIZE) {
+            order.push_back(i);
+        }
+    }
+    if (order.empty()) {
+        return 0;
+    }
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return entries[a].first < entries[b].first; });
+
+    // nodes are rewritten wholesale here, no insert may run alongside
+    Exclusive exclusive(this);
+
+    // the whole batch is logged as one unit, like a single insert
+    AtomicOperation operation(buffer_pool_);
+
+    // empty tree: start from an empty root leaf and merge into it
+    if (root_page_id_ == 0) {
+        root_page_id_ = allocateNode(true);
+        saveRootPageId();
+    }
+
+    vector<string> separators;
+    vector<uint32_t> new_pages;
+    insertBatchHelper(root_page_id_, entries, order.data(), order.size(), separators, new_pages);
+
+    // the root split (maybe many ways): new roots on top until one node holds every child
+    while (!new_pages.empty()) {
+        Node newRoot(false);
+        newRoot.keys = separators;
+        newRoot.children_page_ids.push_back(root_page_id_);
+        newRoot.children_page_ids.insert(newRoot.children_page_ids.end(), new_pages.begin(), new_pages.end());
+
+        root_page_id_ = allocateNode(false);
+        newRoot.page_id = root_page_id_;
+        separators.clear();
+        new_pages.clear();
+        splitAndSave(root_page_id_, newRoot, separators, new_pages);
+        saveRootPageId();
+    }
+
+    return order.size();
+}
+
+void BPlusTree::insertBatchHelper(uint32_t page_id, const vector<pair<string, uint64_t>>& entries, const size_t* order, size_t count,
+    vector<string>& separators, vector<uint32_t>& new_pages) {
+    Node node;
+    loadNode(page_id, node);
+
+    if (node.is_leaf) {
+        // merge the sorted entries into the leaf, a new key goes after existing equal ones (as in insert())
+        vector<string> keys;
+        vector<uint64_t> values;
+        keys.reserve(node.keys.size() + count);
+        values.reserve(node.keys.size() + count);
+        size_t existing = 0;
+        for (size_t i = 0; i < count; i++) {
+            const pair<string, uint64_t>& entry = entries[order[i]];
+            while (existing < node.keys.size() && node.keys[existing] <= entry.first) {
+                keys.push_back(move(node.keys[existing]));
+                values.push_back(node.values[existing]);
+                existing++;
+            }
+            keys.push_back(entry.first);
+            values.push_back(entry.second);
+        }
+        for (; existing < node.keys.size(); existing++) {
+            keys.push_back(move(node.keys[existing]));
+            values.push_back(node.values[existing]);
+        }
+        node.keys.swap(keys);
+        node.values.swap(values);
+
+        splitAndSave(page_id, node, separators, new_pages);
+        return;
+    }
+
+    // internal node: hand every child the run of entries that belongs to it (key < keys[i] goes left of keys[i])
+    // children that split report their new siblings, they're added right to left so indexes stay valid
+    vector<size_t> split_children;
+    vector<vector<string>> child_separators;
+    vector<vector<uint32_t>> child_pages;
+    size_t first = 0;
+    for (size_t child = 0; child < node.children_page_ids.size() && first < count; child++) {
+        size_t last = first;
+        if (child < node.keys.size()) {
+            while (last < count && entries[order[last]].first < node.keys[child]) {
+                last++;
+            }
+        } else {
+            last = count;  // the last child takes everything that's left
+        }
+        if (last == first) {
+            continue;
+        }
+
+        vector<string> seps;
+        vector<uint32_t> pages;
+        insertBatchHelper(node.children_page_ids[child], entries, order + first, last - first, seps, pages);
+        if (!pages.empty()) {
+            split_children.push_back(child);
+            child_separators.push_back(move(seps));
+            child_pages.push_back(move(pages));
+        }
+        first = last;
+    }
+
+    // no child split, this node didn't change
+    if (split_children.empty()) {
+        return;
+    }
+
+    for (size_t i = split_children.size(); i-- > 0;) {
+        size_t child = split_children[i];
+        node.keys.insert(node.keys.begin() + child, child_separators[i].begin(), child_separators[i].end());
+        node.children_page_ids.insert(node.children_page_ids.begin() + child + 1, child_pages[i].begin(), child_pages[i].end());
+    }
+    splitAndSave(page_id, node, separators, new_pages);
+}
+
+void BPlusTree::splitAndSave(uint32_t page_id, Node& node, vector<string>& separators, vector<uint32_t>& new_pages) {
+    if (!isFull(node)) {
+        if (node.is_leaf) {
+            leaf_filters_.build(page_id, node.keys);
+        }
+        saveNode(page_id, node);
+        return;
+    }
+
+    vector<Node> pieces;
+    splitPieces(node, pieces, separators);
+
+    // the first piece stays on this page, the others get one extent of new ones (neighbours in key order
+    // are neighbours on disk, so scans over a batch-inserted range read runs of pages)
+    pieces[0].page_id = page_id;
+    uint32_t first_page_id = page_manager_ ? page_manager_->allocateExtent(pieces.size() - 1) : 0;
+    for (size_t i = 1; i < pieces.size(); i++) {
+        pieces[i].page_id = first_page_id != 0 ? first_page_id + static_cast<uint32_t>(i - 1) : allocateNode(node.is_leaf);
+        new_pages.push_back(pieces[i].page_id);
+    }
+
+    // leaves: chain the pieces in between the old neighbours, node <-> piece 1 <-> ... <-> oldNext
+    uint32_t oldNext = node.next_page_id;
+    if (node.is_leaf) {
+        for (size_t i = 0; i < pieces.size(); i++) {
+            pieces[i].prev_page_id = i > 0 ? pieces[i - 1].page_id : node.prev_page_id;
+            pieces[i].next_page_id = i + 1 < pieces.size() ? pieces[i + 1].page_id : oldNext;
+        }
+    }
+    for (size_t i = pieces.size(); i-- > 0;) {
+        if (node.is_leaf) {
+            leaf_filters_.build(pieces[i].page_id, pieces[i].keys);
+        }
+        saveNode(pieces[i].page_id, pieces[i]);
+    }
+
+    if (node.is_leaf && oldNext != 0) {
+        Node nextLeaf;
+        loadNode(oldNext, nextLeaf);
+        nextLeaf.prev_page_id = pieces.back().page_id;
+        saveNode(oldNext, nextLeaf);
+    }
+}
+
+// cut node in half (by bytes, like a single split) until no piece is full
+// separators[i] ends up between pieces[i] and pieces[i + 1]
+void BPlusTree::splitPieces(Node& node, vector<Node>& pieces, vector<string>& separators) const {
+    if (!isFull(node)) {
+        pieces.push_back(move(node));
+        return;
+    }
+
+    Node left(node.is_leaf);
+    Node right(node.is_leaf);
+    string middle;
+    splitNode(node, left, right, middle);
+
+    splitPieces(left, pieces, separators);
+    separators.push_back(middle);
+    splitPieces(right, pieces, separators);
+}
+
+void BPlusTree::splitNode(const Node& node, Node& left, Node& right, string& middle) const {
+    splitNodeAt(node, splitIndex(node), left, right, middle);
+}
+
+void BPlusTree::splitNodeAt(const Node& node, int split_index, Node& left, Node& right, string& middle) const {
+    if (node.is_leaf) {
+        middle = separator(node.keys[split_index - 1], node.keys[split_index]);
+        left.keys.assign(node.keys.begin(), node.keys.begin() + split_index);
+        left.values.assign(node.values.begin(), node.values.begin() + split_index);
+        right.keys.assign(node.keys.begin() + split_index, node.keys.end());
+        right.values.assign(node.values.begin() + split_index, node.values.end());
+    } else {
+        // the middle key moves up
+        middle = node.keys[split_index];
+        left.keys.assign(node.keys.begin(), node.keys.begin() + split_index);
+        left.children_page_ids.assign(node.children_page_ids.begin(), node.children_page_ids.begin() + split_index + 1);
+        right.keys.assign(node.keys.begin() + split_index + 1, node.keys.end());
+        right.children_page_ids.assign(node.children_page_ids.begin() + split_index + 1, node.children_page_ids.end());
+    }
+}
+
+bool BPlusTree::remove(const string& key) {
+    if (!buffer_pool_) {
+        return false;
+    }
+
+    // most removes only touch their leaf and run alongside inserts
+    {
+        shared_lock<shared_mutex> shared(exclusive_mutex_);
+        AtomicOperation operation(buffer_pool_);
+        RemoveAttempt attempt;
+        while ((attempt = tryRemove(key)) == RemoveAttempt::Restart) {
+            this_thread::yield();
+        }
+        if (attempt != RemoveAttempt::Underfull) {
+            return attempt == RemoveAttempt::Removed;
+        }
+    }
+
+    // the leaf would be left underfull: rebalance on the way back up from it, with the tree to ourselves
+    Exclusive exclusive(this);
+    AtomicOperation operation(buffer_pool_);
+    if (root_page_id_ == 0) {
+        return false;
+    }
+    bool removed = false;
+    removeHelper(root_page_id_, key, removed);
+    collapseRoot();
+    return removed;
+}
+
+BPlusTree::RemoveAttempt BPlusTree::tryRemove(const string& key) {
+    Path path;
+    if (!descend(key, path, nullptr)) {
+        return RemoveAttempt::Restart;
+    }
+    if (path.size == 1) {
+        return RemoveAttempt::NotFound;  // empty tree
+    }
+
+    WriteLatches latches(latches_);
+    size_t leaf = path.size - 1;
+    if (!latches.lock(path.page_ids[leaf], path.versions[leaf])) {
+        return RemoveAttempt::Restart;
+    }
+    Node node;
+    loadNode(path.page_ids[leaf], node);
+    int index = lower_bound(node.keys.begin(), node.keys.end(), key) - node.keys.begin();
+    if (!node.is_leaf || index == static_cast<int>(node.keys.size()) || node.keys[index] != key) {
+        return RemoveAttempt::NotFound;
+    }
+    node.keys.erase(node.keys.begin() + index);
+    node.values.erase(node.values.begin() + index);
+
+    // the root leaf has no siblings, it only needs the slow path once it's empty
+    bool is_root = leaf == 1;
+    if (is_root ? node.keys.empty() : isUnderfull(node)) {
+        return RemoveAttempt::Underfull;  // nothing saved, the slow path removes it again
+    }
+    saveNode(path.page_ids[leaf], node);
+    return RemoveAttempt::Removed;
+}
+
+bool BPlusTree::removeHelper(uint32_t page_id, const string& key, bool& removed) {
+    Node node;
+    loadNode(page_id, node);
+
+    if (node.is_leaf) {
+        int index = lower_bound(node.keys.begin(), node.keys.end(), key) - node.keys.begin();
+        if (index == static_cast<int>(node.keys.size()) || node.keys[index] != key) {
+            return false;
+        }
+        node.keys.erase(node.keys.begin() + index);
+        node.values.erase(node.values.begin() + index);
+        saveNode(page_id, node);
+        removed = true;
+        return isUnderfull(node);
+    }
+
+    // same child insert would pick
+    size_t child = upper_bound(node.keys.begin(), node.keys.end(), key) - node.keys.begin();
+    if (child >= node.children_page_ids.size() || !removeHelper(node.children_page_ids[child], key, removed)) {
+        return false;
+    }
+
+    // child is underfull: borrow from a sibling or merge with it (the left one if there is one)
+    if (node.children_page_ids.size() < 2) {
+        return isUnderfull(node);
+    }
+    size_t left_index = child > 0 ? child - 1 : child;
+    joinChildren(node, left_index, PAGE_SIZE, true);
+    saveNode(page_id, node);
+    return isUnderfull(node);
+}
+
+bool BPlusTree::joinChildren(Node& parent, size_t left_index, uint32_t limit, bool redistribute) {
+    uint32_t left_page_id = parent.children_page_ids[left_index];
+    uint32_t right_page_id = parent.children_page_ids[left_index + 1];
+    Node left;
+    Node right;
+    loadNode(left_page_id, left);
+    loadNode(right_page_id, right);
+
+    // both as one node: an internal pair takes the parent's separator back down between them
+    Node combined(left.is_leaf);
+    combined.keys = left.keys;
+    if (left.is_leaf) {
+        combined.keys.insert(combined.keys.end(), right.keys.begin(), right.keys.end());
+        combined.values = left.values;
+        combined.values.insert(combined.values.end(), right.values.begin(), right.values.end());
+    } else {
+        combined.keys.push_back(parent.keys[left_index]);
+        combined.keys.insert(combined.keys.end(), right.keys.begin(), right.keys.end());
+        combined.children_page_ids = left.children_page_ids;
+        combined.children_page_ids.insert(combined.children_page_ids.end(), right.children_page_ids.begin(), right.children_page_ids.end());
+    }
+    combined.prev_page_id = left.prev_page_id;
+
+    // merge: everything on the left page, unlink the right one (leaf chain and parent) and free it
+    if (!isFull(combined) && combined.byteSize() <= limit) {
+        combined.next_page_id = right.next_page_id;
+        if (combined.is_leaf) {
+            leaf_filters_.build(left_page_id, combined.keys);
+        }
+        saveNode(left_page_id, combined);
+        if (combined.is_leaf && right.next_page_id != 0) {
+            Node nextLeaf;
+            loadNode(right.next_page_id, nextLeaf);
+            nextLeaf.prev_page_id = left_page_id;
+            saveNode(right.next_page_id, nextLeaf);
+        }
+        parent.keys.erase(parent.keys.begin() + left_index);
+        parent.children_page_ids.erase(parent.children_page_ids.begin() + left_index + 1);
+        leaf_filters_.drop(right_page_id);
+        buffer_pool_->freePage(right_page_id);
+        return true;
+    }
+
+    // borrow: too much for one page, cut the pair again in the middle (by bytes), links stay as they are
+    if (redistribute && combined.keys.size() >= 3) {
+        Node newLeft(left.is_leaf);
+        Node newRight(left.is_leaf);
+        splitNode(combined, newLeft, newRight, parent.keys[left_index]);
+        newLeft.prev_page_id = left.prev_page_id;
+        newLeft.next_page_id = left.next_page_id;
+        newRight.prev_page_id = right.prev_page_id;
+        newRight.next_page_id = right.next_page_id;
+        if (left.is_leaf) {
+            leaf_filters_.build(left_page_id, newLeft.keys);
+            leaf_filters_.build(right_page_id, newRight.keys);
+        }
+        saveNode(left_page_id, newLeft);
+        saveNode(right_page_id, newRight);
+    }
+    return false;
+}
+
+void BPlusTree::collapseRoot() {
+    while (root_page_id_ != 0) {
+        Node root;
+        loadNode(root_page_id_, root);
+        uint32_t old_root = root_page_id_;
+        if (!root.is_leaf && root.keys.empty() && root.children_page_ids.size() == 1) {
+            root_page_id_ = root.children_page_ids[0];
+        } else if (root.is_leaf && root.keys.empty()) {
+            root_page_id_ = 0;
+        } else {
+            return;
+        }
+        saveRootPageId();
+        leaf_filters_.drop(old_root);
+        buffer_pool_->freePage(old_root);
+    }
+}
+
+size_t BPlusTree::compact() {
+    if (!buffer_pool_) {
+        return 0;
+    }
+    Exclusive exclusive(this);
+    AtomicOperation operation(buffer_pool_);
     if (root_page_id_ == 0) {
         return 0;
     }
+    size_t freed = compactHelper(root_page_id_);
+    collapseRoot();
+    return freed;
+}
 
-    // find the leaf node that contains the key
-    uint32_t leaf_page_id = findLeaf(key);
-    if (leaf_page_id == 0) {
-        return 0;  // not found
+// post-order: children are compacted first, then neighbouring children are merged while the result
+// stays below COMPACT_FILL of a page (some room left so the next inserts don't split right away)
+size_t BPlusTree::compactHelper(uint32_t page_id) {
+    Node node;
+    loadNode(page_id, node);
+    if (node.is_leaf) {
+        return 0;
     }
-    Node leaf;
-    loadNode(leaf_page_id, leaf);
 
-    // search through leaf's keys for a match
-    // if found, return corresponding value (file position), else 0
-    for (int i = 0; i < leaf.keys.size(); i++) {
-        if (leaf.keys[i] == key) {
-            return leaf.values[i];
+    size_t freed = 0;
+    for (uint32_t child : node.children_page_ids) {
+        freed += compactHelper(child);
+    }
+
+    bool changed = false;
+    size_t index = 0;
+    while (index + 1 < node.children_page_ids.size()) {
+        if (joinChildren(node, index, COMPACT_FILL * PAGE_SIZE, false)) {
+            freed++;
+            changed = true;
+        } else {
+            index++;
         }
     }
+    if (changed) {
+        saveNode(page_id, node);
+    }
+    return freed;
+}
 
-    return 0;
+vector<uint32_t> BPlusTree::pageIds() {
+    vector<uint32_t> page_ids;
+    if (!buffer_pool_) {
+        return page_ids;
+    }
+    Exclusive exclusive(this);
+    if (root_page_id_ != 0) {
+        collectPages(root_page_id_, page_ids);
+    }
+    return page_ids;
+}
+
+void BPlusTree::collectPages(uint32_t page_id, vector<uint32_t>& page_ids) {
+    page_ids.push_back(page_id);
+    Node node;
+    loadNode(page_id, node);
+    if (node.is_leaf) {
+        return;
+    }
+    for (uint32_t child : node.children_page_ids) {
+        if (child != 0) {
+            collectPages(child, page_ids);
+        }
+    }
+}
+
+vector<uint64_t> BPlusTree::searchBatch(const vector<string>& keys) {
+    vector<uint64_t> results(keys.size(), 0);
+    if (keys.empty() || !buffer_pool_) {
+        return results;
+    }
+
+    vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+
+    // page 0 is the root's parent for lock coupling, like in descend()
+    while (true) {
+        uint64_t tree_version = stableTreeVersion();
+        uint64_t version = latches_.readLock(0);
+        uint32_t root_page_id = root_page_id_;
+        if (root_page_id == 0) {
+            return results;
+        }
+        searchBatchHelper(root_page_id, 0, version, keys, order.data(), order.size(), results);
+        if (tree_version_ == tree_version) {
+            return results;
+        }
+    }
+}
+
+void BPlusTree::searchBatchHelper(uint32_t page_id, uint32_t parent_id, uint64_t parent_version,
+    const vector<string>& keys, const size_t* order, size_t count, vector<uint64_t>& results) {
+    // runs of keys headed for the same child, collected first so the page is unpinned before going down
+    vector<uint32_t> children;
+    vector<size_t> run_starts;
+
+    // same coupling as descend(): page_id must still be the parent's child when we read its version,
+    // and unchanged after reading it; if not, this run goes through search() one key at a time
+    uint64_t version = latches_.readLock(page_id);
+    bool unchanged = latches_.validate(parent_id, parent_version);
+
+    // a leaf whose filter rules out every key of the run isn't read at all
+    if (unchanged) {
+        size_t maybe = 0;
+        while (maybe < count && !leaf_filters_.mayContain(page_id, keys[order[maybe]])) {
+            maybe++;
+        }
+        if (maybe == count && latches_.validate(page_id, version)) {
+            return;
+        }
+    }
+
+    if (unchanged) {
+        ReadPageGuard guard = buffer_pool_->fetchPage(page_id);
+        if (!guard.valid()) {
+            return;
+        }
+        NodeView current(guard.page());
+
+        if (current.isLeaf()) {
+            for (size_t i = 0; i < count; i++) {
+                const string& key = keys[order[i]];
+                uint16_t index = current.lowerBound(key);
+                if (index < current.numKeys() && current.compare(key, index) == 0) {
+                    results[order[i]] = current.value(index);
+                }
+            }
+        } else {
+            for (size_t i = 0; i < count; i++) {
+                uint32_t child = current.childFor(keys[order[i]]);
+                if (children.empty() || children.back() != child) {
+                    children.push_back(child);
+                    run_starts.push_back(i);
+                }
+            }
+        }
+    }
+    if (!unchanged || !latches_.validate(page_id, version)) {
+        for (size_t i = 0; i < count; i++) {
+            results[order[i]] = search(keys[order[i]]);
+        }
+        return;
+    }
+
+    run_starts.push_back(count);
+    for (size_t i = 0; i < children.size(); i++) {
+        if (children[i] != 0) {
+            searchBatchHelper(children[i], page_id, version, keys, order + run_starts[i], run_starts[i + 1] - run_starts[i], results);
+        }
+    }
+}
+
+// search for key in tree. if found, return value, else return 0
+uint64_t BPlusTree::search(const string& key) {
+    if (!buffer_pool_) {
+        return 0;
+    }
+
+    // no latches: descend, look the key up in the leaf, and start over if anything moved meanwhile
+    Path path;
+    uint64_t value;
+    while (true) {
+        uint64_t tree_version = stableTreeVersion();
+        if (descend(key, path, &value) && tree_version_ == tree_version) {
+            return value;
+        }
+        this_thread::yield();
+    }
 }
 
 // find the leaf node that contains the key
 uint32_t BPlusTree::findLeaf(const string& key) {
-    if (root_page_id_ == 0) {
+    if (!buffer_pool_) {
         return 0;
     }
 
-    // start at root
-    Node current;
-    loadNode(root_page_id_, current);
+    Path path;
+    while (true) {
+        uint64_t tree_version = stableTreeVersion();
+        if (descend(key, path, nullptr) && tree_version_ == tree_version) {
+            break;
+        }
+        this_thread::yield();
+    }
+    return path.size > 1 ? path.page_ids[path.size - 1] : 0;
+}
 
-    while (!current.is_leaf) {
-        bool found = false;
-        // go through keys in current node to find child node to follow next
-        // if key is less than current key, follow child node at current index
-        for (int i = 0; i < current.keys.size(); i++) {
-            if (key < current.keys[i]) {
-                loadNode(current.children_page_ids[i], current);
-                found = true;
-                break;
+bool BPlusTree::descend(const string& key, Path& path, uint64_t* value) {
+    if (value) {
+        *value = 0;
+    }
+
+    // whole-tree operations change leaves without latching them, a filter built from a page is only kept
+    // if none ran meanwhile
+    uint64_t tree_version = tree_version_;
+
+    // page 0 stands in for the root's parent: whoever replaces the root holds its latch
+    uint64_t version = latches_.readLock(0);
+    uint32_t page_id = root_page_id_;
+    if (!latches_.validate(0, version)) {
+        return false;
+    }
+    path.page_ids[0] = 0;
+    path.versions[0] = version;
+    path.size = 1;
+
+    // binary search every level on the page itself (no Node built on the way down)
+    while (page_id != 0) {
+        if (path.size == MAX_HEIGHT) {
+            return false;
+        }
+
+        // lock coupling: the parent unchanged after reading the child's version means it's still the right child
+        version = latches_.readLock(page_id);
+        if (!latches_.validate(path.page_ids[path.size - 1], path.versions[path.size - 1])) {
+            return false;
+        }
+        path.page_ids[path.size] = page_id;
+        path.versions[path.size] = version;
+        path.size++;
+
+        // a leaf whose filter rules the key out is done with, without reading its page (only leaves have filters)
+        bool wants_filter = false;
+        if (value && !leaf_filters_.mayContain(page_id, key, &wants_filter)) {
+            return latches_.validate(page_id, version);
+        }
+
+        uint32_t child = 0;
+        vector<string> filter_keys;
+        {
+            ReadPageGuard guard = buffer_pool_->fetchPage(page_id);
+            if (!guard.valid()) {
+                return true;  // only without a page manager (the pool waits for a frame otherwise), nothing to find
+            }
+            NodeView current(guard.page());
+            if (current.isLeaf()) {
+                if (value) {
+                    uint16_t index = current.lowerBound(key);
+                    if (index < current.numKeys() && current.compare(key, index) == 0) {
+                        *value = current.value(index);
+                    }
+
+                    // first lookup on a leaf without a filter builds one from the page
+                    if (wants_filter && current.numKeys() > 0) {
+                        filter_keys.reserve(current.numKeys());
+                        for (uint16_t i = 0; i < current.numKeys(); i++) {
+                            filter_keys.push_back(current.key(i));
+                        }
+                    }
+                }
+            } else {
+                // follow the first child whose keys are all > key, the last child if key >= all keys
+                child = current.childFor(key);
             }
         }
-        // if key is greater than all keys in current node, follow last child node (last index in children vector)
-        if (!found) {
-            loadNode(current.children_page_ids.back(), current);
+
+        // whatever we read from the page only counts if no writer had it meanwhile
+        if (!latches_.validate(page_id, version)) {
+            return false;
+        }
+        if (!filter_keys.empty()) {
+            leaf_filters_.build(page_id, filter_keys, [&] {
+                return latches_.validate(page_id, version) && (tree_version & 1) == 0 && tree_version_ == tree_version;
+            });
         }
+        page_id = child;  // 0 past the leaf (or on a corrupt child pointer)
     }
-    return current.page_id;
+    return true;
 }
 
+uint64_t BPlusTree::stableTreeVersion() const {
+    uint64_t version = tree_version_;
+    while (version & 1) {
+        this_thread::yield();
+        version = tree_version_;
+    }
+    return version;
+}
 
-void Node::serializeToPage(Page& page) const { // write node data to page
-    uint32_t offset = 0;
+// node takes one more separator (of any length) without splitting
+// counts full keys: a new key can only shorten the node prefix, never grow it
+bool BPlusTree::canAbsorb(const Node& node) const {
+    if (order_ > 0 && node.keys.size() + 1 >= static_cast<size_t>(order_)) {
+        return false;
+    }
+    uint32_t size = NODE_SLOTS + SLOT_SIZE + 2 + MAX_KEY_SIZE + 4;
+    for (size_t i = 0; i < node.keys.size(); i++) {
+        size += SLOT_SIZE + node.cellSize(i);
+    }
+    return size <= PAGE_SIZE;
+}
 
-    // write is_leaf (1 byte)
-    page.writeBytes(offset, (char*)&is_leaf, 1);
-    offset += 4;
+// node has to split: page is over by bytes, or a fixed order was asked for and reached
+bool BPlusTree::isFull(const Node& node) const {
+    if (node.byteSize() > PAGE_SIZE) {
+        return true;
+    }
+    return order_ > 0 && node.keys.size() >= static_cast<size_t>(order_);
+}
+
+// less than a quarter of a page (or half the order) in use, so a merge with a sibling always fits
+bool BPlusTree::isUnderfull(const Node& node) const {
+    if (order_ > 0) {
+        size_t minimum = (order_ - 1) / 2;
+        return node.keys.size() < (minimum > 0 ? minimum : 1);
+    }
+    return node.byteSize() < PAGE_SIZE / 4;
+}
 
-    // write num_keys (4 bytes)
-    uint32_t num_keys = keys.size();
-    page.writeUint32(offset, num_keys);
-    offset += 4;
+// where to cut an overfull node so both halves hold about the same number of bytes
+// leaves keep at least one key per side, internal nodes also need a key to push up
+int BPlusTree::splitIndex(const Node& node) const {
+    int num_keys = node.keys.size();
+    uint32_t total = 0;
+    for (int i = 0; i < num_keys; i++) {
+        total += node.cellSize(i);
+    }
 
-    // write next_page_id (4 bytes)
-    page.writeUint32(offset, next_page_id);
-    offset += 4;
+    int split_index = 0;
+    uint32_t left = 0;
+    while (split_index < num_keys && left + node.cellSize(split_index) / 2 < total / 2) {
+        left += node.cellSize(split_index);
+        split_index++;
+    }
 
-    const uint32_t key_size = 64;
-    const uint32_t entry_size = key_size + 8;
+    int lowest = 1;
+    int highest = node.is_leaf ? num_keys - 1 : num_keys - 2;
+    if (split_index > highest) split_index = highest;
+    if (split_index < lowest) split_index = lowest;
+    return split_index;
+}
 
-    // write keys
-    for (uint32_t i = 0; i < keys.size(); i++) {
-        uint32_t entry_offset = 12 + (i * entry_size);
-        uint32_t value_offset = entry_offset + key_size;
+string BPlusTree::separator(const string& left, const string& right) {
+    // right's first differing byte is larger than left's (or left ran out), so
+    // right cut just past the common prefix still sorts after left and is a prefix of right
+    size_t common = 0;
+    while (common < left.size() && common < right.size() && left[common] == right[common]) {
+        common++;
+    }
+    return right.substr(0, common + 1);
+}
 
-        // write key
-        char key_buffer[key_size] = {0}; // create a 64 byte buffer
-        uint32_t key_len = keys[i].size();
-        if (key_len > 0 && key_len <= key_size) { // if key is not too long, copy it to the buffer
-            memcpy(key_buffer, keys[i].c_str(), key_len);
+// leftmost or rightmost leaf, 0 if the tree is empty
+uint32_t BPlusTree::edgeLeaf(bool leftmost) {
+    if (root_page_id_ == 0 || !buffer_pool_) {
+        return 0;
+    }
+
+    uint32_t page_id = root_page_id_;
+    while (page_id != 0) {
+        ReadPageGuard guard = buffer_pool_->fetchPage(page_id);
+        if (!guard.valid()) {
+            return 0;
         }
-        page.writeBytes(entry_offset, key_buffer, key_size); // write the buffer to the page
+        NodeView current(guard.page());
+        if (current.isLeaf()) {
+            return page_id;
+        }
+        page_id = current.child(leftmost ? 0 : current.numKeys());
+    }
+    return 0;
+}
 
-        // write value
-        if (is_leaf) {
-            page.writeUint64(value_offset, values[i]);
-        } else {
-        // for internal nodes, write the left child for this key
-        // (children_page_ids[i] is the left child of key[i])
-            page.writeUint64(value_offset, children_page_ids[i]);
+BPlusTree::Iterator BPlusTree::lowerBound(const string& key) {
+    Iterator it;
+    uint32_t leaf_page_id = findLeaf(key);
+    if (leaf_page_id == 0) {
+        return it;
+    }
+    it.tree_ = this;
+    it.loadLeaf(leaf_page_id, true);
+
+    // first key >= key in this leaf
+    size_t index = lower_bound(it.leaf_.keys.begin(), it.leaf_.keys.end(), key) - it.leaf_.keys.begin();
+
+    // everything in this leaf is smaller, the answer is the first entry of a later leaf
+    if (index == it.leaf_.keys.size()) {
+        it.index_ = static_cast<int>(index) - 1;
+        it.next();
+        return it;
+    }
+    it.index_ = static_cast<int>(index);
+    return it;
+}
+
+BPlusTree::Iterator BPlusTree::seek(const string& key) {
+    Iterator it = lowerBound(key);
+    if (!it.valid() || it.key() != key) {
+        return Iterator();
+    }
+    return it;
+}
+
+BPlusTree::Iterator BPlusTree::first() {
+    Iterator it;
+    uint32_t leaf_page_id = edgeLeaf(true);
+    if (leaf_page_id == 0) {
+        return it;
+    }
+    it.tree_ = this;
+    it.loadLeaf(leaf_page_id, true);
+    it.index_ = -1;
+    it.next();
+    return it;
+}
+
+BPlusTree::Iterator BPlusTree::last() {
+    Iterator it;
+    uint32_t leaf_page_id = edgeLeaf(false);
+    if (leaf_page_id == 0) {
+        return it;
+    }
+    it.tree_ = this;
+    it.loadLeaf(leaf_page_id, false);
+    it.index_ = it.leaf_.keys.size();
+    it.prev();
+    return it;
+}
+
+size_t BPlusTree::scan(const string& begin, const string& end, const function<bool(const string&, uint64_t)>& callback) {
+    size_t visited = 0;
+    for (Iterator it = lowerBound(begin); it.valid(); it.next()) {
+        if (!end.empty() && it.key() >= end) {
+            break;
+        }
+        visited++;
+        if (!callback(it.key(), it.value())) {
+            break;
         }
     }
-    
-    // for internal nodes, we need to write the last (rightmost) child
-    // internal nodes have num_keys + 1 children
-    if (!is_leaf && keys.size() > 0) {
-        uint32_t last_entry_offset = 12 + (keys.size() * entry_size);
-        uint32_t last_value_offset = last_entry_offset + key_size;
-        page.writeUint64(last_value_offset, children_page_ids.back());
+    return visited;
+}
+
+void BPlusTree::Iterator::next() {
+    if (!tree_) {
+        return;
+    }
+    index_++;
+
+    // ran off this leaf, follow the chain (skipping empty leaves)
+    while (index_ >= static_cast<int>(leaf_.keys.size())) {
+        if (leaf_.next_page_id == 0) {
+            tree_ = nullptr;
+            return;
+        }
+        loadLeaf(leaf_.next_page_id, true);
+        index_ = 0;
     }
 }
 
-void Node::deserializeFromPage(const Page& page) {
-    uint32_t offset = 0;
+void BPlusTree::Iterator::prev() {
+    if (!tree_) {
+        return;
+    }
+    index_--;
+
+    while (index_ < 0) {
+        if (leaf_.prev_page_id == 0) {
+            tree_ = nullptr;
+            return;
+        }
+        loadLeaf(leaf_.prev_page_id, false);
+        index_ = static_cast<int>(leaf_.keys.size()) - 1;
+    }
+}
+
+void BPlusTree::Iterator::loadLeaf(uint32_t page_id, bool forward) {
+    // start from an empty leaf so a failed load ends the walk instead of looping
+    leaf_ = Node(true);
+    tree_->loadNode(page_id, leaf_);
+
+    // leaves aren't allocated in key order, so sequential read-ahead won't spot a chain walk;
+    // ask the kernel for the next leaf while the caller works through this one
+    uint32_t ahead = forward ? leaf_.next_page_id : leaf_.prev_page_id;
+    if (ahead != 0 && tree_->page_manager_) {
+        tree_->page_manager_->adviseWillNeed(ahead, 1);
+    }
+}
 
-    // read is_leaf (1 byte)
-    page.readBytes(offset, (char*)&is_leaf, 1);
-    offset += 4;
+void Node::serializeToPage(Page& page) const { // write node data to page
+    // node header, right after the page header (LSN)
+    uint16_t num_keys = keys.size();
+    uint16_t prefix_len = prefixLength();
+    page.writeBytes(NODE_IS_LEAF, (const char*)&is_leaf, 1);
+    page.writeUint16(NODE_NUM_KEYS, num_keys);
+    page.writeUint32(NODE_NEXT_PAGE, next_page_id);
+    page.writeUint32(NODE_PREV_PAGE, prev_page_id);
+
+    // internal nodes: children_page_ids[0] goes in the header, every cell carries the child right of its key
+    uint32_t leftmost_child = (!is_leaf && !children_page_ids.empty()) ? children_page_ids[0] : 0;
+    page.writeUint32(NODE_LEFTMOST_CHILD, leftmost_child);
+
+    // the shared prefix goes at the very end of the page, once
+    uint32_t heap_start = PAGE_SIZE - prefix_len;
+    page.writeUint16(NODE_PREFIX_LEN, prefix_len);
+    if (prefix_len > 0) {
+        page.writeBytes(heap_start, keys[0].data(), prefix_len);
+    }
 
-    // read num_keys (4 bytes)
-    uint32_t num_keys = page.readUint32(offset);
-    offset += 4;
+    // cells are packed from the prefix down, slots from the header up (both in key order)
+    for (size_t i = 0; i < num_keys; i++) {
+        uint32_t cell_size = cellSize(i, prefix_len);
+        if (heap_start < NODE_SLOTS + (i + 1) * SLOT_SIZE + cell_size) {
+            break;  // doesn't fit, the tree splits before this can happen
+        }
+        heap_start -= cell_size;
+
+        uint32_t offset = heap_start;
+        uint32_t suffix_len = keys[i].size() - prefix_len;
+        page.writeUint16(offset, suffix_len);
+        offset += 2;
+        page.writeBytes(offset, keys[i].data() + prefix_len, suffix_len);
+        offset += suffix_len;
+        if (is_leaf) {
+            page.writeUint64(offset, values[i]);
+        } else {
+            page.writeUint32(offset, i + 1 < children_page_ids.size() ? children_page_ids[i + 1] : 0);
+        }
+        page.writeUint16(NODE_SLOTS + i * SLOT_SIZE, heap_start);
+    }
+    page.writeUint16(NODE_HEAP_START, heap_start);
+}
 
-    // read next_page_id
-    next_page_id = page.readUint32(offset);
-    offset += 4;
+void Node::deserializeFromPage(const Page& page) {
+    // read node header
+    page.readBytes(NODE_IS_LEAF, (char*)&is_leaf, 1);
+    uint16_t num_keys = page.readUint16(NODE_NUM_KEYS);
+    next_page_id = page.readUint32(NODE_NEXT_PAGE);
+    prev_page_id = page.readUint32(NODE_PREV_PAGE);
 
     // clear vectors
     keys.clear();
     values.clear();
     children_page_ids.clear();
 
-    const uint32_t key_size = 64;
-    const uint32_t entry_size = key_size + 8; // 72 bytes per entry
+    // a garbage slot count can't run past the page
+    uint32_t max_keys = (PAGE_SIZE - NODE_SLOTS) / SLOT_SIZE;
+    if (num_keys > max_keys) {
+        num_keys = max_keys;
+    }
+    keys.reserve(num_keys);
 
-    // loop through entries and read the key and value
-    for (uint32_t i = 0; i < num_keys; i++) {
-        uint32_t entry_offset = 12 + (i * entry_size);
-        uint32_t value_offset = entry_offset + key_size;
+    // every key is the node prefix followed by its cell's suffix
+    uint32_t prefix_len = page.readUint16(NODE_PREFIX_LEN);
+    if (prefix_len > MAX_KEY_SIZE) {
+        prefix_len = 0;  // garbage
+    }
+    string prefix = page.readString(PAGE_SIZE - prefix_len, prefix_len);
 
-        // read key
-        char key_buffer[key_size] = {0};
-        page.readBytes(entry_offset, key_buffer, key_size);
-        string key_str(key_buffer);
+    // internal nodes have num_keys + 1 children, the first one lives in the header
+    // (a bulk-loaded tree can end a level with a node that has just that one child)
+    if (!is_leaf && page.readUint32(NODE_LEFTMOST_CHILD) != 0) {
+        children_page_ids.reserve(num_keys + 1);
+        children_page_ids.push_back(page.readUint32(NODE_LEFTMOST_CHILD));
+    }
 
-        // remove any null characters from the key
-        size_t null_pos = key_str.find('\0');
-        if (null_pos != string::npos) {
-            key_str = key_str.substr(0, null_pos);
+    // follow the slot directory, slots are already in key order
+    uint32_t value_size = is_leaf ? 8 : 4;
+    for (size_t i = 0; i < num_keys; i++) {
+        uint32_t offset = page.readUint16(NODE_SLOTS + i * SLOT_SIZE);
+        uint32_t key_len = page.readUint16(offset);
+        if (offset < NODE_SLOTS || offset + 2 + key_len + value_size > PAGE_SIZE) {
+            break;  // corrupt cell
         }
-        keys.push_back(key_str);
+        keys.push_back(prefix);
+        keys.back().append(page.getData(offset + 2), key_len);
 
-        // read value
+        uint32_t value_offset = offset + 2 + key_len;
         if (is_leaf) {
             values.push_back(page.readUint64(value_offset));
         } else {
-            // for internal nodes, read the left child for this key
-            children_page_ids.push_back(page.readUint64(value_offset));
+            children_page_ids.push_back(page.readUint32(value_offset));
         }
     }
-    
-    // for internal nodes, read the last (rightmost) child
-    if (!is_leaf && num_keys > 0) {
-        uint32_t last_entry_offset = 12 + (num_keys * entry_size);
-        uint32_t last_value_offset = last_entry_offset + key_size;
-        children_page_ids.push_back(page.readUint64(last_value_offset));
+}
+
+NodeView::NodeView(const Page& page) : page_(page) {
+    is_leaf_ = page.data[NODE_IS_LEAF] != 0;
+    num_keys_ = page.readUint16(NODE_NUM_KEYS);
+    prefix_len_ = page.readUint16(NODE_PREFIX_LEN);
+    if (prefix_len_ > MAX_KEY_SIZE) {
+        prefix_len_ = 0;
     }
+
+    // same guard as deserializeFromPage, a garbage slot count can't run past the page
+    uint32_t max_keys = (PAGE_SIZE - NODE_SLOTS) / SLOT_SIZE;
+    if (num_keys_ > max_keys) {
+        num_keys_ = max_keys;
+    }
+}
+
+bool NodeView::cell(uint16_t i, uint32_t& offset, uint16_t& key_len) const {
+    offset = page_.readUint16(NODE_SLOTS + i * SLOT_SIZE);
+    key_len = page_.readUint16(offset);
+    return offset >= NODE_SLOTS && offset + 2 + key_len + (is_leaf_ ? 8 : 4) <= PAGE_SIZE;
+}
+
+int NodeView::compare(const string& key, uint16_t i) const {
+    int result = comparePrefix(key);
+    return result != 0 ? result : compareSuffix(key, i);
+}
+
+int NodeView::comparePrefix(const string& key) const {
+    // a key shorter than the prefix but matching it so far compares as smaller
+    return key.compare(0, prefix_len_, page_.data + PAGE_SIZE - prefix_len_, prefix_len_);
+}
+
+int NodeView::compareSuffix(const string& key, uint16_t i) const {
+    // only called once the key is known to start with the prefix
+    uint32_t offset;
+    uint16_t key_len;
+    if (!cell(i, offset, key_len)) {
+        return key.size() > prefix_len_ ? 1 : 0;  // corrupt cell compares as the bare prefix
+    }
+    return key.compare(prefix_len_, string::npos, page_.getData(offset + 2), key_len);
+}
+
+// both searches check the prefix once: a key outside it sorts before or after every slot
+uint16_t NodeView::lowerBound(const string& key) const {
+    int prefix = comparePrefix(key);
+    if (prefix != 0) {
+        return prefix < 0 ? 0 : num_keys_;
+    }
+    uint16_t low = 0, high = num_keys_;
+    while (low < high) {
+        uint16_t mid = low + (high - low) / 2;
+        if (compareSuffix(key, mid) > 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+uint16_t NodeView::upperBound(const string& key) const {
+    int prefix = comparePrefix(key);
+    if (prefix != 0) {
+        return prefix < 0 ? 0 : num_keys_;
+    }
+    uint16_t low = 0, high = num_keys_;
+    while (low < high) {
+        uint16_t mid = low + (high - low) / 2;
+        if (compareSuffix(key, mid) >= 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+string NodeView::key(uint16_t i) const {
+    string result(page_.data + PAGE_SIZE - prefix_len_, prefix_len_);
+    uint32_t offset;
+    uint16_t key_len;
+    if (i < num_keys_ && cell(i, offset, key_len)) {
+        result.append(page_.getData(offset + 2), key_len);
+    }
+    return result;
+}
+
+uint64_t NodeView::value(uint16_t i) const {
+    uint32_t offset;
+    uint16_t key_len;
+    if (i >= num_keys_ || !cell(i, offset, key_len)) {
+        return 0;
+    }
+    return page_.readUint64(offset + 2 + key_len);
+}
+
+uint32_t NodeView::child(uint16_t i) const {
+    // child 0 lives in the header, child i > 0 is the right child stored in cell i - 1
+    if (i == 0) {
+        return page_.readUint32(NODE_LEFTMOST_CHILD);
+    }
+    uint32_t offset;
+    uint16_t key_len;
+    if (i > num_keys_ || !cell(i - 1, offset, key_len)) {
+        return 0;
+    }
+    return page_.readUint32(offset + 2 + key_len);
+}
+
+uint32_t Node::prefixLength() const {
+    // keys are sorted, whatever the first and last share every key in between shares too
+    if (keys.size() < 2) {
+        return 0;
+    }
+    const string& first = keys.front();
+    const string& last = keys.back();
+    uint32_t length = 0;
+    while (length < first.size() && length < last.size() && first[length] == last[length]) {
+        length++;
+    }
+    return length;
+}
+
+uint32_t Node::cellSize(size_t i, uint32_t prefix_len) const {
+    return 2 + keys[i].size() - prefix_len + (is_leaf ? 8 : 4);
+}
+
+uint32_t Node::byteSize() const {
+    uint32_t prefix_len = prefixLength();
+    uint32_t size = NODE_SLOTS + prefix_len;
+    for (size_t i = 0; i < keys.size(); i++) {
+        size += SLOT_SIZE + cellSize(i, prefix_len);
+    }
+    return size;
 }
 
 void BPlusTree::loadNode(uint32_t page_id, Node& node) {
@@ -340,12 +1363,14 @@ void BPlusTree::loadNode(uint32_t page_id, Node& node) {
         return;
     }
     
-    // load page from BufferPool
-    Page page;
-    buffer_pool_->getPage(page_id, page);
+    // pin page in BufferPool and deserialize straight from the cached frame
+    ReadPageGuard guard = buffer_pool_->fetchPage(page_id);
+    if (!guard.valid()) {
+        return;
+    }
 
     // deserialize node from page
-    node.deserializeFromPage(page);
+    node.deserializeFromPage(guard.page());
 
     // set node.page_id
     node.page_id = page_id;
@@ -357,12 +1382,13 @@ void BPlusTree::saveNode(uint32_t page_id, const Node& node) {
         return;
     }
     
-    // serialize node to page
-    Page page(true);  // clear page first to avoid garbage data
-    node.serializeToPage(page);
-
-    // save page to BufferPool
-    buffer_pool_->savePage(page_id, page);
+    // serialize node straight into the cached frame (marked dirty when guard goes away)
+    WritePageGuard guard = buffer_pool_->fetchPageWrite(page_id);
+    if (!guard.valid()) {
+        return;
+    }
+    guard.page().clear();  // clear page first to avoid garbage data
+    node.serializeToPage(guard.page());
 
 }
 
@@ -379,6 +1405,9 @@ uint32_t BPlusTree::allocateNode(bool is_leaf) {
         new_page_id = page_manager_->allocatePage();
     }
 
+    // a reused page may still have a filter from its life as a leaf
+    leaf_filters_.drop(new_page_id);
+
     // create an empty node
     Node node(is_leaf);
     
@@ -403,13 +1432,15 @@ void BPlusTree::loadRootPageId() {
     }
     
     // try to load root_page_id_ from metadata page (page 0)
-    // if file is new/empty, getPage will return an empty page, and readUint32(0) will return 0
-    Page metadata_page(true);  // initialize with cleared page (all zeros)
-    buffer_pool_->getPage(0, metadata_page);
+    // if file is new/empty, fetchPage will return an empty page and the root id reads as 0
+    ReadPageGuard metadata_page = buffer_pool_->fetchPage(0);
+    if (!metadata_page.valid()) {
+        return;
+    }
     
-    // read root_page_id_ from offset 0 (first 4 bytes of page 0)
+    // read root_page_id_ from the first 4 bytes after the page header of page 0
     // if page is empty (new file), this will be 0, which is correct
-    root_page_id_ = metadata_page.readUint32(0);
+    root_page_id_ = metadata_page.page().readUint32(PAGE_HEADER_SIZE);
 }
 
 // save root_page_id_ to metadata page (page 0)
@@ -420,12 +1451,12 @@ void BPlusTree::saveRootPageId() {
     }
     
     // load existing page 0 (or get empty page if new)
-    Page metadata_page;
-    buffer_pool_->getPage(0, metadata_page);
-    
-    // write root_page_id_ to offset 0 (first 4 bytes of page 0)
-    metadata_page.writeUint32(0, root_page_id_);
+    WritePageGuard metadata_page = buffer_pool_->fetchPageWrite(0);
+    if (!metadata_page.valid()) {
+        return;
+    }
     
-    // mark as dirty and save
-    buffer_pool_->savePage(0, metadata_page);
+    // write root_page_id_ right after the page header of page 0
+    // page is marked dirty when the guard goes out of scope
+    metadata_page.page().writeUint32(PAGE_HEADER_SIZE, root_page_id_);
 }
@@ -1,124 +1,970 @@
-#include "buffer_pool.h"
-
-BufferPool::BufferPool(PageManager* page_manager, size_t max_pages) : page_manager_(page_manager), max_pages_(max_pages) {
-
-}
-
-BufferPool::~BufferPool() {
-    flushAll();
-}
-
-void BufferPool::getPage(uint32_t page_id, Page& page) {
-    // check if page is in cache (cache hit)
-    // -copy from cache to page
-    // -update LRU and return
-    if (cache_.find(page_id) != cache_.end()) {
-        page = cache_[page_id];
-        moveToFront(page_id);
-        return;
-    }
-
-    // if not (cache miss) and cache is full, evict a page to make space
-    if (cache_.size() >= max_pages_) {
-        if (!lru_list_.empty()) {
-            evictPage(lru_list_.back());
-        }
-    }
-
-    // load page from disk
-    if (!page_manager_) {
-        page.clear();
-        return;
-    }
-    page_manager_->readPage(page_id, page);
-
-    // add to cache
-    cache_[page_id] = page;
-    dirty_[page_id] = false;  // just loaded, not modified yet
-    
-    // add to LRU tracking
-    moveToFront(page_id);
-    return;
-}
-
-void BufferPool::savePage(uint32_t page_id, const Page& page) {
-    // update cache
-    cache_[page_id] = page;
-
-    // mark page as dirty
-    dirty_[page_id] = true;
-
-    // update LRU
-    moveToFront(page_id);
-}
-
-void BufferPool::pinPage(uint32_t page_id) {
-    pinned_[page_id] = true;
-}
-
-void BufferPool::unpinPage(uint32_t page_id) {
-    pinned_[page_id] = false;
-}
-
-void BufferPool::flushAll() {
-    // iterate through all dirty pages and flush them
-    for (auto& pair : dirty_) {
-        if (pair.second) {
-            flushPage(pair.first);
-        }
-    }
-
-    // clear dirty pages
-    dirty_.clear();
-}
-
-void BufferPool::moveToFront(uint32_t page_id) {
-    if (lru_map_.find(page_id) != lru_map_.end()) {
-        // already tracked - move to front
-        auto iterator = lru_map_[page_id];
-        lru_list_.splice(lru_list_.begin(), lru_list_, iterator);
-        lru_map_[page_id] = lru_list_.begin();
-    } else {
-        // not tracked yet - add to front
-        lru_list_.push_front(page_id);
-        lru_map_[page_id] = lru_list_.begin();
-    }
-}
-
-void BufferPool::flushPage(uint32_t page_id) {
-    // check if page exists in cache
-    if (cache_.find(page_id) == cache_.end()) return;
-
-    // check if page is dirty (and exists in dirty map)
-    if (dirty_.find(page_id) == dirty_.end() || !dirty_[page_id]) return;
-
-    // write page to disk
-    if (!page_manager_) return;
-    page_manager_->writePage(page_id, cache_[page_id]);
-
-    // mark page as clean
-    dirty_[page_id] = false;
-}
-
-void BufferPool::evictPage(uint32_t page_id) {
-    // check if page is pinned because can't evict in use pages
-    if (pinned_.find(page_id) != pinned_.end() && pinned_[page_id]) return;
-
-    // flush if dirty
-    if (dirty_.find(page_id) != dirty_.end() && dirty_[page_id]) {
-        flushPage(page_id);
-    }
-
-    // remove from cache
-    cache_.erase(page_id);
-
-    // remove from LRU tracking if it exists
-    if (lru_map_.find(page_id) != lru_map_.end()) {
-        lru_list_.erase(lru_map_[page_id]);
-        lru_map_.erase(page_id);
-    }
-
-    // clean up tracking maps
-    pinned_.erase(page_id);
-    dirty_.erase(page_id);
-}
\ No newline at end of file
+#include "buffer_pool.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+// served for pages past end of file in read-only mapped mode
+static const Page ZERO_PAGE(true);
+
+// the operation the current thread has open (see AtomicOperation)
+struct OperationState {
+    BufferPool* pool = nullptr;
+    int depth = 0;
+    vector<uint32_t> page_ids;  // pages written so far, logged together at the end
+    vector<uint32_t> freed_page_ids;  // pages freed by the operation, given back once it's logged
+};
+static thread_local OperationState current_operation;
+
+BufferPool::BufferPool(PageManager* page_manager, size_t max_pages, size_t num_partitions, LogManager* log_manager)
+    : page_manager_(page_manager), log_manager_(log_manager), max_pages_(max_pages), num_partitions_(num_partitions), frames_(nullptr),
+      last_miss_page_(INVALID_PAGE_ID), sequential_misses_(0), dirty_count_(0), dirty_watermark_(0),
+      checkpoint_log_bytes_(CHECKPOINT_LOG_BYTES), checkpoint_log_base_(0), cleaner_stop_(false) {
+    if (max_pages_ == 0) {
+        max_pages_ = 1;
+    }
+
+    // default: one partition per hardware thread, but keep at least 32 frames in each
+    if (num_partitions_ == 0) {
+        size_t hardware_threads = thread::hardware_concurrency();
+        num_partitions_ = hardware_threads > 0 ? hardware_threads : 1;
+        if (num_partitions_ > max_pages_ / 32) {
+            num_partitions_ = max_pages_ / 32;
+        }
+    }
+    if (num_partitions_ == 0) {
+        num_partitions_ = 1;
+    }
+    if (num_partitions_ > max_pages_) {
+        num_partitions_ = max_pages_;
+    }
+
+    // allocate every frame up front, page-aligned and contiguous
+    frames_ = static_cast<Page*>(aligned_alloc(PAGE_SIZE, max_pages_ * PAGE_SIZE));
+    for (size_t i = 0; i < max_pages_; i++) {
+        new (&frames_[i]) Page(true);
+    }
+
+    frame_page_ids_.assign(max_pages_, INVALID_PAGE_ID);
+    referenced_.assign(max_pages_, 0);
+    flushing_.assign(max_pages_, 0);
+    pin_counts_.reset(new atomic<uint32_t>[max_pages_]);
+    dirty_.reset(new atomic<uint8_t>[max_pages_]);
+    write_counts_.reset(new atomic<uint32_t>[max_pages_]);
+    operation_refs_.reset(new atomic<uint32_t>[max_pages_]);
+    recovery_lsns_.reset(new atomic<uint64_t>[max_pages_]);
+    frame_latches_.reset(new shared_mutex[max_pages_]);
+    for (size_t i = 0; i < max_pages_; i++) {
+        pin_counts_[i] = 0;
+        dirty_[i] = 0;
+        write_counts_[i] = 0;
+        operation_refs_[i] = 0;
+        recovery_lsns_[i] = 0;
+    }
+
+    // split frames as evenly as possible between partitions
+    partitions_.reset(new Partition[num_partitions_]);
+    size_t frame_begin = 0;
+    for (size_t p = 0; p < num_partitions_; p++) {
+        Partition& partition = partitions_[p];
+        size_t frame_count = max_pages_ / num_partitions_ + (p < max_pages_ % num_partitions_ ? 1 : 0);
+        partition.frame_begin = frame_begin;
+        partition.frame_end = frame_begin + frame_count;
+        frame_begin += frame_count;
+
+        // hand out low frames first
+        partition.free_frames.reserve(frame_count);
+        for (size_t i = partition.frame_end; i > partition.frame_begin; i--) {
+            partition.free_frames.push_back(i - 1);
+        }
+
+        // page table is kept at most half full so probe chains stay short
+        size_t table_size = 1;
+        while (table_size < frame_count * 2) {
+            table_size <<= 1;
+        }
+        partition.page_table.assign(table_size, PageTableEntry{INVALID_PAGE_ID, INVALID_FRAME_ID});
+        partition.table_mask = table_size - 1;
+    }
+
+    // cleaner keeps at most a quarter of the pool dirty unless told otherwise
+    dirty_watermark_ = max_pages_ / 4 > 0 ? max_pages_ / 4 : 1;
+
+    // an open operation may hold at most half of a partition
+    operation_limit_ = max_pages_ / num_partitions_ / 2;
+    if (operation_limit_ == 0) {
+        operation_limit_ = 1;
+    }
+
+    // redo whatever the log has before any page gets cached
+    if (log_manager_ && page_manager_ && !page_manager_->isMapped()) {
+        log_manager_->recover(page_manager_);
+    }
+
+    // background writeback, nothing to write in read-only mapped mode
+    if (page_manager_ && !page_manager_->isMapped()) {
+        cleaner_ = thread(&BufferPool::cleanerLoop, this);
+    }
+}
+
+BufferPool::~BufferPool() {
+    if (cleaner_.joinable()) {
+        {
+            lock_guard<mutex> lock(cleaner_mutex_);
+            cleaner_stop_ = true;
+        }
+        cleaner_wake_.notify_one();
+        cleaner_.join();
+    }
+    flushAll();
+    for (size_t i = 0; i < max_pages_; i++) {
+        frames_[i].~Page();
+    }
+    free(frames_);
+}
+
+ReadPageGuard BufferPool::fetchPage(uint32_t page_id) {
+    // read-only mapped file: hand out the mapped page itself, no frame, no pin, no copy
+    if (page_manager_ && page_manager_->isMapped()) {
+        const Page* mapped = page_manager_->mappedPage(page_id);
+        return ReadPageGuard(nullptr, page_id, INVALID_FRAME_ID, const_cast<Page*>(mapped ? mapped : &ZERO_PAGE));
+    }
+
+    uint32_t frame_id = fetchFrame(page_id, false, true);
+    if (frame_id == INVALID_FRAME_ID) {
+        return ReadPageGuard();
+    }
+    return ReadPageGuard(this, page_id, frame_id, &frames_[frame_id]);
+}
+
+WritePageGuard BufferPool::fetchPageWrite(uint32_t page_id) {
+    // nothing can be written through a read-only mapping
+    if (page_manager_ && page_manager_->isMapped()) {
+        return WritePageGuard();
+    }
+
+    uint32_t frame_id = fetchFrame(page_id, true, true);
+    if (frame_id == INVALID_FRAME_ID) {
+        return WritePageGuard();
+    }
+    return WritePageGuard(this, page_id, frame_id, &frames_[frame_id]);
+}
+
+void BufferPool::getPage(uint32_t page_id, Page& page) {
+    if (page_manager_ && page_manager_->isMapped()) {
+        const Page* mapped = page_manager_->mappedPage(page_id);
+        page = mapped ? *mapped : ZERO_PAGE;
+        return;
+    }
+
+    uint32_t frame_id = fetchFrame(page_id, false, true);
+    if (frame_id == INVALID_FRAME_ID) {
+        page.clear();
+        return;
+    }
+    page = frames_[frame_id];
+    releasePage(frame_id, false, false);
+}
+
+void BufferPool::savePage(uint32_t page_id, const Page& page) {
+    if (page_manager_ && page_manager_->isMapped()) {
+        return;  // read-only
+    }
+
+    // whole page is overwritten, no need to read it from disk first
+    uint32_t frame_id = fetchFrame(page_id, true, false);
+    if (frame_id == INVALID_FRAME_ID) {
+        return;
+    }
+    frames_[frame_id] = page;
+
+    // mark page as dirty
+    releaseWritten(frame_id, page_id);
+}
+
+void BufferPool::prefetch(uint32_t first_page_id, uint32_t count) {
+    if (!page_manager_ || count == 0) {
+        return;
+    }
+
+    // mapped pages are already in memory as far as we're concerned, just warm the mapping
+    if (page_manager_->isMapped()) {
+        page_manager_->adviseWillNeed(first_page_id, count);
+        return;
+    }
+
+    // nothing to read past end of file, and never push out more than half the pool
+    uint32_t page_count = page_manager_->pageCount();
+    if (first_page_id >= page_count) {
+        return;
+    }
+    if (count > page_count - first_page_id) {
+        count = page_count - first_page_id;
+    }
+    size_t limit = max_pages_ / 2 > 0 ? max_pages_ / 2 : 1;
+    if (count > limit) {
+        count = limit;
+    }
+
+    // claim a frame for every page that isn't cached yet, same as a miss in fetchFrame
+    // frames stay write-latched until the batch read is done, so anyone asking for them waits
+    vector<uint32_t> frame_ids;
+    vector<uint32_t> page_ids;
+    vector<Page*> pages;
+    frame_ids.reserve(count);
+    page_ids.reserve(count);
+    pages.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t page_id = first_page_id + i;
+        Partition& partition = partitionFor(page_id);
+        unique_lock<mutex> lock(partition.latch);
+        if (lookup(partition, page_id) != INVALID_FRAME_ID) continue;  // already cached
+
+        // a busy partition just doesn't get this page, prefetching is only a hint
+        uint32_t victim = findVictim(partition, lock);
+        if (victim == INVALID_FRAME_ID) continue;
+        if (lookup(partition, page_id) != INVALID_FRAME_ID) {
+            partition.free_frames.push_back(victim);
+            continue;
+        }
+
+        frame_page_ids_[victim] = page_id;
+        referenced_[victim] = 1;  // survive one clock turn until the reader gets here
+        pin_counts_[victim] = 1;
+        tableInsert(partition, page_id, victim);
+        frame_latches_[victim].lock();
+        lock.unlock();
+
+        frame_ids.push_back(victim);
+        page_ids.push_back(page_id);
+        pages.push_back(&frames_[victim]);
+    }
+
+    // one batch, many reads in flight
+    vector<uint8_t> failed(pages.size());
+    page_manager_->readPageBatch(page_ids.data(), pages.data(), pages.size(), failed.data());
+
+    for (size_t i = 0; i < frame_ids.size(); i++) {
+        uint32_t frame_id = frame_ids[i];
+        if (failed[i]) {
+            // the frame holds a cleared page, not the real one: give it back so the next miss reads the page
+            // itself, unless somebody is already waiting on the frame, then read it for them right here
+            Partition& partition = partitionFor(page_ids[i]);
+            unique_lock<mutex> lock(partition.latch);
+            if (pin_counts_[frame_id] == 1) {
+                tableErase(partition, page_ids[i]);
+                frame_page_ids_[frame_id] = INVALID_PAGE_ID;
+                referenced_[frame_id] = 0;
+                partition.free_frames.push_back(frame_id);
+                frame_latches_[frame_id].unlock();
+                pin_counts_[frame_id]--;
+                continue;
+            }
+            lock.unlock();
+            page_manager_->readPage(page_ids[i], frames_[frame_id]);
+        }
+        frame_latches_[frame_id].unlock();
+        pin_counts_[frame_id]--;
+    }
+}
+
+void BufferPool::readAhead(uint32_t page_id) {
+    uint32_t previous = last_miss_page_.exchange(page_id);
+    if (page_id != previous + 1) {
+        sequential_misses_ = 0;
+        return;
+    }
+    if (++sequential_misses_ < READAHEAD_TRIGGER) {
+        return;
+    }
+
+    // read the next window into the pool in one batch, at most a quarter of the pool
+    uint32_t window = READAHEAD_PAGES;
+    if (window > max_pages_ / 4) {
+        window = max_pages_ / 4;
+    }
+    if (window == 0) {
+        return;
+    }
+    prefetch(page_id + 1, window);
+
+    // the scan's next miss is right after the window, that keeps the run going
+    last_miss_page_ = page_id + window;
+
+    // and let the kernel start on the window after that meanwhile
+    page_manager_->adviseWillNeed(page_id + 1 + window, window);
+}
+
+void BufferPool::pinPage(uint32_t page_id) {
+    // mapped pages never leave memory, nothing to pin
+    if (page_manager_ && page_manager_->isMapped()) return;
+
+    // bring the page in if needed so it stays resident while pinned, keep the pin but not the latch
+    uint32_t frame_id = fetchFrame(page_id, false, true);
+    if (frame_id == INVALID_FRAME_ID) return;
+    frame_latches_[frame_id].unlock_shared();
+}
+
+void BufferPool::unpinPage(uint32_t page_id) {
+    Partition& partition = partitionFor(page_id);
+    lock_guard<mutex> lock(partition.latch);
+    uint32_t frame_id = lookup(partition, page_id);
+    if (frame_id == INVALID_FRAME_ID || pin_counts_[frame_id] == 0) return;
+    pin_counts_[frame_id]--;
+}
+
+bool BufferPool::discardPage(uint32_t page_id) {
+    if (page_manager_ && page_manager_->isMapped()) return true;
+
+    Partition& partition = partitionFor(page_id);
+    lock_guard<mutex> lock(partition.latch);
+    uint32_t frame_id = lookup(partition, page_id);
+    if (frame_id == INVALID_FRAME_ID) return true;
+
+    // in use, on its way to disk, or holding an open operation's changes: it stays
+    if (pin_counts_[frame_id] > 0 || flushing_[frame_id] || operation_refs_[frame_id] > 0) return false;
+
+    // dropped without a writeback, the contents don't matter any more
+    if (dirty_[frame_id].exchange(0)) {
+        dirty_count_--;
+    }
+    tableErase(partition, page_id);
+    frame_page_ids_[frame_id] = INVALID_PAGE_ID;
+    referenced_[frame_id] = 0;
+    partition.free_frames.push_back(frame_id);
+    return true;
+}
+
+void BufferPool::flushAll() {
+    // one flush at a time, two batches racing on the same page could land out of order
+    lock_guard<mutex> flush_lock(flush_mutex_);
+    if (log_manager_ && page_manager_) {
+        checkpoint();
+    } else {
+        writeDirtyFrames(SIZE_MAX);
+    }
+}
+
+void BufferPool::setCheckpointLogSize(uint64_t bytes) {
+    checkpoint_log_bytes_ = bytes;
+    cleaner_wake_.notify_one();
+}
+
+void BufferPool::checkpoint() {
+    // everything logged so far goes to disk first, then every page it covers
+    uint64_t checkpoint_lsn = log_manager_->commit();
+    writeDirtyFrames(SIZE_MAX);
+
+    // frames still dirty (open operations, evictions in flight, written to since their copy) need the log
+    // from their oldest unwritten change on; looked at before the sync, so an eviction that
+    // cleans a frame after this has its write covered by it
+    uint64_t cut_lsn = checkpoint_lsn;
+    for (size_t i = 0; i < max_pages_; i++) {
+        if (dirty_[i]) {
+            uint64_t recovery_lsn = recovery_lsns_[i];
+            if (recovery_lsn <= cut_lsn) {
+                cut_lsn = recovery_lsn > 0 ? recovery_lsn - 1 : 0;
+            }
+        }
+    }
+
+    // the log can go up to cut_lsn once the pages it covers are durable
+    page_manager_->sync();
+    log_manager_->truncate(cut_lsn);
+    checkpoint_log_base_ = log_manager_->size();
+    // frees logged up to the checkpoint can't be undone by replay any more
+    page_manager_->saveFreeSpace(checkpoint_lsn);
+}
+
+bool BufferPool::logNeedsCheckpoint() const {
+    return log_manager_ && log_manager_->size() > checkpoint_log_base_ + checkpoint_log_bytes_;
+}
+
+bool BufferPool::writeDirtyFrames(size_t max_frames) {
+    // dirty pages are copied into a scratch batch and written together so the I/O engine
+    // can keep many writes in flight; frames are only pinned for the copy, not for the I/O
+    Page* scratch = static_cast<Page*>(aligned_alloc(PAGE_SIZE, FLUSH_BATCH_SIZE * PAGE_SIZE));
+    FlushBatch batch;
+    batch.reserve(FLUSH_BATCH_SIZE);
+    bool skipped = false;  // some dirty frame stayed behind
+    size_t copied = 0;
+
+    // take frames from all partitions in turn, neighbouring page ids hash to different partitions
+    // and a batch spanning them can be coalesced into long runs
+    // frames in a batch can't be evicted until it lands, so at most half of a partition goes in one
+    vector<size_t> in_batch(num_partitions_, 0);
+    size_t largest_partition = 0;
+    for (size_t p = 0; p < num_partitions_; p++) {
+        size_t frames = partitions_[p].frame_end - partitions_[p].frame_begin;
+        if (frames > largest_partition) {
+            largest_partition = frames;
+        }
+    }
+
+    for (size_t i = 0; i < largest_partition && copied < max_frames; i++) {
+        for (size_t p = 0; p < num_partitions_ && copied < max_frames; p++) {
+            Partition& partition = partitions_[p];
+            uint32_t frame_id = partition.frame_begin + i;
+            if (frame_id >= partition.frame_end) continue;
+
+            {
+                // pin so the frame can't be evicted while we copy it
+                lock_guard<mutex> lock(partition.latch);
+                if (frame_page_ids_[frame_id] == INVALID_PAGE_ID || !dirty_[frame_id]) continue;
+                // unlogged changes, or an eviction is writing it back right now (may not be on disk when we're done)
+                if (operation_refs_[frame_id] > 0 || flushing_[frame_id]) {
+                    skipped = true;
+                    continue;
+                }
+                pin_counts_[frame_id]++;
+                flushing_[frame_id] = 1;
+            }
+
+            {
+                // writers hold the frame exclusively, so the copy is consistent
+                // the dirty bit stays up until the copy is on disk (see writeBatch)
+                shared_lock<shared_mutex> frame_latch(frame_latches_[frame_id]);
+                Page* copy = &scratch[batch.pages.size()];
+                memcpy(copy->data, frames_[frame_id].data, PAGE_SIZE);
+                batch.frame_ids.push_back(frame_id);
+                batch.page_ids.push_back(frame_page_ids_[frame_id]);
+                batch.write_counts.push_back(write_counts_[frame_id]);
+                batch.pages.push_back(copy);
+            }
+            pin_counts_[frame_id]--;
+            copied++;
+
+            size_t partition_frames = partition.frame_end - partition.frame_begin;
+            size_t partition_limit = partition_frames / 2 > 0 ? partition_frames / 2 : 1;
+            if (++in_batch[p] >= partition_limit || batch.pages.size() >= FLUSH_BATCH_SIZE) {
+                writeBatch(batch);
+                fill(in_batch.begin(), in_batch.end(), 0);
+            }
+        }
+    }
+    writeBatch(batch);
+    free(scratch);
+    return skipped;
+}
+
+void BufferPool::setDirtyWatermark(size_t max_dirty_frames) {
+    dirty_watermark_ = max_dirty_frames > 0 ? max_dirty_frames : 1;
+    cleaner_wake_.notify_one();
+}
+
+void BufferPool::cleanerLoop() {
+    unique_lock<mutex> lock(cleaner_mutex_);
+    while (!cleaner_stop_) {
+        // wake up when writers push the pool over the watermark or the log over its size, or every so often anyway
+        cleaner_wake_.wait_for(lock, CLEANER_INTERVAL,
+                               [&] { return cleaner_stop_ || dirty_count_ > dirty_watermark_ || logNeedsCheckpoint(); });
+        if (cleaner_stop_) {
+            break;
+        }
+
+        // the log outgrew its limit: checkpoint, which cleans the pool as well
+        if (logNeedsCheckpoint()) {
+            lock.unlock();
+            {
+                lock_guard<mutex> flush_lock(flush_mutex_);
+                checkpoint();
+            }
+            lock.lock();
+            continue;
+        }
+
+        // clean down to half the watermark so writers don't wake us again right away
+        size_t dirty = dirty_count_;
+        size_t target = dirty_watermark_ / 2;
+        if (dirty <= target) {
+            continue;
+        }
+        lock.unlock();
+        {
+            lock_guard<mutex> flush_lock(flush_mutex_);
+            writeDirtyFrames(dirty - target);
+        }
+        lock.lock();
+    }
+}
+
+void BufferPool::beginOperation() {
+    if (!log_manager_) {
+        return;
+    }
+    // an operation on another pool is already open, our writes get logged one by one
+    if (current_operation.pool && current_operation.pool != this) {
+        return;
+    }
+    current_operation.pool = this;
+    current_operation.depth++;
+}
+
+void BufferPool::endOperation() {
+    if (!log_manager_ || current_operation.pool != this) {
+        return;
+    }
+    if (--current_operation.depth > 0) {
+        return;  // nested, the outermost one logs
+    }
+    vector<uint32_t> page_ids;
+    vector<uint32_t> freed_page_ids;
+    page_ids.swap(current_operation.page_ids);
+    freed_page_ids.swap(current_operation.freed_page_ids);
+    current_operation.pool = nullptr;
+    logOperation(page_ids);
+
+    // the unlinking writes are logged now (this record or pieces before it), lastLsn covers them all
+    if (page_manager_) {
+        uint64_t lsn = log_manager_->lastLsn();
+        for (uint32_t page_id : freed_page_ids) {
+            page_manager_->freePage(page_id, lsn);
+        }
+    }
+}
+
+void BufferPool::freePage(uint32_t page_id) {
+    if (!page_manager_) {
+        return;
+    }
+    if (current_operation.pool == this) {
+        current_operation.freed_page_ids.push_back(page_id);
+        return;
+    }
+    // no operation open: the writes that unlinked the page were logged one by one already
+    page_manager_->freePage(page_id, log_manager_ ? log_manager_->lastLsn() : 0);
+}
+
+void BufferPool::logOperation(vector<uint32_t>& page_ids) {
+    if (page_ids.empty()) {
+        return;
+    }
+
+    // latch in page id order so two operations logging overlapping pages can't deadlock
+    sort(page_ids.begin(), page_ids.end());
+    vector<uint32_t> frame_ids;
+    vector<Page*> pages;
+    vector<uint32_t> logged_ids;
+    frame_ids.reserve(page_ids.size());
+    pages.reserve(page_ids.size());
+    logged_ids.reserve(page_ids.size());
+    for (uint32_t page_id : page_ids) {
+        // still cached, operation_refs_ kept the frame from being evicted
+        uint32_t frame_id = fetchFrame(page_id, true, true);
+        if (frame_id == INVALID_FRAME_ID) continue;
+        frame_ids.push_back(frame_id);
+        pages.push_back(&frames_[frame_id]);
+        logged_ids.push_back(page_id);
+    }
+
+    log_manager_->logPages(logged_ids.data(), pages.data(), pages.size());
+    if (logNeedsCheckpoint()) {
+        cleaner_wake_.notify_one();
+    }
+
+    for (uint32_t frame_id : frame_ids) {
+        operation_refs_[frame_id]--;
+        releasePage(frame_id, true, true);  // LSN stamp changed the page
+    }
+}
+
+void BufferPool::writeBatch(FlushBatch& batch) {
+    if (batch.pages.empty()) {
+        return;
+    }
+    // WAL-before-data for the whole batch
+    if (log_manager_) {
+        uint64_t max_lsn = 0;
+        for (const Page* page : batch.pages) {
+            if (page->lsn() > max_lsn) {
+                max_lsn = page->lsn();
+            }
+        }
+        log_manager_->flush(max_lsn);
+    }
+    if (page_manager_) {
+        // in page id order, runs of neighbouring pages go out as one pwritev, the rest as one async batch
+        size_t count = batch.pages.size();
+        vector<size_t> order(count);
+        for (size_t i = 0; i < count; i++) {
+            order[i] = i;
+        }
+        sort(order.begin(), order.end(), [&](size_t a, size_t b) { return batch.page_ids[a] < batch.page_ids[b]; });
+
+        vector<const Page*> run;
+        vector<uint32_t> single_ids;
+        vector<const Page*> single_pages;
+        size_t first = 0;
+        while (first < count) {
+            size_t last = first + 1;
+            while (last < count && batch.page_ids[order[last]] == batch.page_ids[order[last - 1]] + 1) {
+                last++;
+            }
+            if (last - first > 1) {
+                run.clear();
+                for (size_t i = first; i < last; i++) {
+                    run.push_back(batch.pages[order[i]]);
+                }
+                page_manager_->writePages(batch.page_ids[order[first]], run.data(), run.size());
+            } else {
+                single_ids.push_back(batch.page_ids[order[first]]);
+                single_pages.push_back(batch.pages[order[first]]);
+            }
+            first = last;
+        }
+        if (!single_ids.empty()) {
+            page_manager_->writePageBatch(single_ids.data(), single_pages.data(), single_pages.size());
+        }
+    }
+
+    // a frame is clean only if nobody wrote to it since the copy
+    // (flushing_ kept it from being evicted, so it still holds the same page)
+    for (size_t i = 0; i < batch.frame_ids.size(); i++) {
+        uint32_t frame_id = batch.frame_ids[i];
+        Partition& partition = partitionFor(batch.page_ids[i]);
+        {
+            lock_guard<mutex> lock(partition.latch);
+            pin_counts_[frame_id]++;
+        }
+        {
+            shared_lock<shared_mutex> frame_latch(frame_latches_[frame_id]);
+            if (write_counts_[frame_id] != batch.write_counts[i]) {
+                // still dirty, but everything up to the copy's LSN is on disk now
+                recovery_lsns_[frame_id] = batch.pages[i]->lsn() + 1;
+            } else if (dirty_[frame_id].exchange(0)) {
+                dirty_count_--;
+            }
+        }
+        {
+            lock_guard<mutex> lock(partition.latch);
+            flushing_[frame_id] = 0;
+            pin_counts_[frame_id]--;
+        }
+    }
+    batch.clear();
+}
+
+BufferPool::Partition& BufferPool::partitionFor(uint32_t page_id) {
+    // different multiplier than the page table so partition and slot bits don't correlate
+    return partitions_[((page_id * 0x85EBCA6Bu) >> 16) % num_partitions_];
+}
+
+uint32_t BufferPool::fetchFrame(uint32_t page_id, bool exclusive, bool read_from_disk) {
+    Partition& partition = partitionFor(page_id);
+    unique_lock<mutex> lock(partition.latch);
+
+    // check if page is in cache (cache hit)
+    uint32_t frame_id = lookup(partition, page_id);
+    for (int attempt = 0; frame_id == INVALID_FRAME_ID; attempt++) {
+        if (!page_manager_) {
+            return INVALID_FRAME_ID;
+        }
+
+        // cache miss, reuse a frame (never grows past max_pages_)
+        uint32_t victim = findVictim(partition, lock);
+        if (victim == INVALID_FRAME_ID) {
+            // every frame is pinned or being flushed, usually that passes quickly
+            // never give up: a caller that can't get the page would miss a key that is there or drop a write
+            lock.unlock();
+            if (attempt < VICTIM_RETRIES) {
+                this_thread::yield();
+            } else {
+                cleaner_wake_.notify_one();
+                this_thread::sleep_for(VICTIM_BACKOFF);
+            }
+            lock.lock();
+            frame_id = lookup(partition, page_id);
+            continue;
+        }
+
+        // another thread may have brought the page in while the latch was dropped for a writeback
+        frame_id = lookup(partition, page_id);
+        if (frame_id != INVALID_FRAME_ID) {
+            partition.free_frames.push_back(victim);
+            break;
+        }
+
+        frame_page_ids_[victim] = page_id;  // victims are always clean
+        referenced_[victim] = 1;
+        pin_counts_[victim] = 1;
+        tableInsert(partition, page_id, victim);
+
+        // frame was unpinned and unmapped, so nobody else holds its latch
+        // keep it exclusive until the read is done, anyone else asking for the page waits on it
+        frame_latches_[victim].lock();
+        lock.unlock();
+
+        // load page from disk straight into the frame, outside the partition latch
+        if (read_from_disk) {
+            page_manager_->readPage(page_id, frames_[victim]);
+        }
+        if (!exclusive) {
+            frame_latches_[victim].unlock();
+            frame_latches_[victim].lock_shared();
+        }
+        if (read_from_disk) {
+            readAhead(page_id);
+        }
+        return victim;
+    }
+
+    pin_counts_[frame_id]++;
+    referenced_[frame_id] = 1;
+    lock.unlock();
+
+    if (exclusive) {
+        frame_latches_[frame_id].lock();
+    } else {
+        frame_latches_[frame_id].lock_shared();
+    }
+    return frame_id;
+}
+
+uint32_t BufferPool::findVictim(Partition& partition, unique_lock<mutex>& partition_latch) {
+    // use a frame that was never filled first
+    if (!partition.free_frames.empty()) {
+        uint32_t frame_id = partition.free_frames.back();
+        partition.free_frames.pop_back();
+        return frame_id;
+    }
+
+    // clock sweep: skip pinned frames, give referenced frames a second chance
+    // two full turns clear every reference bit, so if nothing turns up everything is pinned
+    // dirty frames are left to the cleaner as long as a clean one turns up
+    uint32_t frame_count = partition.frame_end - partition.frame_begin;
+    uint32_t dirty_candidate = INVALID_FRAME_ID;
+    for (size_t step = 0; step < frame_count * 2; step++) {
+        uint32_t frame_id = partition.frame_begin + partition.clock_hand;
+        partition.clock_hand = (partition.clock_hand + 1) % frame_count;
+
+        if (pin_counts_[frame_id] > 0 || flushing_[frame_id] || operation_refs_[frame_id] > 0) continue;
+        if (referenced_[frame_id]) {
+            referenced_[frame_id] = 0;
+            continue;
+        }
+        if (dirty_[frame_id]) {
+            if (dirty_candidate == INVALID_FRAME_ID) {
+                dirty_candidate = frame_id;
+            }
+            continue;
+        }
+
+        // evict
+        tableErase(partition, frame_page_ids_[frame_id]);
+        frame_page_ids_[frame_id] = INVALID_PAGE_ID;
+        return frame_id;
+    }
+    if (dirty_candidate == INVALID_FRAME_ID) {
+        return INVALID_FRAME_ID;
+    }
+
+    // nothing clean, the cleaner is behind: write the victim back ourselves, without holding the partition latch
+    // the pin keeps the page mapped, so a concurrent fetch still finds the cached copy
+    // flushing_ keeps the cleaner off the frame meanwhile: an older copy of it in one of its batches could land
+    // after ours and nobody would write the page again
+    cleaner_wake_.notify_one();
+    uint32_t frame_id = dirty_candidate;
+    pin_counts_[frame_id]++;
+    flushing_[frame_id] = 1;
+    partition_latch.unlock();
+    flushFrame(frame_id);
+    partition_latch.lock();
+    flushing_[frame_id] = 0;
+    pin_counts_[frame_id]--;
+
+    // somebody used it meanwhile, the caller tries again
+    if (pin_counts_[frame_id] > 0 || flushing_[frame_id] || operation_refs_[frame_id] > 0 || dirty_[frame_id] || referenced_[frame_id]) {
+        return INVALID_FRAME_ID;
+    }
+    tableErase(partition, frame_page_ids_[frame_id]);
+    frame_page_ids_[frame_id] = INVALID_PAGE_ID;
+    return frame_id;
+}
+
+void BufferPool::releasePage(uint32_t frame_id, bool exclusive, bool is_dirty) {
+    // dirty bit goes up before the unpin so an evictor that sees pin 0 also sees the dirty bit
+    if (is_dirty) {
+        if (!dirty_[frame_id].exchange(1) && ++dirty_count_ > dirty_watermark_) {
+            cleaner_wake_.notify_one();
+        }
+        write_counts_[frame_id]++;
+    }
+    if (exclusive) {
+        frame_latches_[frame_id].unlock();
+    } else {
+        frame_latches_[frame_id].unlock_shared();
+    }
+    pin_counts_[frame_id]--;
+}
+
+void BufferPool::releaseWritten(uint32_t frame_id, uint32_t page_id) {
+    if (log_manager_) {
+        uint64_t lsn;
+        if (current_operation.pool == this) {
+            // part of an open operation, logged when it ends; until then the frame stays put
+            vector<uint32_t>& page_ids = current_operation.page_ids;
+            if (find(page_ids.begin(), page_ids.end(), page_id) == page_ids.end()) {
+                page_ids.push_back(page_id);
+                operation_refs_[frame_id]++;
+            }
+            lsn = log_manager_->lastLsn() + 1;  // the operation's record comes after anything logged so far
+        } else {
+            Page* page = &frames_[frame_id];
+            lsn = log_manager_->logPages(&page_id, &page, 1);
+            if (logNeedsCheckpoint()) {
+                cleaner_wake_.notify_one();
+            }
+        }
+        // first change since the page was last written, the log is needed from here on
+        // (we hold the frame exclusively, nobody can clean it meanwhile)
+        if (!dirty_[frame_id]) {
+            recovery_lsns_[frame_id] = lsn;
+        }
+    }
+    releasePage(frame_id, true, true);
+
+    // an operation holding this many frames would starve the pool, log what it has so far
+    // (it stops being all-or-nothing, but nothing is lost)
+    if (current_operation.pool == this && current_operation.page_ids.size() >= operation_limit_) {
+        vector<uint32_t> page_ids;
+        page_ids.swap(current_operation.page_ids);
+        logOperation(page_ids);
+    }
+}
+
+void BufferPool::flushFrame(uint32_t frame_id) {
+    // writers hold the frame exclusively, so the page can't change while we write it
+    shared_lock<shared_mutex> frame_latch(frame_latches_[frame_id]);
+
+    // check if frame holds a dirty page
+    if (!dirty_[frame_id] || frame_page_ids_[frame_id] == INVALID_PAGE_ID) return;
+
+    // write page to disk, the log records for it have to get there first
+    if (!page_manager_) return;
+    uint32_t write_count = write_counts_[frame_id];
+    if (log_manager_) {
+        log_manager_->flush(frames_[frame_id].lsn());
+    }
+    page_manager_->writePage(frame_page_ids_[frame_id], frames_[frame_id]);
+
+    // mark page as clean, unless somebody wrote to it since (same rule as writeBatch)
+    if (write_counts_[frame_id] == write_count && dirty_[frame_id].exchange(0)) {
+        dirty_count_--;
+    }
+}
+
+uint32_t BufferPool::slotFor(const Partition& partition, uint32_t page_id) const {
+    // fibonacci hashing, spreads sequential page ids across the table
+    return (page_id * 2654435769u) & partition.table_mask;
+}
+
+uint32_t BufferPool::lookup(const Partition& partition, uint32_t page_id) const {
+    uint32_t slot = slotFor(partition, page_id);
+    while (partition.page_table[slot].page_id != INVALID_PAGE_ID) {
+        if (partition.page_table[slot].page_id == page_id) {
+            return partition.page_table[slot].frame_id;
+        }
+        slot = (slot + 1) & partition.table_mask;
+    }
+    return INVALID_FRAME_ID;
+}
+
+void BufferPool::tableInsert(Partition& partition, uint32_t page_id, uint32_t frame_id) {
+    uint32_t slot = slotFor(partition, page_id);
+    while (partition.page_table[slot].page_id != INVALID_PAGE_ID && partition.page_table[slot].page_id != page_id) {
+        slot = (slot + 1) & partition.table_mask;
+    }
+    partition.page_table[slot] = PageTableEntry{page_id, frame_id};
+}
+
+void BufferPool::tableErase(Partition& partition, uint32_t page_id) {
+    uint32_t slot = slotFor(partition, page_id);
+    while (partition.page_table[slot].page_id != page_id) {
+        if (partition.page_table[slot].page_id == INVALID_PAGE_ID) return;  // not in table
+        slot = (slot + 1) & partition.table_mask;
+    }
+
+    // backward-shift deletion: pull later entries of the probe chain into the hole
+    // so lookups never need tombstones
+    uint32_t hole = slot;
+    uint32_t next = (hole + 1) & partition.table_mask;
+    while (partition.page_table[next].page_id != INVALID_PAGE_ID) {
+        uint32_t home = slotFor(partition, partition.page_table[next].page_id);
+        // entry can move into the hole only if its home slot is not in (hole, next]
+        if (((next - home) & partition.table_mask) >= ((next - hole) & partition.table_mask)) {
+            partition.page_table[hole] = partition.page_table[next];
+            hole = next;
+        }
+        next = (next + 1) & partition.table_mask;
+    }
+    partition.page_table[hole] = PageTableEntry{INVALID_PAGE_ID, INVALID_FRAME_ID};
+}
+
+ReadPageGuard::ReadPageGuard(BufferPool* buffer_pool, uint32_t page_id, uint32_t frame_id, Page* page)
+    : buffer_pool_(buffer_pool), page_(page), page_id_(page_id), frame_id_(frame_id) {}
+
+ReadPageGuard::~ReadPageGuard() {
+    release();
+}
+
+ReadPageGuard::ReadPageGuard(ReadPageGuard&& other) noexcept
+    : buffer_pool_(other.buffer_pool_), page_(other.page_), page_id_(other.page_id_), frame_id_(other.frame_id_) {
+    other.buffer_pool_ = nullptr;
+    other.page_ = nullptr;
+}
+
+ReadPageGuard& ReadPageGuard::operator=(ReadPageGuard&& other) noexcept {
+    if (this != &other) {
+        release();
+        buffer_pool_ = other.buffer_pool_;
+        page_ = other.page_;
+        page_id_ = other.page_id_;
+        frame_id_ = other.frame_id_;
+        other.buffer_pool_ = nullptr;
+        other.page_ = nullptr;
+    }
+    return *this;
+}
+
+void ReadPageGuard::release() {
+    if (buffer_pool_ && page_) {
+        buffer_pool_->releasePage(frame_id_, false, false);
+    }
+    buffer_pool_ = nullptr;
+    page_ = nullptr;
+}
+
+WritePageGuard::WritePageGuard(BufferPool* buffer_pool, uint32_t page_id, uint32_t frame_id, Page* page)
+    : buffer_pool_(buffer_pool), page_(page), page_id_(page_id), frame_id_(frame_id) {}
+
+WritePageGuard::~WritePageGuard() {
+    release();
+}
+
+WritePageGuard::WritePageGuard(WritePageGuard&& other) noexcept
+    : buffer_pool_(other.buffer_pool_), page_(other.page_), page_id_(other.page_id_), frame_id_(other.frame_id_) {
+    other.buffer_pool_ = nullptr;
+    other.page_ = nullptr;
+}
+
+WritePageGuard& WritePageGuard::operator=(WritePageGuard&& other) noexcept {
+    if (this != &other) {
+        release();
+        buffer_pool_ = other.buffer_pool_;
+        page_ = other.page_;
+        page_id_ = other.page_id_;
+        frame_id_ = other.frame_id_;
+        other.buffer_pool_ = nullptr;
+        other.page_ = nullptr;
+    }
+    return *this;
+}
+
+void WritePageGuard::release() {
+    // log (if the pool has a log), mark dirty and unpin
+    if (buffer_pool_ && page_) {
+        buffer_pool_->releaseWritten(frame_id_, page_id_);
+    }
+    buffer_pool_ = nullptr;
+    page_ = nullptr;
+}
@@ -0,0 +1,304 @@
+#include "bulk_loader.h"
+#include "buffer_pool.h"
+#include "page_manager.h"
+#include <algorithm>
+
+BulkLoader::BulkLoader(BPlusTree* tree, double fill_factor) : tree_(tree), page_manager_(tree->page_manager_),
+    leaf_page_id_(0), prev_leaf_page_id_(0), count_(0), finished_(false), extent_next_(0), extent_end_(0) {
+    if (fill_factor < 0.1) fill_factor = 0.1;
+    if (fill_factor > 1.0) fill_factor = 1.0;
+    byte_limit_ = static_cast<uint32_t>(fill_factor * PAGE_SIZE);
+
+    levels_.resize(1);
+    levels_[0].node = Node(true);
+    pending_ids_.reserve(WRITE_BATCH);
+    pending_pages_.reserve(WRITE_BATCH);
+}
+
+bool BulkLoader::add(const string& key, uint64_t value) {
+    if (finished_ || key.size() > MAX_KEY_SIZE || (count_ > 0 && key <= last_key_)) {
+        return false;
+    }
+
+    // leaf is full: write it and start the next one, the separator between them goes up with the new leaf
+    if (!levels_[0].node.keys.empty() && !fits(levels_[0], key)) {
+        string separator = BPlusTree::separator(last_key_, key);
+        uint32_t next_page_id = allocatePage();
+        writeLeaf(next_page_id);
+        prev_leaf_page_id_ = leaf_page_id_;
+        leaf_page_id_ = next_page_id;
+        levels_[0].node = Node(true);
+        levels_[0].key_bytes = 0;
+        levels_[0].low_separator = separator;
+    }
+    if (leaf_page_id_ == 0) {
+        leaf_page_id_ = allocatePage();
+    }
+
+    levels_[0].node.keys.push_back(key);
+    levels_[0].node.values.push_back(value);
+    levels_[0].key_bytes += key.size();
+    last_key_ = key;
+    count_++;
+    return true;
+}
+
+bool BulkLoader::finish() {
+    if (finished_) {
+        return false;
+    }
+    finished_ = true;
+
+    uint32_t root_page_id = 0;
+    if (count_ > 0) {
+        levels_[0].node.next_page_id = 0;
+        levels_[0].node.prev_page_id = prev_leaf_page_id_;
+
+        // close every level bottom-up: even out its last two nodes, write them and hand the last one up
+        // the first level left with a single child has the root as that child
+        for (size_t level = 0; level < levels_.size(); level++) {
+            if (level > 0 && level == levels_.size() - 1 && levels_[level].held_page_id == 0 && levels_[level].node.keys.empty()) {
+                root_page_id = levels_[level].node.children_page_ids[0];
+                break;
+            }
+            bool keep_last = balanceLast(level);
+            if (levels_[level].held_page_id != 0) {
+                queueNode(levels_[level].held_page_id, levels_[level].held);
+            }
+            if (!keep_last) {
+                // merged into the node before it, which is already linked in; the last leaf's page was never used
+                if (level == 0 && page_manager_) {
+                    page_manager_->freePage(leaf_page_id_);
+                }
+                continue;
+            }
+            uint32_t page_id = level == 0 ? leaf_page_id_ : allocatePage();
+            queueNode(page_id, levels_[level].node);
+            addChild(level + 1, levels_[level].low_separator, page_id);
+        }
+    }
+
+    // new pages durable before page 0 points at them, a crash in between keeps the old tree
+    writePending();
+    if (page_manager_) {
+        page_manager_->sync();
+        // the rest of the last extent was never written or linked, give it back
+        for (; extent_next_ < extent_end_; extent_next_++) {
+            page_manager_->freePage(extent_next_);
+        }
+    }
+
+    BPlusTree::Exclusive exclusive(tree_);
+    vector<uint32_t> old_page_ids;
+    if (tree_->buffer_pool_ && tree_->root_page_id_ != 0) {
+        tree_->collectPages(tree_->root_page_id_, old_page_ids);
+    }
+    tree_->root_page_id_ = root_page_id;
+    tree_->leaf_filters_.clear();  // the old tree's leaves, the new ones get filters as they're read
+    AtomicOperation operation(tree_->buffer_pool_);
+    tree_->saveRootPageId();
+    // the old tree is unreachable now; inside the operation the frees wait until the new root is logged,
+    // so a crash before that still finds the old tree whole
+    for (uint32_t page_id : old_page_ids) {
+        tree_->buffer_pool_->freePage(page_id);
+    }
+    return true;
+}
+
+bool BulkLoader::fits(const Level& level, const string& key) const {
+    const Node& node = level.node;
+    size_t num_keys = node.keys.size();
+    if (num_keys == 0) {
+        return true;  // every node takes at least one key
+    }
+    if (tree_->order_ > 0 && num_keys + 1 >= static_cast<size_t>(tree_->order_)) {
+        return false;  // the tree would split a node with order keys on its next insert
+    }
+
+    // keys arrive sorted, so the node prefix is whatever the first key and the new one share
+    uint32_t prefix_len = 0;
+    const string& first = node.keys.front();
+    while (prefix_len < first.size() && prefix_len < key.size() && first[prefix_len] == key[prefix_len]) {
+        prefix_len++;
+    }
+
+    // same arithmetic as Node::byteSize, without walking the node
+    uint32_t value_size = node.is_leaf ? 8 : 4;
+    uint32_t entries = num_keys + 1;
+    uint32_t size = NODE_SLOTS + prefix_len + entries * (SLOT_SIZE + 2 + value_size) + level.key_bytes + key.size() - entries * prefix_len;
+    return size <= byte_limit_;
+}
+
+void BulkLoader::addChild(size_t level, string separator, uint32_t child_page_id) {
+    if (level == levels_.size()) {
+        levels_.emplace_back();
+        levels_[level].node = Node(false);
+    }
+
+    // first child of a fresh node, its separator belongs to the level above
+    if (levels_[level].node.children_page_ids.empty()) {
+        levels_[level].node.children_page_ids.push_back(child_page_id);
+        levels_[level].low_separator = separator;
+        return;
+    }
+
+    if (fits(levels_[level], separator)) {
+        levels_[level].node.keys.push_back(separator);
+        levels_[level].node.children_page_ids.push_back(child_page_id);
+        levels_[level].key_bytes += separator.size();
+        return;
+    }
+
+    // full: this node is done, the child starts the next one at this level
+    uint32_t page_id = allocatePage();
+    holdNode(level, page_id);
+    string up = levels_[level].low_separator;
+    levels_[level].node = Node(false);
+    levels_[level].node.children_page_ids.push_back(child_page_id);
+    levels_[level].key_bytes = 0;
+    levels_[level].low_separator = separator;
+    addChild(level + 1, up, page_id);
+}
+
+void BulkLoader::writeLeaf(uint32_t next_page_id) {
+    Node& leaf = levels_[0].node;
+    leaf.next_page_id = next_page_id;
+    leaf.prev_page_id = prev_leaf_page_id_;
+    holdNode(0, leaf_page_id_);
+    addChild(1, levels_[0].low_separator, leaf_page_id_);
+}
+
+void BulkLoader::holdNode(size_t level, uint32_t page_id) {
+    Level& current = levels_[level];
+    if (current.held_page_id != 0) {
+        queueNode(current.held_page_id, current.held);
+    }
+    current.held = move(current.node);
+    current.held_page_id = page_id;
+}
+
+bool BulkLoader::balanceLast(size_t level) {
+    Level& current = levels_[level];
+    Node& left = current.held;
+    Node& right = current.node;
+    if (current.held_page_id == 0 || !tree_->isUnderfull(right)) {
+        return true;
+    }
+
+    // both as one node, like joinChildren: an internal pair takes the separator between them back down
+    Node combined(left.is_leaf);
+    combined.keys = left.keys;
+    if (left.is_leaf) {
+        combined.keys.insert(combined.keys.end(), right.keys.begin(), right.keys.end());
+        combined.values = left.values;
+        combined.values.insert(combined.values.end(), right.values.begin(), right.values.end());
+    } else {
+        combined.keys.push_back(current.low_separator);
+        combined.keys.insert(combined.keys.end(), right.keys.begin(), right.keys.end());
+        combined.children_page_ids = left.children_page_ids;
+        combined.children_page_ids.insert(combined.children_page_ids.end(), right.children_page_ids.begin(), right.children_page_ids.end());
+    }
+
+    // cut the pair again in the middle (by bytes), the new separator goes up with the last node; links stay
+    // keys of very different lengths can leave a half underfull, then the cut nearest the middle that doesn't
+    int num_keys = static_cast<int>(combined.keys.size());
+    int highest = combined.is_leaf ? num_keys - 1 : num_keys - 2;
+    int middle_index = highest >= 1 ? tree_->splitIndex(combined) : 0;
+    Node new_left(left.is_leaf);
+    Node new_right(left.is_leaf);
+    string middle;
+    bool balanced = false;
+    for (int distance = 0; highest >= 1 && !balanced && distance <= highest; distance++) {
+        for (int side = -1; side <= 1 && !balanced; side += 2) {
+            int split_index = middle_index + side * distance;
+            if (split_index < 1 || split_index > highest || (distance == 0 && side > 0)) continue;
+            new_left = Node(left.is_leaf);
+            new_right = Node(left.is_leaf);
+            tree_->splitNodeAt(combined, split_index, new_left, new_right, middle);
+            balanced = !tree_->isFull(new_left) && !tree_->isFull(new_right) &&
+                       !tree_->isUnderfull(new_left) && !tree_->isUnderfull(new_right);
+        }
+    }
+
+    // no such cut: one node if the pair fits in a page (past the fill factor), else the split in the middle
+    if (!balanced && !tree_->isFull(combined)) {
+        combined.prev_page_id = left.prev_page_id;
+        combined.next_page_id = right.next_page_id;
+        left = move(combined);
+        return false;
+    }
+    if (!balanced && highest >= 1) {
+        new_left = Node(left.is_leaf);
+        new_right = Node(left.is_leaf);
+        tree_->splitNodeAt(combined, middle_index, new_left, new_right, middle);
+        balanced = true;
+    }
+    if (balanced) {
+        new_left.prev_page_id = left.prev_page_id;
+        new_left.next_page_id = left.next_page_id;
+        new_right.prev_page_id = right.prev_page_id;
+        new_right.next_page_id = right.next_page_id;
+        left = move(new_left);
+        right = move(new_right);
+        current.low_separator = middle;
+    }
+    return true;
+}
+
+void BulkLoader::queueNode(uint32_t page_id, const Node& node) {
+    pending_ids_.push_back(page_id);
+    pending_pages_.emplace_back(true);
+    node.serializeToPage(pending_pages_.back());
+    if (pending_ids_.size() >= WRITE_BATCH) {
+        writePending();
+    }
+}
+
+void BulkLoader::writePending() {
+    if (!page_manager_ || pending_ids_.empty()) {
+        pending_ids_.clear();
+        pending_pages_.clear();
+        return;
+    }
+
+    // pages were allocated in increasing order and come out nearly in it, sort and write runs of neighbours
+    vector<size_t> order(pending_ids_.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) { return pending_ids_[a] < pending_ids_[b]; });
+
+    vector<const Page*> run;
+    size_t first = 0;
+    while (first < order.size()) {
+        run.clear();
+        run.push_back(&pending_pages_[order[first]]);
+        size_t last = first;
+        while (last + 1 < order.size() && pending_ids_[order[last + 1]] == pending_ids_[order[last]] + 1) {
+            last++;
+            run.push_back(&pending_pages_[order[last]]);
+        }
+        page_manager_->writePages(pending_ids_[order[first]], run.data(), run.size());
+        first = last + 1;
+    }
+
+    pending_ids_.clear();
+    pending_pages_.clear();
+}
+
+uint32_t BulkLoader::allocatePage() {
+    if (!page_manager_) {
+        return 0;
+    }
+    // reserve a write batch worth of pages at a time so the batch lands as one run even with other
+    // allocators around; never freed pages, the buffer pool may still cache them
+    if (extent_next_ == extent_end_) {
+        extent_next_ = page_manager_->allocateExtent(WRITE_BATCH, false);
+        extent_end_ = extent_next_ + WRITE_BATCH;
+        // page 0 is the tree's metadata page
+        if (extent_next_ == 0) {
+            extent_next_++;
+        }
+    }
+    return extent_next_++;
+}
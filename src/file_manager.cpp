@@ -1,153 +1,415 @@
-#include "file_manager.h" 
-
-// constructor, :: prefix means it's member of the FileManager class
-FileManager::FileManager(const string& filename) : filename_(filename) {
-
-    // open file for reading and writing at specific offsets
-    // ios::binary = binary mode
-    // ios::in = input (read)
-    // ios::out = output (write)
-    // first try to open existing file, if fails create new one
-    file_.open(filename_, ios::binary | ios::in | ios::out);
-    if (!file_.is_open()) {
-        // file doesn't exist, create it
-        file_.open(filename_, ios::binary | ios::out);
-        file_.close();
-        file_.open(filename_, ios::binary | ios::in | ios::out);
-    }
-
-}
-
-// destructor
-FileManager::~FileManager() {
-    if (file_.is_open()) {
-        file_.close();
-    }
-}
-
-string FileManager::read(size_t position, size_t size) {
-    // move to the specified position
-    file_.seekg(position, ios::beg); // ios::beg means beginning of the file
-    
-    // check if seek was successful
-    if (!file_.good()) {
-        return string(size, '\0'); // return empty string if file operation failed
-    }
-
-    // create buffer to hold data
-    string result(size, '\0'); // create string with size and fill with null characters
-
-    // read data into the buffer
-    file_.read(&result[0], size); // read 'size' bytes into the string
-    
-    // if read failed (e.g., end of file), return what we got (will be zeros)
-    // gcount() returns number of characters read
-    streamsize bytes_read = file_.gcount();
-    if (bytes_read < static_cast<streamsize>(size)) {
-        // partial read - fill rest with zeros (already done by string constructor)
-        // the string was initialized with zeros, so we're good
-    }
-
-    return result;
-}
-
-
-uint64_t FileManager::write(const string& data) {
-    // move to the end of the file (to append)
-    file_.seekp(0, ios::end); // seekp is seek put pointer, move the put pointer where next write will happen
-
-    // get current position (wheere we're about to write)
-    uint64_t position = file_.tellp();
-
-    // write the data to the file
-    file_.write(data.c_str(), data.size()); // c_str gives pointer to char array, data.size() ensures write entire string
-
-    // flush to ensure it's written to disk
-    file_.flush(); 
-
-    // return the position where data was written
-    return position;
-}
-
-uint64_t FileManager::size() {
-    // check if file is open
-    if (!file_.is_open()) {
-        return 0;  // file not open, return 0 size
-    }
-    
-    file_.seekg(0, ios::end);
-    if (!file_.good()) {
-        return 0;  // seek failed, return 0 size
-    }
-    
-    uint64_t size = file_.tellg();
-    if (size == static_cast<uint64_t>(-1)) {  // tellg returns -1 on error
-        return 0;
-    }
-    return size;
-}
-
-void FileManager::readPage(uint32_t page_id, Page& page) {
-    // check if file is open
-    if (!file_.is_open()) {
-        page.clear();
-        return;
-    }
-    
-    uint64_t page_offset = page_id * PAGE_SIZE;
-    uint64_t file_size = size();
-    // if offset beyond file size, page is empty, clear and return
-    if (page_offset >= file_size) {
-        page.clear();
-        return;
-    }
-
-    uint64_t bytes_to_read;
-    if (page_offset + PAGE_SIZE > file_size) {
-        bytes_to_read = file_size - page_offset;
-    } else {
-        bytes_to_read = PAGE_SIZE;
-    }
-
-    string page_data = read(page_offset, bytes_to_read);
-    page.clear();
-    page.writeBytes(0, page_data.c_str(), bytes_to_read);
-
-}
-
-void FileManager::writePage(uint32_t page_id, const Page& page) {
-    // check if file is open
-    if (!file_.is_open()) {
-        return;  // can't write if file not open
-    }
-    
-    uint64_t page_offset = page_id * PAGE_SIZE;
-    uint64_t required_size = page_offset + PAGE_SIZE;
-    uint64_t current_size = size();
-    
-    // extend file if necessary (fill with zeros)
-    if (required_size > current_size) {
-        file_.seekp(0, ios::end);
-        if (!file_.good()) {
-            return;  // seek failed
-        }
-        uint64_t bytes_to_add = required_size - current_size;
-        string zeros(bytes_to_add, '\0');
-        file_.write(zeros.c_str(), bytes_to_add);
-        if (!file_.good()) {
-            return;  // write failed
-        }
-        file_.flush();
-    }
-    
-    // now write the page at the correct offset
-    file_.seekp(page_offset, ios::beg);
-    if (!file_.good()) {
-        return;  // seek failed
-    }
-    file_.write(page.data, PAGE_SIZE);
-    if (!file_.good()) {
-        return;  // write failed
-    }
-    file_.flush();
-}
\ No newline at end of file
+#include "file_manager.h" 
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <vector>
+
+// direct I/O needs page-aligned buffers, every Page is one
+static_assert(alignof(Page) == PAGE_SIZE, "Page must be PAGE_SIZE aligned for O_DIRECT");
+
+// reserve disk space at least this much at a time
+constexpr uint64_t RESERVE_CHUNK = 64 * PAGE_SIZE;
+
+// constructor, :: prefix means it's member of the FileManager class
+FileManager::FileManager(const string& filename, bool read_only, bool direct_io)
+    : filename_(filename), fd_(-1), read_only_(read_only), direct_io_(false), size_(0), allocated_size_(0) {
+
+    // open file for reading and writing at specific offsets, create it if it doesn't exist
+    int flags = read_only_ ? O_RDONLY : (O_RDWR | O_CREAT);
+#ifdef O_DIRECT
+    if (direct_io) {
+        fd_ = ::open(filename_.c_str(), flags | O_DIRECT, 0644);
+        direct_io_ = fd_ >= 0;
+    }
+#endif
+    // some filesystems (tmpfs, ...) reject O_DIRECT, use the page cache there
+    if (fd_ < 0) {
+        fd_ = ::open(filename_.c_str(), flags, 0644);
+    }
+    if (fd_ < 0) {
+        return;
+    }
+
+    // cache the file size once, every write keeps it up to date afterwards
+    struct stat st;
+    if (fstat(fd_, &st) == 0) {
+        size_ = st.st_size;
+        allocated_size_ = st.st_size;
+    }
+
+    io_engine_.reset(new IoEngine(fd_, IO_QUEUE_DEPTH));
+}
+
+// destructor
+FileManager::~FileManager() {
+    // engine has to drain before the descriptor goes away
+    io_engine_.reset();
+    if (fd_ >= 0) {
+        // direct writes go out in whole blocks, cut the padding after the last byte off again
+        if (direct_io_ && !read_only_) {
+            struct stat st;
+            if (fstat(fd_, &st) == 0 && static_cast<uint64_t>(st.st_size) > size_) {
+                ftruncate(fd_, size_);
+            }
+        }
+        ::close(fd_);
+    }
+}
+
+string FileManager::read(size_t position, size_t size) {
+    // create string with size and fill with null characters
+    string result(size, '\0');
+    readAt(position, &result[0], size);
+    return result;
+}
+
+void FileManager::readAt(uint64_t position, char* out, size_t size) {
+    if (fd_ < 0) {
+        memset(out, 0, size);
+        return;
+    }
+    if (direct_io_) {
+        readBounced(position, out, size);
+        return;
+    }
+
+    // read data into the buffer, a short read (end of file) leaves the rest as zeros
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd_, out + done, size - done, position + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    memset(out + done, 0, size - done);
+}
+
+
+uint64_t FileManager::write(const string& data) {
+    if (fd_ < 0 || read_only_) {
+        return 0;
+    }
+
+    // claim the range at the end of the file (to append), concurrent appends get disjoint ranges
+    uint64_t position = size_.fetch_add(data.size());
+    writeAt(position, data.c_str(), data.size());
+
+    // return the position where data was written
+    return position;
+}
+
+void FileManager::writeAt(uint64_t position, const char* data, size_t size) {
+    if (fd_ < 0 || read_only_ || size == 0) {
+        return;
+    }
+    reserve(position + size);
+
+    if (direct_io_) {
+        writeBounced(position, data, size);
+    } else {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = pwrite(fd_, data + done, size - done, position + done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return;  // write failed
+            done += n;
+        }
+    }
+    growSize(position + size);
+}
+
+uint64_t FileManager::size() {
+    // check if file is open
+    if (fd_ < 0) {
+        return 0;  // file not open, return 0 size
+    }
+    return size_;
+}
+
+void FileManager::readPage(uint32_t page_id, Page& page) {
+    // check if file is open
+    if (fd_ < 0) {
+        page.clear();
+        return;
+    }
+
+    uint64_t page_offset = static_cast<uint64_t>(page_id) * PAGE_SIZE;
+    // if offset beyond file size, page is empty, clear and return
+    if (page_offset >= size_) {
+        page.clear();
+        return;
+    }
+
+    // one pread straight into the page, zero whatever lies past end of file
+    uint32_t done = 0;
+    while (done < PAGE_SIZE) {
+        ssize_t n = pread(fd_, page.data + done, PAGE_SIZE - done, page_offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    if (done < PAGE_SIZE) {
+        memset(page.data + done, 0, PAGE_SIZE - done);
+    }
+}
+
+void FileManager::writePage(uint32_t page_id, const Page& page) {
+    // check if file is open
+    if (fd_ < 0 || read_only_) {
+        return;  // can't write if file not open
+    }
+
+    uint64_t page_offset = static_cast<uint64_t>(page_id) * PAGE_SIZE;
+    reserve(page_offset + PAGE_SIZE);
+
+    // write the page at the correct offset, any gap before it reads back as zeros
+    uint32_t done = 0;
+    while (done < PAGE_SIZE) {
+        ssize_t n = pwrite(fd_, page.data + done, PAGE_SIZE - done, page_offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;  // write failed
+        done += n;
+    }
+    growSize(page_offset + PAGE_SIZE);
+}
+
+void FileManager::writePages(uint32_t first_page_id, const Page* const* pages, size_t count) {
+    if (fd_ < 0 || read_only_ || count == 0) {
+        return;
+    }
+
+    uint64_t offset = static_cast<uint64_t>(first_page_id) * PAGE_SIZE;
+    uint64_t end = offset + count * PAGE_SIZE;
+    reserve(end);
+
+    // gather the pages into as few pwritev calls as IOV_MAX allows
+    vector<struct iovec> iov(count);
+    for (size_t i = 0; i < count; i++) {
+        iov[i].iov_base = const_cast<char*>(pages[i]->data);
+        iov[i].iov_len = PAGE_SIZE;
+    }
+
+    size_t first = 0;
+    while (first < count) {
+        int batch = static_cast<int>(count - first < IOV_MAX ? count - first : IOV_MAX);
+        ssize_t n = pwritev(fd_, &iov[first], batch, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;  // write failed
+
+        // advance past fully written pages, finish a partially written one with pwrite
+        size_t full_pages = n / PAGE_SIZE;
+        size_t partial = n % PAGE_SIZE;
+        first += full_pages;
+        offset += full_pages * PAGE_SIZE;
+        if (partial > 0) {
+            const char* rest = pages[first]->data + partial;
+            size_t left = PAGE_SIZE - partial;
+            uint64_t rest_offset = offset + partial;
+            while (left > 0) {
+                ssize_t m = pwrite(fd_, rest, left, rest_offset);
+                if (m < 0 && errno == EINTR) continue;
+                if (m <= 0) return;
+                rest += m;
+                left -= m;
+                rest_offset += m;
+            }
+            first++;
+            offset += PAGE_SIZE;
+        }
+    }
+    growSize(end);
+}
+
+void FileManager::readPageBatch(const uint32_t* page_ids, Page* const* pages, size_t count, uint8_t* failed) {
+    if (failed) {
+        memset(failed, 0, count);
+    }
+    if (fd_ < 0) {
+        for (size_t i = 0; i < count; i++) {
+            pages[i]->clear();
+        }
+        return;
+    }
+
+    // pages past end of file are just zeros, only the rest goes to disk
+    vector<IoRequest> requests;
+    vector<size_t> indexes;  // which page each request is for
+    requests.reserve(count);
+    indexes.reserve(count);
+    uint64_t file_size = size_;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t page_offset = static_cast<uint64_t>(page_ids[i]) * PAGE_SIZE;
+        if (page_offset >= file_size) {
+            pages[i]->clear();
+            continue;
+        }
+        IoRequest request;
+        request.offset = page_offset;
+        request.page = pages[i];
+        request.is_write = false;
+        requests.push_back(request);
+        indexes.push_back(i);
+    }
+
+    vector<IoRequest*> batch(requests.size());
+    for (size_t i = 0; i < requests.size(); i++) {
+        batch[i] = &requests[i];
+    }
+    {
+        lock_guard<mutex> lock(io_engine_mutex_);
+        io_engine_->run(batch.data(), batch.size());
+    }
+
+    // the engine retried failures once already and cleared what it couldn't read
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (requests[i].result < 0 && failed) {
+            failed[indexes[i]] = 1;
+        }
+    }
+}
+
+void FileManager::writePageBatch(const uint32_t* page_ids, const Page* const* pages, size_t count) {
+    if (fd_ < 0 || read_only_ || count == 0) {
+        return;
+    }
+
+    vector<IoRequest> requests(count);
+    vector<IoRequest*> batch(count);
+    uint64_t end = 0;
+    for (size_t i = 0; i < count; i++) {
+        requests[i].offset = static_cast<uint64_t>(page_ids[i]) * PAGE_SIZE;
+        requests[i].page = const_cast<Page*>(pages[i]);  // only read from for writes
+        requests[i].is_write = true;
+        batch[i] = &requests[i];
+        if (requests[i].offset + PAGE_SIZE > end) {
+            end = requests[i].offset + PAGE_SIZE;
+        }
+    }
+    reserve(end);
+
+    {
+        lock_guard<mutex> lock(io_engine_mutex_);
+        io_engine_->run(batch.data(), batch.size());
+    }
+
+    // only move end of file past pages that actually made it
+    for (size_t i = 0; i < count; i++) {
+        if (requests[i].result == static_cast<int>(PAGE_SIZE)) {
+            growSize(requests[i].offset + PAGE_SIZE);
+        }
+    }
+}
+
+void FileManager::sync() {
+    if (fd_ >= 0 && !read_only_) {
+        fdatasync(fd_);
+    }
+}
+
+void FileManager::readBounced(uint64_t position, char* out, size_t size) {
+    // widen the range to whole blocks and read those into an aligned buffer
+    uint64_t start = position & ~static_cast<uint64_t>(PAGE_SIZE - 1);
+    uint64_t end = (position + size + PAGE_SIZE - 1) & ~static_cast<uint64_t>(PAGE_SIZE - 1);
+    size_t length = end - start;
+    char* bounce = static_cast<char*>(aligned_alloc(PAGE_SIZE, length));
+    if (!bounce) {
+        return;
+    }
+
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd_, bounce + done, length - done, start + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    memset(bounce + done, 0, length - done);
+    memcpy(out, bounce + (position - start), size);
+    free(bounce);
+}
+
+void FileManager::writeBounced(uint64_t position, const char* in, size_t size) {
+    uint64_t start = position & ~static_cast<uint64_t>(PAGE_SIZE - 1);
+    uint64_t end = (position + size + PAGE_SIZE - 1) & ~static_cast<uint64_t>(PAGE_SIZE - 1);
+    size_t length = end - start;
+    char* bounce = static_cast<char*>(aligned_alloc(PAGE_SIZE, length));
+    if (!bounce) {
+        return;
+    }
+
+    // two appends can share a block, so the read-modify-write of the edges has to be exclusive
+    lock_guard<mutex> lock(bounce_mutex_);
+    size_t done = 0;
+    while (done < length) {
+        ssize_t n = pread(fd_, bounce + done, length - done, start + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    memset(bounce + done, 0, length - done);
+    memcpy(bounce + (position - start), in, size);
+
+    done = 0;
+    while (done < length) {
+        ssize_t n = pwrite(fd_, bounce + done, length - done, start + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        done += n;
+    }
+    free(bounce);
+}
+
+void FileManager::truncate(uint64_t size) {
+    if (fd_ < 0 || read_only_) {
+        return;
+    }
+    if (ftruncate(fd_, size) != 0) {
+        return;
+    }
+
+    // blocks past the new end were released too, so they have to be reserved again
+    lock_guard<mutex> lock(extend_mutex_);
+    size_ = size;
+    allocated_size_ = size;
+}
+
+void FileManager::adviseWillNeed(uint64_t offset, uint64_t length) {
+    if (fd_ < 0 || direct_io_) {
+        return;
+    }
+    posix_fadvise(fd_, offset, length, POSIX_FADV_WILLNEED);
+}
+
+void FileManager::reserve(uint64_t end) {
+    lock_guard<mutex> lock(extend_mutex_);
+    if (end <= allocated_size_) {
+        return;
+    }
+
+    // grow by at least RESERVE_CHUNK or 1/8 of the file, whichever is bigger
+    uint64_t grow = allocated_size_ / 8;
+    if (grow < RESERVE_CHUNK) {
+        grow = RESERVE_CHUNK;
+    }
+    uint64_t new_size = allocated_size_ + grow;
+    if (new_size < end) {
+        new_size = end;
+    }
+
+#ifdef __linux__
+    // KEEP_SIZE reserves blocks without moving end of file, so size() stays the logical size
+    // if the filesystem can't do it, writes past the end still extend the file on their own
+    fallocate(fd_, FALLOC_FL_KEEP_SIZE, allocated_size_, new_size - allocated_size_);
+#endif
+    allocated_size_ = new_size;
+}
+
+void FileManager::growSize(uint64_t end) {
+    uint64_t current = size_;
+    while (current < end && !size_.compare_exchange_weak(current, end)) {
+    }
+}
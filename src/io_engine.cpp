@@ -0,0 +1,336 @@
+#include "io_engine.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+// thin wrappers, we talk to the kernel directly instead of pulling in liburing
+static int sysIoUringSetup(unsigned entries, struct io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int sysIoUringEnter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+IoEngine::IoEngine(int fd, unsigned queue_depth, bool use_uring)
+    : fd_(fd), queue_depth_(queue_depth == 0 ? 1 : queue_depth), in_flight_(0),
+      ring_fd_(-1), sq_ring_(nullptr), cq_ring_(nullptr), sq_ring_size_(0), cq_ring_size_(0),
+      sqes_(nullptr), sqes_size_(0), sq_head_(nullptr), sq_tail_(nullptr), sq_mask_(nullptr),
+      sq_array_(nullptr), cq_head_(nullptr), cq_tail_(nullptr), cq_mask_(nullptr), cqes_(nullptr),
+      finished_(0), stopping_(false) {
+    if (use_uring && setupUring()) {
+        return;
+    }
+
+    // no io_uring (old kernel, seccomp, ...), fall back to threads
+    startPool(queue_depth_ < 8 ? queue_depth_ : 8);
+}
+
+IoEngine::~IoEngine() {
+    // don't leave the kernel writing into pages we no longer own
+    while (in_flight_ > 0) {
+        complete(in_flight_);
+    }
+
+    if (ring_fd_ >= 0) {
+        teardownUring();
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(pool_mutex_);
+        stopping_ = true;
+    }
+    work_ready_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+size_t IoEngine::submit(IoRequest* const* requests, size_t count) {
+    // never take more than the queue has room for
+    size_t room = queue_depth_ - in_flight_;
+    if (count > room) {
+        count = room;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        IoRequest* request = requests[i];
+        request->iov.iov_base = request->page->data;
+        request->iov.iov_len = PAGE_SIZE;
+        request->result = 0;
+    }
+
+    if (ring_fd_ >= 0) {
+        return submitUring(requests, count);
+    }
+
+    {
+        lock_guard<mutex> lock(pool_mutex_);
+        for (size_t i = 0; i < count; i++) {
+            pending_.push_back(requests[i]);
+        }
+    }
+    in_flight_ += count;
+    work_ready_.notify_all();
+    return count;
+}
+
+size_t IoEngine::complete(size_t min_completions) {
+    if (min_completions > in_flight_) {
+        min_completions = in_flight_;
+    }
+
+    if (ring_fd_ >= 0) {
+        return completeUring(min_completions);
+    }
+
+    unique_lock<mutex> lock(pool_mutex_);
+    work_done_.wait(lock, [&] { return finished_ >= min_completions; });
+    size_t reaped = finished_;
+    finished_ = 0;
+    in_flight_ -= reaped;
+    return reaped;
+}
+
+void IoEngine::run(IoRequest* const* requests, size_t count) {
+    size_t submitted = 0;
+    while (submitted < count) {
+        submitted += submit(requests + submitted, count - submitted);
+
+        // queue is full, make room for the rest
+        if (submitted < count) {
+            complete(1);
+        }
+    }
+    while (in_flight_ > 0) {
+        complete(in_flight_);
+    }
+}
+
+bool IoEngine::setupUring() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = sysIoUringSetup(queue_depth_, &params);
+    if (ring_fd < 0) {
+        return false;
+    }
+
+    // map the submission ring, completion ring and SQE array
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        if (cq_ring_size_ > sq_ring_size_) {
+            sq_ring_size_ = cq_ring_size_;
+        }
+        cq_ring_size_ = sq_ring_size_;
+    }
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+        sq_ring_ = nullptr;
+        ::close(ring_fd);
+        return false;
+    }
+    if (single_mmap) {
+        cq_ring_ = sq_ring_;
+    } else {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            cq_ring_ = nullptr;
+            munmap(sq_ring_, sq_ring_size_);
+            sq_ring_ = nullptr;
+            ::close(ring_fd);
+            return false;
+        }
+    }
+
+    sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes_ == MAP_FAILED) {
+        sqes_ = nullptr;
+        if (cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        munmap(sq_ring_, sq_ring_size_);
+        sq_ring_ = cq_ring_ = nullptr;
+        ::close(ring_fd);
+        return false;
+    }
+
+    char* sq = static_cast<char*>(sq_ring_);
+    char* cq = static_cast<char*>(cq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = cq + params.cq_off.cqes;
+
+    // the kernel may round entries up, but never give us fewer than asked
+    if (params.sq_entries < queue_depth_) {
+        queue_depth_ = params.sq_entries;
+    }
+    ring_fd_ = ring_fd;
+    return true;
+}
+
+void IoEngine::teardownUring() {
+    munmap(sqes_, sqes_size_);
+    if (cq_ring_ != sq_ring_) {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    munmap(sq_ring_, sq_ring_size_);
+    ::close(ring_fd_);
+    ring_fd_ = -1;
+}
+
+size_t IoEngine::submitUring(IoRequest* const* requests, size_t count) {
+    struct io_uring_sqe* sqes = static_cast<struct io_uring_sqe*>(sqes_);
+    unsigned tail = *sq_tail_;
+    unsigned mask = *sq_mask_;
+
+    for (size_t i = 0; i < count; i++) {
+        IoRequest* request = requests[i];
+        unsigned index = tail & mask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = request->is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = fd_;
+        sqe->off = request->offset;
+        sqe->addr = reinterpret_cast<uint64_t>(&request->iov);
+        sqe->len = 1;
+        sqe->user_data = reinterpret_cast<uint64_t>(request);
+        sq_array_[index] = index;
+        tail++;
+    }
+
+    // publish the new tail after the entries are filled in
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+    // queue_depth_ never exceeds the SQ size and the CQ is twice that, so the kernel always has room
+    size_t submitted = 0;
+    while (submitted < count) {
+        int ret = sysIoUringEnter(ring_fd_, count - submitted, 0, 0);
+        if (ret < 0 && errno == EINTR) continue;
+        if (ret <= 0) break;
+        submitted += ret;
+    }
+    in_flight_ += submitted;
+
+    // the kernel refused the rest, take them back off the ring and do them here
+    if (submitted < count) {
+        __atomic_store_n(sq_tail_, tail - (count - submitted), __ATOMIC_RELEASE);
+        for (size_t i = submitted; i < count; i++) {
+            finishSync(requests[i], 0);
+        }
+    }
+    return count;
+}
+
+size_t IoEngine::completeUring(size_t min_completions) {
+    struct io_uring_cqe* cqes = static_cast<struct io_uring_cqe*>(cqes_);
+    size_t reaped = 0;
+
+    while (true) {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        unsigned mask = *cq_mask_;
+
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &cqes[head & mask];
+            IoRequest* request = reinterpret_cast<IoRequest*>(cqe->user_data);
+            request->result = cqe->res;
+            head++;
+            reaped++;
+
+            // finish short transfers (end of file on reads, rare partial writes) synchronously
+            // and retry failed ones the same way (EAGAIN and friends), a read must not leave the page half filled
+            if (request->result < 0) {
+                finishSync(request, 0);
+            } else if (request->result < static_cast<int>(PAGE_SIZE)) {
+                finishSync(request, request->result);
+            }
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+        if (reaped >= min_completions) {
+            break;
+        }
+
+        int ret = sysIoUringEnter(ring_fd_, 0, min_completions - reaped, IORING_ENTER_GETEVENTS);
+        if (ret < 0 && errno != EINTR) {
+            break;
+        }
+    }
+
+    in_flight_ -= reaped;
+    return reaped;
+}
+
+void IoEngine::startPool(unsigned threads) {
+    for (unsigned i = 0; i < threads; i++) {
+        workers_.emplace_back(&IoEngine::workerLoop, this);
+    }
+}
+
+void IoEngine::workerLoop() {
+    while (true) {
+        IoRequest* request = nullptr;
+        {
+            unique_lock<mutex> lock(pool_mutex_);
+            work_ready_.wait(lock, [&] { return stopping_ || !pending_.empty(); });
+            if (pending_.empty()) {
+                return;  // stopping and nothing left
+            }
+            request = pending_.front();
+            pending_.pop_front();
+        }
+
+        finishSync(request, 0);
+
+        {
+            lock_guard<mutex> lock(pool_mutex_);
+            finished_++;
+        }
+        work_done_.notify_all();
+    }
+}
+
+void IoEngine::finishSync(IoRequest* request, size_t already_done) {
+    size_t done = already_done;
+    while (done < PAGE_SIZE) {
+        ssize_t n;
+        if (request->is_write) {
+            n = pwrite(fd_, request->page->data + done, PAGE_SIZE - done, request->offset + done);
+        } else {
+            n = pread(fd_, request->page->data + done, PAGE_SIZE - done, request->offset + done);
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            request->result = -errno;
+            // whatever part of the read landed is no use on its own
+            if (!request->is_write) {
+                request->page->clear();
+            }
+            return;
+        }
+        if (n == 0) break;  // end of file
+        done += n;
+    }
+
+    // reads past end of file come back as zeros
+    if (!request->is_write && done < PAGE_SIZE) {
+        memset(request->page->data + done, 0, PAGE_SIZE - done);
+    }
+    request->result = static_cast<int>(done);
+}
@@ -1,161 +1,1025 @@
-#include "kv_store.h"
-#include "page_manager.h"
-#include <iostream>
-
-KVStore::KVStore(const string& filename) : page_manager_(filename), current_page_id_(0), current_offset_(0) {
-    // create BufferPool with PageManager
-    buffer_pool_ = new BufferPool(&page_manager_, 100);
-    // rebuild the index from the file
-    rebuildIndex();
-}
-
-KVStore::~KVStore() {
-    // file manager destructor will automatically close the file
-    // index will be automatically destroyed
-    delete buffer_pool_;
-}
-
-bool KVStore::put(const string& key, const string& value) {
-    // calculate record size
-    uint32_t key_len = key.size();
-    uint32_t value_len = value.size();
-    uint32_t record_size = 4 + key_len + 4 + value_len;
- 
-    // check if record fits in current page
-    if (current_offset_ + record_size > PAGE_SIZE) {
-        // allocate new page
-        current_page_id_ = page_manager_.allocatePage();
-        current_offset_ = 0;
-    }
-
-    // load current page (or create empty if none) using BufferPool cache
-    Page page;
-    buffer_pool_->getPage(current_page_id_, page);
-
-    // write record to page at current offset
-    uint32_t offset = current_offset_;
-    page.writeUint32(offset, key_len);
-    offset += 4;
-    page.writeString(offset, key, key_len);
-    offset += key_len;
-    page.writeUint32(offset, value_len);
-    offset += 4;
-    page.writeString(offset, value, value_len);
-
-    // save page back to cache (will write to disk when flushed/evicted)
-    buffer_pool_->savePage(current_page_id_, page);
-
-    // update index with (page_id, offset)
-    index_[key] = {current_page_id_, current_offset_};
-
-    // update current offset
-    current_offset_ += record_size;
- 
-    return true;
-}
-
-string KVStore::get(const string& key) {
-    // check if key exists in index, if not, return empty string
-    if (index_.find(key) == index_.end()) { 
-        return "";
-    }
-
-    // look up key in index (page_id, offset)
-    uint32_t page_id = index_[key].first;
-    uint32_t offset = index_[key].second;
-
-    // load that page from cache or disk using BufferPool cache
-    Page page;
-    buffer_pool_->getPage(page_id, page);
-
-    // read record from page at that offset
-    uint32_t key_len = page.readUint32(offset);
-    offset += 4;
-
-    // skip key
-    offset += key_len;
-
-    // read value length (4 bytes)
-    uint32_t value_len = page.readUint32(offset);
-    offset += 4;
-
-    // read value
-    string value = page.readString(offset, value_len);
-
-    // return the value
-    return value;
-}
-
-bool KVStore::remove(const string& key) {
-    // check if key exists in index
-    if (index_.find(key) == index_.end()) return false;
-    
-    // remove key from index
-    index_.erase(key);
-
-    // return true
-    return true;
-}
-
-
-void KVStore::rebuildIndex() {
-    // start at beginning of file
-    uint32_t page_id = 0;
-    current_page_id_ = 0;
-    current_offset_ = 0;
-
-    while (true) {
-        // load page from cache or disk using BufferPool cache
-        Page page;
-        buffer_pool_->getPage(page_id, page);
-
-        // check if page is empty (all zeros or past end of file)
-        uint32_t offset = 0;
-        bool found_any = false; // flag to check if any records were found on this page
-
-        // scan page for records
-        while (offset + 4 <= PAGE_SIZE) {
-            // save where this record starts
-            uint32_t record_start = offset;
-            
-            uint32_t key_len = page.readUint32(offset);
-
-            if (key_len == 0 || key_len > PAGE_SIZE) break;
-
-            offset += 4;
-
-            if (offset + key_len > PAGE_SIZE) break;
-
-            // read key
-            string key = page.readString(offset, key_len);
-            offset += key_len;
-
-            if (offset + 4 > PAGE_SIZE) break;
-
-            uint32_t value_len = page.readUint32(offset);
-            offset += 4;
-
-            if (offset + value_len > PAGE_SIZE) break;
-
-            // store in index using the saved record_start
-            index_[key] = {page_id, record_start};
-            found_any = true;
-
-            offset += value_len;
-
-        }
-
-        // update current position
-        if (found_any) {
-            current_page_id_ = page_id;
-            current_offset_ = offset;
-        }
-
-        // if page was empty, break
-        if (!found_any && page_id > 0) {
-            break;
-        }
-
-        page_id++;
-    }
-}
+#include "kv_store.h"
+#include "page_manager.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <unordered_set>
+
+// BTree mode is recorded in <file>.mode, out of band: in Memory mode page 0 holds records from its header on,
+// so no bytes in the data file can mark the mode without a key that happens to start with them looking the same
+static constexpr uint64_t KV_BTREE_TAG = 0x3145455254425653;  // "SVBTREE1"
+
+// bytes of a data page records can use
+static constexpr uint32_t DATA_PAGE_BYTES = PAGE_SIZE - PAGE_HEADER_SIZE;
+
+// index entries the compactor counts per survey step, and how long it sleeps when there's nothing to do
+static constexpr size_t SURVEY_BATCH = 256;
+static constexpr auto COMPACTOR_IDLE = chrono::milliseconds(100);
+
+// index snapshot: entries (key length, key, page id, offset), then a trailer with
+// magic, checksum of the entries, entry count, append position, size of the entries
+static constexpr uint32_t SNAPSHOT_MAGIC = 0x3149564B;  // "KVI1"
+static constexpr size_t SNAPSHOT_TRAILER_SIZE = 32;
+static constexpr size_t SNAPSHOT_CHUNK = 1 << 20;  // entries are written a chunk at a time
+
+// FNV-1a, continued from hash, tells a torn snapshot from a whole one
+static uint32_t snapshotChecksum(const char* data, size_t size, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename T>
+static void appendRaw(string& out, T value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+// values longer than a quarter page go to overflow pages, so a data page still holds a few records;
+// the record's value is then a pointer (first page, page count, value size) and its length is flagged
+static constexpr uint32_t OVERFLOW_THRESHOLD = DATA_PAGE_BYTES / 4;
+static constexpr uint32_t VALUE_OVERFLOW = 0x80000000;
+static constexpr uint32_t OVERFLOW_POINTER_SIZE = 16;
+
+// overflow pages: a marker where a data page has its first key length (no data page starts with it,
+// so the index rebuild skips them), then the value's bytes; they're read and written around the buffer pool
+static constexpr uint32_t OVERFLOW_MARKER = 0xFFFFFFFF;
+static constexpr uint32_t OVERFLOW_PAGE_BYTES = DATA_PAGE_BYTES - 4;
+static constexpr uint32_t OVERFLOW_BATCH = 64;  // overflow pages per read/write batch
+
+// bytes a record's value takes in its page
+static uint32_t inlineValueSize(uint32_t value_len) {
+    return (value_len & VALUE_OVERFLOW) ? OVERFLOW_POINTER_SIZE : value_len;
+}
+
+// tree value of a record: page id, record size, offset in the page (flagged if the value overflows)
+static constexpr uint32_t LOCATION_OVERFLOW = 0x8000;
+static uint64_t packLocation(uint32_t page_id, uint32_t offset, uint32_t size) {
+    return (static_cast<uint64_t>(page_id) << 32) | (static_cast<uint64_t>(size) << 16) | offset;
+}
+static uint32_t locationPage(uint64_t location) { return static_cast<uint32_t>(location >> 32); }
+static uint32_t locationSize(uint64_t location) { return static_cast<uint32_t>(location >> 16) & 0xFFFF; }
+static uint32_t locationOffset(uint64_t location) { return static_cast<uint32_t>(location) & 0x7FFF; }
+static bool locationOverflow(uint64_t location) { return (location & LOCATION_OVERFLOW) != 0; }
+
+KVStore::KVStore(const string& filename, KVIndexMode mode) : page_manager_(filename), current_page_id_(0), current_offset_(0),
+    total_live_bytes_(0), surveyed_(false), compactor_stop_(false), compactor_rate_(0), compactor_ratio_(0),
+    index_filename_(filename + ".idx"), checkpoint_interval_(0), bytes_since_checkpoint_(0), mode_filename_(filename + ".mode") {
+    // create BufferPool with PageManager
+    buffer_pool_ = new BufferPool(&page_manager_, 100);
+
+    // page 0 is ours before it reaches disk (records in Memory mode, tree metadata in BTree mode), so an
+    // overflow extent can't start on it
+    page_manager_.markAllocated(0);
+
+    // a new file gets the mode asked for, an existing one keeps the mode it was created with
+    // (the mode file goes to disk before any page does; if it can't be written the store stays in Memory mode)
+    bool new_file = page_manager_.pageCount() == 0;
+    bool btree = false;
+    if (new_file) {
+        btree = saveMode(mode_filename_, mode) && mode == KVIndexMode::BTree;
+    } else {
+        btree = loadMode(mode_filename_) == KVIndexMode::BTree;
+    }
+
+    if (btree) {
+        // the index is already on disk, nothing to scan; appends start on a fresh page (how full the
+        // last one was isn't stored anywhere a crash couldn't leave stale, its tail stays unused)
+        tree_.reset(new BPlusTree(buffer_pool_, &page_manager_));
+        current_offset_ = PAGE_SIZE;
+        // nothing on disk yet, every record is counted as it's put
+        surveyed_ = new_file;
+        return;
+    }
+
+    // load the last index snapshot, then rebuild the rest of the index from the pages written after it
+    uint32_t first_page_id = 0;
+    uint32_t first_offset = PAGE_HEADER_SIZE;
+    loadCheckpoint(first_page_id, first_offset);
+    rebuildIndex(first_page_id, first_offset);
+}
+
+KVStore::~KVStore() {
+    stopCompaction();
+    // a snapshot at close makes the next open a plain load
+    if (!tree_ && bytes_since_checkpoint_ > 0) {
+        lock_guard<mutex> lock(mutex_);
+        checkpointLocked();
+    }
+    // file manager destructor will automatically close the file
+    // index will be automatically destroyed, the tree goes before the pool it writes through
+    tree_.reset();
+    delete buffer_pool_;
+}
+
+bool KVStore::put(const string& key, const string& value) {
+    lock_guard<mutex> lock(mutex_);
+    if (!putLocked(key, value)) {
+        return false;
+    }
+    if (!tree_ && checkpoint_interval_ > 0 && bytes_since_checkpoint_ >= checkpoint_interval_) {
+        checkpointLocked();
+    }
+    return true;
+}
+
+bool KVStore::putLocked(const string& key, const string& value) {
+    // big values go to overflow pages, the record only holds a pointer to them
+    if (value.size() > OVERFLOW_THRESHOLD) {
+        if (!recordFits(key.size(), OVERFLOW_POINTER_SIZE)) {
+            return false;
+        }
+        // a failed writer is abandoned here, its destructor would take mutex_ again
+        ValueWriter writer(this, key, value.size());
+        if (!writer.write(value.data(), value.size()) || !commitValue(writer)) {
+            abandonLocked(writer);
+            return false;
+        }
+        return true;
+    }
+    return putRecord(key, value.data(), value.size(), false, true);
+}
+
+bool KVStore::recordFits(uint32_t key_len, uint32_t inline_value_len) const {
+    // the tree would turn the key away after the record was written
+    if (tree_ && key_len > MAX_KEY_SIZE) {
+        return false;
+    }
+    return 8 + static_cast<uint64_t>(key_len) + inline_value_len <= DATA_PAGE_BYTES;
+}
+
+bool KVStore::putRecord(const string& key, const char* value, uint32_t value_len, bool overflow, bool free_old_overflow) {
+    // calculate record size
+    uint32_t key_len = key.size();
+    uint32_t record_size = 4 + key_len + 4 + value_len;
+
+    if (!recordFits(key_len, value_len)) {
+        return false;
+    }
+ 
+    // where an overwritten key's record was, its bytes turn into garbage (and its overflow pages go)
+    uint64_t old_location = tree_ ? tree_->search(key) : 0;
+    OverflowPointer old_overflow;
+    if (free_old_overflow && locationOverflow(old_location)) {
+        string unused;
+        readRecordValue(locationPage(old_location), locationOffset(old_location), unused, old_overflow);
+    }
+
+    // check if record fits in current page
+    if (current_offset_ + record_size > PAGE_SIZE) {
+        // the page we leave may be all garbage already (everything on it overwritten or removed)
+        uint32_t previous_page_id = current_page_id_;
+
+        // allocate new page
+        current_page_id_ = page_manager_.allocatePage();
+
+        // page 0 is already in use on a new file (it hasn't reached disk yet), allocate again
+        if (current_page_id_ == 0) {
+            current_page_id_ = page_manager_.allocatePage();
+        }
+        current_offset_ = PAGE_HEADER_SIZE;  // records start after the page header
+
+        auto previous = live_bytes_.find(previous_page_id);
+        if (previous != live_bytes_.end() && previous->second == 0) {
+            addLive(previous_page_id, 0);
+        }
+    }
+
+    // pin current page (or create empty if none) in BufferPool cache and write in place
+    WritePageGuard guard = buffer_pool_->fetchPageWrite(current_page_id_);
+    if (!guard.valid()) {
+        return false;
+    }
+    Page& page = guard.page();
+
+    // a fresh page may be one the tree freed, drop the old node so no stale bytes follow the records
+    if (current_offset_ == PAGE_HEADER_SIZE) {
+        page.clear();
+    }
+
+    // write record to page at current offset, an overflow pointer is flagged in the value length
+    uint32_t offset = current_offset_;
+    page.writeUint32(offset, key_len);
+    offset += 4;
+    page.writeString(offset, key, key_len);
+    offset += key_len;
+    page.writeUint32(offset, overflow ? (value_len | VALUE_OVERFLOW) : value_len);
+    offset += 4;
+    page.writeBytes(offset, value, value_len);
+
+    // release page back to cache, marked dirty (will write to disk when flushed/evicted)
+    guard.release();
+
+    // update index with (page_id, offset)
+    if (tree_) {
+        // the tree keeps duplicate keys, an overwritten key's old entry has to go first
+        if (old_location != 0) {
+            tree_->remove(key);
+        }
+        tree_->insert(key, packLocation(current_page_id_, current_offset_ | (overflow ? LOCATION_OVERFLOW : 0), record_size));
+        if (tracked(key)) {
+            addLive(current_page_id_, record_size);
+            if (old_location != 0) {
+                addLive(locationPage(old_location), -static_cast<int64_t>(locationSize(old_location)));
+            }
+        }
+        freeOverflow(old_overflow);
+    } else {
+        index_[key] = {current_page_id_, current_offset_};
+        bytes_since_checkpoint_ += record_size;
+    }
+
+    // update current offset
+    current_offset_ += record_size;
+ 
+    return true;
+}
+
+string KVStore::get(const string& key) {
+    lock_guard<mutex> lock(mutex_);
+    if (tree_) {
+        // page 0 is the tree's metadata page, so location 0 can't be a record and means not found
+        uint64_t location = tree_->search(key);
+        if (location == 0) {
+            return "";
+        }
+        return readValue(locationPage(location), locationOffset(location));
+    }
+
+    // check if key exists in index, if not, return empty string
+    auto entry = index_.find(key);
+    if (entry == index_.end()) { 
+        return "";
+    }
+
+    // look up key in index (page_id, offset)
+    return readValue(entry->second.first, entry->second.second);
+}
+
+string KVStore::readValue(uint32_t page_id, uint32_t offset) {
+    string value;
+    OverflowPointer overflow;
+    if (readRecordValue(page_id, offset, value, overflow)) {
+        return readOverflow(overflow, 0, overflow.size);
+    }
+    return value;
+}
+
+bool KVStore::readRecordValue(uint32_t page_id, uint32_t offset, string& value, OverflowPointer& overflow) {
+    // pin that page from cache or disk using BufferPool cache, read in place
+    ReadPageGuard guard = buffer_pool_->fetchPage(page_id);
+    if (!guard.valid()) {
+        return false;
+    }
+    const Page& page = guard.page();
+
+    // read record from page at that offset
+    uint32_t key_len = page.readUint32(offset);
+    offset += 4;
+
+    // skip key
+    offset += key_len;
+
+    // read value length (4 bytes)
+    uint32_t value_len = page.readUint32(offset);
+    offset += 4;
+
+    // read value, or the pointer to its overflow pages
+    if (value_len & VALUE_OVERFLOW) {
+        overflow.first_page_id = page.readUint32(offset);
+        overflow.page_count = page.readUint32(offset + 4);
+        overflow.size = page.readUint64(offset + 8);
+        return true;
+    }
+    value = page.readString(offset, value_len);
+    return false;
+}
+
+string KVStore::readOverflow(const OverflowPointer& overflow, uint64_t offset, size_t length) {
+    if (offset >= overflow.size) {
+        return "";
+    }
+    length = static_cast<size_t>(min<uint64_t>(length, overflow.size - offset));
+    string out;
+    out.reserve(length);
+
+    // only the pages the range covers, a batch of neighbours at a time
+    uint32_t page_index = static_cast<uint32_t>(offset / OVERFLOW_PAGE_BYTES);
+    uint32_t skip = static_cast<uint32_t>(offset % OVERFLOW_PAGE_BYTES);
+    uint64_t pages_needed = min<uint64_t>((skip + length + OVERFLOW_PAGE_BYTES - 1) / OVERFLOW_PAGE_BYTES,
+                                          overflow.page_count - page_index);
+    vector<Page> pages(min<uint64_t>(pages_needed, OVERFLOW_BATCH));
+    vector<Page*> page_ptrs;
+    vector<uint32_t> page_ids;
+    while (out.size() < length && page_index < overflow.page_count) {
+        uint32_t pages_left = static_cast<uint32_t>((skip + length - out.size() + OVERFLOW_PAGE_BYTES - 1) / OVERFLOW_PAGE_BYTES);
+        uint32_t count = min(min(pages_left, OVERFLOW_BATCH), overflow.page_count - page_index);
+        page_ptrs.clear();
+        page_ids.clear();
+        for (uint32_t i = 0; i < count; i++) {
+            page_ids.push_back(overflow.first_page_id + page_index + i);
+            page_ptrs.push_back(&pages[i]);
+        }
+        page_manager_.readPageBatch(page_ids.data(), page_ptrs.data(), count);
+        for (uint32_t i = 0; i < count && out.size() < length; i++) {
+            size_t take = min<size_t>(OVERFLOW_PAGE_BYTES - skip, length - out.size());
+            out.append(pages[i].data + PAGE_HEADER_SIZE + 4 + skip, take);
+            skip = 0;
+        }
+        page_index += count;
+    }
+    return out;
+}
+
+void KVStore::freeOverflow(const OverflowPointer& overflow) {
+    // BTree mode only, Memory mode's rebuild relies on pages never being reused
+    if (!tree_) {
+        return;
+    }
+    for (uint32_t i = 0; i < overflow.page_count; i++) {
+        buffer_pool_->freePage(overflow.first_page_id + i);
+    }
+}
+
+string KVStore::getRange(const string& key, uint64_t offset, size_t length) {
+    lock_guard<mutex> lock(mutex_);
+    uint32_t page_id, record_offset;
+    if (!findRecord(key, page_id, record_offset)) {
+        return "";
+    }
+    string value;
+    OverflowPointer overflow;
+    if (readRecordValue(page_id, record_offset, value, overflow)) {
+        return readOverflow(overflow, offset, length);
+    }
+    return offset < value.size() ? value.substr(offset, length) : "";
+}
+
+uint64_t KVStore::valueSize(const string& key) {
+    lock_guard<mutex> lock(mutex_);
+    uint32_t page_id, record_offset;
+    if (!findRecord(key, page_id, record_offset)) {
+        return 0;
+    }
+    string value;
+    OverflowPointer overflow;
+    if (readRecordValue(page_id, record_offset, value, overflow)) {
+        return overflow.size;
+    }
+    return value.size();
+}
+
+bool KVStore::findRecord(const string& key, uint32_t& page_id, uint32_t& offset) {
+    if (tree_) {
+        uint64_t location = tree_->search(key);
+        page_id = locationPage(location);
+        offset = locationOffset(location);
+        return location != 0;
+    }
+    auto entry = index_.find(key);
+    if (entry == index_.end()) {
+        return false;
+    }
+    page_id = entry->second.first;
+    offset = entry->second.second;
+    return true;
+}
+
+KVStore::ValueWriter KVStore::putStream(const string& key, uint64_t size) {
+    if (!recordFits(key.size(), OVERFLOW_POINTER_SIZE) || (size + OVERFLOW_PAGE_BYTES - 1) / OVERFLOW_PAGE_BYTES > UINT32_MAX) {
+        return ValueWriter();
+    }
+    // the writer's extent is registered under the store lock
+    lock_guard<mutex> lock(mutex_);
+    return ValueWriter(this, key, size);
+}
+
+bool KVStore::commitValue(ValueWriter& writer) {
+    if (!writer.store_ || writer.written_ != writer.size_ || !writer.writePages()) {
+        return false;
+    }
+    string pointer;
+    appendRaw<uint32_t>(pointer, writer.first_page_id_);
+    appendRaw<uint32_t>(pointer, writer.page_count_);
+    appendRaw<uint64_t>(pointer, writer.size_);
+    writer.store_ = nullptr;  // the pages belong to the record now
+    open_extents_.erase(writer.first_page_id_);
+    if (!putRecord(writer.key_, pointer.data(), OVERFLOW_POINTER_SIZE, true, true)) {
+        OverflowPointer overflow;
+        overflow.first_page_id = writer.first_page_id_;
+        overflow.page_count = writer.page_count_;
+        freeOverflow(overflow);
+        return false;
+    }
+    return true;
+}
+
+void KVStore::abandonValue(ValueWriter& writer) {
+    lock_guard<mutex> lock(mutex_);
+    abandonLocked(writer);
+}
+
+void KVStore::abandonLocked(ValueWriter& writer) {
+    if (!writer.store_) {
+        return;  // committed, or already given up
+    }
+    OverflowPointer overflow;
+    overflow.first_page_id = writer.first_page_id_;
+    overflow.page_count = writer.page_count_;
+    freeOverflow(overflow);
+    open_extents_.erase(writer.first_page_id_);
+    writer.store_ = nullptr;
+}
+
+KVStore::ValueWriter::ValueWriter(KVStore* store, const string& key, uint64_t size)
+    : store_(store), key_(key), size_(size), written_(0), page_count_(static_cast<uint32_t>((size + OVERFLOW_PAGE_BYTES - 1) / OVERFLOW_PAGE_BYTES)) {
+    // one extent, freed pages first; they're written around the buffer pool, so a freed page it still caches
+    // has to go first (a stale dirty copy would be written over the value later), else the extent comes from the end
+    // caller holds the store's mutex_ (the extent is listed in open_extents_ until commit or abandon)
+    if (page_count_ > 0) {
+        first_page_id_ = store_->page_manager_.allocateExtent(page_count_);
+        for (uint32_t i = 0; i < page_count_; i++) {
+            if (!store_->buffer_pool_->discardPage(first_page_id_ + i)) {
+                for (uint32_t j = 0; j < page_count_; j++) {
+                    store_->page_manager_.freePage(first_page_id_ + j);
+                }
+                first_page_id_ = store_->page_manager_.allocateExtent(page_count_, false);
+                break;
+            }
+        }
+        store_->open_extents_[first_page_id_] = page_count_;
+    }
+    next_page_id_ = first_page_id_;
+}
+
+KVStore::ValueWriter::ValueWriter(ValueWriter&& other) noexcept {
+    *this = move(other);
+}
+
+KVStore::ValueWriter& KVStore::ValueWriter::operator=(ValueWriter&& other) noexcept {
+    if (this != &other) {
+        if (store_) {
+            store_->abandonValue(*this);
+        }
+        store_ = other.store_;
+        key_ = move(other.key_);
+        size_ = other.size_;
+        written_ = other.written_;
+        first_page_id_ = other.first_page_id_;
+        page_count_ = other.page_count_;
+        next_page_id_ = other.next_page_id_;
+        pages_ = move(other.pages_);
+        other.store_ = nullptr;
+    }
+    return *this;
+}
+
+KVStore::ValueWriter::~ValueWriter() {
+    if (store_) {
+        store_->abandonValue(*this);
+    }
+}
+
+bool KVStore::ValueWriter::write(const char* data, size_t size) {
+    if (!store_ || size > size_ - written_) {
+        return false;
+    }
+    while (size > 0) {
+        uint32_t page_offset = static_cast<uint32_t>(written_ % OVERFLOW_PAGE_BYTES);
+        if (page_offset == 0) {
+            pages_.emplace_back(true);
+            pages_.back().writeUint32(PAGE_HEADER_SIZE, OVERFLOW_MARKER);
+        }
+        uint32_t take = static_cast<uint32_t>(min<size_t>(size, OVERFLOW_PAGE_BYTES - page_offset));
+        pages_.back().writeBytes(PAGE_HEADER_SIZE + 4 + page_offset, data, take);
+        data += take;
+        size -= take;
+        written_ += take;
+
+        // a batch of full pages goes out as one sequential write
+        if (pages_.size() == OVERFLOW_BATCH && written_ % OVERFLOW_PAGE_BYTES == 0 && !writePages()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool KVStore::ValueWriter::commit() {
+    if (!store_) {
+        return false;
+    }
+    KVStore* store = store_;
+    lock_guard<mutex> lock(store->mutex_);
+    return store->commitValue(*this);
+}
+
+bool KVStore::ValueWriter::writePages() {
+    if (pages_.empty()) {
+        return true;
+    }
+    vector<const Page*> page_ptrs;
+    for (const Page& page : pages_) {
+        page_ptrs.push_back(&page);
+    }
+    store_->page_manager_.writePages(next_page_id_, page_ptrs.data(), page_ptrs.size());
+    next_page_id_ += static_cast<uint32_t>(pages_.size());
+    pages_.clear();
+    return true;
+}
+
+bool KVStore::remove(const string& key) {
+    lock_guard<mutex> lock(mutex_);
+    if (tree_) {
+        uint64_t location = tree_->search(key);
+        if (location == 0) {
+            return false;
+        }
+        OverflowPointer overflow;
+        if (locationOverflow(location)) {
+            string unused;
+            readRecordValue(locationPage(location), locationOffset(location), unused, overflow);
+        }
+        if (!tree_->remove(key)) {
+            return false;
+        }
+        if (tracked(key)) {
+            addLive(locationPage(location), -static_cast<int64_t>(locationSize(location)));
+        }
+        freeOverflow(overflow);
+        return true;
+    }
+
+    // check if key exists in index
+    if (index_.find(key) == index_.end()) return false;
+    
+    // remove key from index (kept across restarts once a snapshot without it is taken)
+    index_.erase(key);
+    bytes_since_checkpoint_++;
+
+    // return true
+    return true;
+}
+
+size_t KVStore::scan(const string& begin, const string& end, const function<bool(const string&, const string&)>& callback) {
+    lock_guard<mutex> lock(mutex_);
+    if (tree_) {
+        return tree_->scan(begin, end, [&](const string& key, uint64_t location) {
+            return callback(key, readValue(locationPage(location), locationOffset(location)));
+        });
+    }
+
+    // the hash map has no order, sort the keys in range
+    vector<const string*> keys;
+    for (const auto& entry : index_) {
+        if (entry.first >= begin && (end.empty() || entry.first < end)) {
+            keys.push_back(&entry.first);
+        }
+    }
+    sort(keys.begin(), keys.end(), [](const string* a, const string* b) { return *a < *b; });
+
+    size_t visited = 0;
+    for (const string* key : keys) {
+        visited++;
+        const pair<uint32_t, uint32_t>& location = index_[*key];
+        if (!callback(*key, readValue(location.first, location.second))) {
+            break;
+        }
+    }
+    return visited;
+}
+
+bool KVStore::checkpoint() {
+    lock_guard<mutex> lock(mutex_);
+    return checkpointLocked();
+}
+
+void KVStore::setCheckpointInterval(uint64_t bytes) {
+    lock_guard<mutex> lock(mutex_);
+    checkpoint_interval_ = bytes;
+}
+
+bool KVStore::checkpointLocked() {
+    if (tree_) {
+        return false;
+    }
+
+    // the snapshot points into data pages, they go to disk first
+    buffer_pool_->flushAll();
+    page_manager_.sync();
+
+    // written to a temp file and renamed over the old snapshot, a crash leaves one or the other whole
+    string temp_filename = index_filename_ + ".tmp";
+    std::remove(temp_filename.c_str());
+    {
+        FileManager file(temp_filename);
+        string chunk;
+        chunk.reserve(SNAPSHOT_CHUNK + 2 * PAGE_SIZE);
+        uint32_t sum = snapshotChecksum(nullptr, 0);
+        uint64_t body_size = 0;
+        for (const auto& entry : index_) {
+            appendRaw<uint32_t>(chunk, entry.first.size());
+            chunk.append(entry.first);
+            appendRaw<uint32_t>(chunk, entry.second.first);
+            appendRaw<uint32_t>(chunk, entry.second.second);
+            if (chunk.size() >= SNAPSHOT_CHUNK) {
+                sum = snapshotChecksum(chunk.data(), chunk.size(), sum);
+                body_size += chunk.size();
+                file.write(chunk);
+                chunk.clear();
+            }
+        }
+        sum = snapshotChecksum(chunk.data(), chunk.size(), sum);
+        body_size += chunk.size();
+
+        appendRaw<uint32_t>(chunk, SNAPSHOT_MAGIC);
+        appendRaw<uint32_t>(chunk, sum);
+        appendRaw<uint64_t>(chunk, index_.size());
+        appendRaw<uint32_t>(chunk, current_page_id_);
+        appendRaw<uint32_t>(chunk, current_offset_);
+        appendRaw<uint64_t>(chunk, body_size);
+        file.write(chunk);
+        file.sync();
+    }
+    if (std::rename(temp_filename.c_str(), index_filename_.c_str()) != 0) {
+        return false;
+    }
+    bytes_since_checkpoint_ = 0;
+    return true;
+}
+
+bool KVStore::saveMode(const string& mode_filename, KVIndexMode mode) {
+    // Memory mode is a missing mode file (so files from before it existed open as they are),
+    // one left behind by a deleted BTree file must not carry over
+    if (mode == KVIndexMode::Memory) {
+        std::remove(mode_filename.c_str());
+        return true;
+    }
+
+    // written to a temp file and renamed, a crash leaves no mode file or a whole one
+    string temp_filename = mode_filename + ".tmp";
+    std::remove(temp_filename.c_str());
+    {
+        FileManager file(temp_filename);
+        string tag;
+        appendRaw<uint64_t>(tag, KV_BTREE_TAG);
+        file.write(tag);
+        file.sync();
+        if (file.size() != tag.size()) {
+            return false;
+        }
+    }
+    return std::rename(temp_filename.c_str(), mode_filename.c_str()) == 0;
+}
+
+KVIndexMode KVStore::loadMode(const string& mode_filename) {
+    FileManager file(mode_filename, true);
+    if (file.size() != sizeof(uint64_t)) {
+        return KVIndexMode::Memory;
+    }
+    uint64_t tag = 0;
+    file.readAt(0, reinterpret_cast<char*>(&tag), sizeof(tag));
+    return tag == KV_BTREE_TAG ? KVIndexMode::BTree : KVIndexMode::Memory;
+}
+
+void KVStore::loadCheckpoint(uint32_t& first_page_id, uint32_t& first_offset) {
+    FileManager file(index_filename_, true);
+    uint64_t size = file.size();
+    if (size < SNAPSHOT_TRAILER_SIZE) {
+        return;
+    }
+    string snapshot = file.read(0, size);
+    const char* trailer = snapshot.data() + size - SNAPSHOT_TRAILER_SIZE;
+    uint32_t magic, sum, page_id, offset;
+    uint64_t count, body_size;
+    memcpy(&magic, trailer, 4);
+    memcpy(&sum, trailer + 4, 4);
+    memcpy(&count, trailer + 8, 8);
+    memcpy(&page_id, trailer + 16, 4);
+    memcpy(&offset, trailer + 20, 4);
+    memcpy(&body_size, trailer + 24, 8);
+    if (magic != SNAPSHOT_MAGIC || body_size != size - SNAPSHOT_TRAILER_SIZE || snapshotChecksum(snapshot.data(), body_size) != sum) {
+        return;
+    }
+    // the data it points into is gone (another file, or cut short): rebuild from scratch
+    if (count > 0 && page_id >= page_manager_.pageCount()) {
+        return;
+    }
+
+    index_.reserve(count);
+    const char* entry = snapshot.data();
+    const char* end = snapshot.data() + body_size;
+    for (uint64_t i = 0; i < count; i++) {
+        uint32_t key_len, entry_page_id, entry_offset;
+        if (end - entry < 4) break;
+        memcpy(&key_len, entry, 4);
+        if (static_cast<uint64_t>(end - entry) < 12 + static_cast<uint64_t>(key_len)) break;
+        memcpy(&entry_page_id, entry + 4 + key_len, 4);
+        memcpy(&entry_offset, entry + 8 + key_len, 4);
+        index_[string(entry + 4, key_len)] = {entry_page_id, entry_offset};
+        entry += 12 + key_len;
+    }
+    if (index_.size() != count) {
+        index_.clear();  // checksum matched but the entries don't add up, don't trust any of it
+        return;
+    }
+    first_page_id = page_id;
+    first_offset = offset;
+}
+
+size_t KVStore::compact(size_t max_pages, double min_garbage_ratio) {
+    lock_guard<mutex> lock(mutex_);
+    if (!tree_) {
+        return 0;
+    }
+    while (!surveyed_) {
+        surveyStep(SURVEY_BATCH);
+    }
+    size_t compacted = 0;
+    uint32_t victim;
+    while (compacted < max_pages && (victim = pickVictim(min_garbage_ratio)) != 0) {
+        compactPage(victim);
+        compacted++;
+    }
+    return compacted;
+}
+
+bool KVStore::startCompaction(uint64_t bytes_per_second, double min_garbage_ratio) {
+    if (!tree_ || bytes_per_second == 0 || compactor_.joinable()) {
+        return false;
+    }
+    compactor_rate_ = bytes_per_second;
+    compactor_ratio_ = min_garbage_ratio;
+    compactor_stop_ = false;
+    compactor_ = thread(&KVStore::compactorLoop, this);
+    return true;
+}
+
+void KVStore::stopCompaction() {
+    if (!compactor_.joinable()) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(compactor_mutex_);
+        compactor_stop_ = true;
+    }
+    compactor_wake_.notify_one();
+    compactor_.join();
+}
+
+uint64_t KVStore::liveBytes() {
+    lock_guard<mutex> lock(mutex_);
+    return total_live_bytes_;
+}
+
+size_t KVStore::dataPageCount() {
+    lock_guard<mutex> lock(mutex_);
+    return live_bytes_.size();
+}
+
+void KVStore::compactorLoop() {
+    unique_lock<mutex> lock(compactor_mutex_);
+    while (!compactor_stop_) {
+        lock.unlock();
+        size_t work;
+        {
+            lock_guard<mutex> store_lock(mutex_);
+            work = compactionStep(compactor_ratio_);
+        }
+        lock.lock();
+
+        // pay for the step with a pause that keeps the average under the rate
+        auto pause = work == 0 ? chrono::duration_cast<chrono::microseconds>(COMPACTOR_IDLE)
+                               : chrono::microseconds(work * 1000000 / compactor_rate_);
+        compactor_wake_.wait_for(lock, pause, [&] { return compactor_stop_; });
+    }
+}
+
+size_t KVStore::compactionStep(double min_garbage_ratio) {
+    if (!surveyed_) {
+        return surveyStep(SURVEY_BATCH);
+    }
+    uint32_t victim = pickVictim(min_garbage_ratio);
+    if (victim == 0) {
+        return 0;
+    }
+    // reading the page counts as well as what's copied off it
+    return PAGE_SIZE + compactPage(victim);
+}
+
+void KVStore::addLive(uint32_t page_id, int64_t delta) {
+    auto entry = live_bytes_.find(page_id);
+    if (entry == live_bytes_.end() && delta <= 0) {
+        return;
+    }
+    int64_t old_live = entry == live_bytes_.end() ? 0 : entry->second;
+    if (entry != live_bytes_.end()) {
+        by_garbage_.erase({DATA_PAGE_BYTES - min<uint32_t>(entry->second, DATA_PAGE_BYTES), page_id});
+    }
+    int64_t new_live = max<int64_t>(old_live + delta, 0);
+    total_live_bytes_ += new_live - old_live;
+
+    // nothing on it is reachable any more, the append page waits until appends move on
+    if (new_live == 0 && page_id != current_page_id_) {
+        if (entry != live_bytes_.end()) {
+            live_bytes_.erase(entry);
+        }
+        buffer_pool_->freePage(page_id);
+        return;
+    }
+    live_bytes_[page_id] = static_cast<uint32_t>(new_live);
+    by_garbage_.insert({DATA_PAGE_BYTES - min<uint32_t>(static_cast<uint32_t>(new_live), DATA_PAGE_BYTES), page_id});
+}
+
+size_t KVStore::surveyStep(size_t max_keys) {
+    // every live record's bytes go to its page; the key after the batch is where the next step starts
+    size_t counted = 0;
+    size_t visited_bytes = 0;
+    string next_key;
+    tree_->scan(survey_cursor_, "", [&](const string& key, uint64_t location) {
+        if (counted == max_keys) {
+            next_key = key;
+            return false;
+        }
+        addLive(locationPage(location), locationSize(location));
+        counted++;
+        visited_bytes += key.size() + 8;
+        return true;
+    });
+    if (counted < max_keys || next_key.empty()) {
+        surveyed_ = true;
+        survey_cursor_.clear();
+        visited_bytes += sweepDeadPages();
+    } else {
+        survey_cursor_ = next_key;
+    }
+    return visited_bytes;
+}
+
+size_t KVStore::sweepDeadPages() {
+    // every live record is counted now, so a page is in use if it's a tree node, holds a live record, is the
+    // append page, or belongs to an overflow value (a live one, or one being written); anything else that
+    // holds records is dead
+    vector<uint32_t> tree_pages = tree_->pageIds();
+    unordered_set<uint32_t> in_use(tree_pages.begin(), tree_pages.end());
+    for (const auto& extent : open_extents_) {
+        for (uint32_t i = 0; i < extent.second; i++) {
+            in_use.insert(extent.first + i);
+        }
+    }
+
+    size_t read_bytes = 0;
+    uint32_t page_count = page_manager_.pageCount();
+    for (uint32_t page_id = 1; page_id < page_count; page_id++) {
+        if (page_id == current_page_id_ || live_bytes_.count(page_id) || in_use.count(page_id) ||
+            page_manager_.pageIsFree(page_id)) {
+            continue;
+        }
+        uint32_t first_key_len;
+        {
+            ReadPageGuard guard = buffer_pool_->fetchPage(page_id);
+            if (!guard.valid()) {
+                continue;
+            }
+            first_key_len = guard.page().readUint32(PAGE_HEADER_SIZE);
+        }
+        read_bytes += PAGE_SIZE;
+        // overflow pages don't say whose they are, a dead value's pages were freed when it died
+        if (first_key_len != OVERFLOW_MARKER) {
+            buffer_pool_->freePage(page_id);
+        }
+    }
+    return read_bytes;
+}
+
+uint32_t KVStore::pickVictim(double min_garbage_ratio) {
+    uint32_t min_garbage = static_cast<uint32_t>(min_garbage_ratio * DATA_PAGE_BYTES);
+    for (auto it = by_garbage_.rbegin(); it != by_garbage_.rend() && it->first >= min_garbage; ++it) {
+        if (it->second != current_page_id_) {
+            return it->second;
+        }
+    }
+    return 0;
+}
+
+size_t KVStore::compactPage(uint32_t page_id) {
+    // take the records off the page first, copying them forward writes other pages
+    // records are moved as they are, an overflow pointer keeps pointing at the same pages
+    struct Record {
+        uint32_t offset;
+        string key;
+        string value;  // inline value or overflow pointer
+        bool overflow;
+    };
+    vector<Record> records;
+    {
+        ReadPageGuard guard = buffer_pool_->fetchPage(page_id);
+        if (!guard.valid()) {
+            return 0;
+        }
+        const Page& page = guard.page();
+        uint32_t offset = PAGE_HEADER_SIZE;
+        while (offset + 4 <= PAGE_SIZE) {
+            uint32_t key_len = page.readUint32(offset);
+            if (key_len == 0 || offset + 8 + key_len > PAGE_SIZE) break;
+            uint32_t value_len = page.readUint32(offset + 4 + key_len);
+            uint32_t inline_len = inlineValueSize(value_len);
+            if (offset + 8 + key_len + inline_len > PAGE_SIZE) break;
+            records.push_back({offset, page.readString(offset + 4, key_len), page.readString(offset + 8 + key_len, inline_len),
+                               (value_len & VALUE_OVERFLOW) != 0});
+            offset += 8 + key_len + inline_len;
+        }
+    }
+
+    // a record is live if the index still points at it; moving the last one frees the page
+    size_t copied = 0;
+    for (const Record& record : records) {
+        uint64_t location = tree_->search(record.key);
+        if (locationPage(location) == page_id && locationOffset(location) == record.offset) {
+            putRecord(record.key, record.value.data(), record.value.size(), record.overflow, false);
+            copied += locationSize(location);
+        }
+    }
+
+    // bytes the records didn't account for (shouldn't happen): stop tracking the page rather than pick it forever
+    auto entry = live_bytes_.find(page_id);
+    if (entry != live_bytes_.end()) {
+        by_garbage_.erase({DATA_PAGE_BYTES - min<uint32_t>(entry->second, DATA_PAGE_BYTES), page_id});
+        total_live_bytes_ -= entry->second;
+        live_bytes_.erase(entry);
+    }
+    return copied;
+}
+
+void KVStore::rebuildIndex(uint32_t first_page_id, uint32_t first_offset) {
+    // pages read ahead per batch, the scan runs at disk bandwidth instead of one miss at a time
+    const uint32_t prefetch_pages = 32;
+
+    // start at the position given (beginning of file, or where the snapshot left off)
+    uint32_t page_id = first_page_id;
+    current_page_id_ = first_page_id;
+    current_offset_ = first_offset;
+
+    // to the end of the file: overflow pages (and pages an abandoned value reserved) hold no records,
+    // data pages can follow them
+    uint32_t page_count = page_manager_.pageCount();
+
+    for (; page_id < page_count; page_id++) {
+        if ((page_id - first_page_id) % prefetch_pages == 0) {
+            buffer_pool_->prefetch(page_id, prefetch_pages);
+        }
+
+        // pin page from cache or disk using BufferPool cache
+        ReadPageGuard guard = buffer_pool_->fetchPage(page_id);
+        if (!guard.valid()) {
+            break;
+        }
+        const Page& page = guard.page();
+
+        // check if page is empty (all zeros or past end of file), records start after the page header
+        uint32_t offset = page_id == first_page_id ? first_offset : PAGE_HEADER_SIZE;
+        bool found_any = false; // flag to check if any records were found on this page
+
+        // scan page for records
+        while (offset + 4 <= PAGE_SIZE) {
+            // save where this record starts
+            uint32_t record_start = offset;
+            
+            uint32_t key_len = page.readUint32(offset);
+
+            if (key_len == 0 || key_len > PAGE_SIZE) break;
+
+            offset += 4;
+
+            if (offset + key_len > PAGE_SIZE) break;
+
+            // read key
+            string key = page.readString(offset, key_len);
+            offset += key_len;
+
+            if (offset + 4 > PAGE_SIZE) break;
+
+            // an overflowing value only has its pointer here
+            uint32_t value_len = inlineValueSize(page.readUint32(offset));
+            offset += 4;
+
+            if (offset + value_len > PAGE_SIZE) break;
+
+            // store in index using the saved record_start
+            index_[key] = {page_id, record_start};
+            found_any = true;
+            bytes_since_checkpoint_ += 8 + key_len + value_len;
+
+            offset += value_len;
+
+        }
+
+        // update current position
+        if (found_any) {
+            current_page_id_ = page_id;
+            current_offset_ = offset;
+        }
+    }
+}
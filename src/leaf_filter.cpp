@@ -0,0 +1,150 @@
+#include "leaf_filter.h"
+#include <cmath>
+#include <mutex>
+
+static constexpr double DEFAULT_FALSE_POSITIVE_RATE = 0.01;
+static constexpr size_t DEFAULT_MEMORY_LIMIT = 16 << 20;
+
+// probe positions come from a remix of the key hash, the block from its high half
+static uint64_t keyHash(const string& key) {
+    return hash<string>()(key);
+}
+
+static uint64_t remix(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+LeafFilterTable::LeafFilterTable()
+    : shards_(new Shard[SHARDS]), rate_(0), bits_per_key_(0), memory_limit_(DEFAULT_MEMORY_LIMIT), memory_usage_(0) {
+    setFalsePositiveRate(DEFAULT_FALSE_POSITIVE_RATE);
+}
+
+void LeafFilterTable::setFalsePositiveRate(double rate) {
+    // optimal Bloom sizing: -ln(rate) / ln(2)^2 bits per key
+    rate_ = rate;
+    bits_per_key_ = rate > 0 && rate < 1 ? -log(rate) / (log(2.0) * log(2.0)) : 0;
+    clear();
+}
+
+void LeafFilterTable::setMemoryLimit(size_t bytes) {
+    memory_limit_ = bytes;
+}
+
+bool LeafFilterTable::mayContain(uint32_t page_id, const string& key, bool* wants_filter) const {
+    const Shard& s = shard(page_id);
+    shared_lock<shared_mutex> lock(s.mutex);
+    auto it = s.filters.find(page_id);
+    if (it == s.filters.end()) {
+        if (wants_filter) {
+            *wants_filter = bits_per_key_ != 0 && memory_usage_ < memory_limit_;
+        }
+        return true;
+    }
+    if (wants_filter) {
+        *wants_filter = false;
+    }
+    return containsKey(it->second, keyHash(key));
+}
+
+void LeafFilterTable::build(uint32_t page_id, const vector<string>& keys, const function<bool()>& unchanged) {
+    double bits_per_key = bits_per_key_;
+    if (bits_per_key == 0) {
+        return;
+    }
+
+    // room for half as many keys again, so inserts after a split (half full) or a first read rarely outgrow it
+    Filter filter;
+    filter.capacity = static_cast<uint32_t>(keys.size() + keys.size() / 2 + 16);
+    filter.blocks = static_cast<uint32_t>(ceil(filter.capacity * bits_per_key / BLOCK_BITS));
+    filter.probes = static_cast<uint32_t>(lround(bits_per_key * log(2.0)));
+    filter.probes = filter.probes < 1 ? 1 : (filter.probes > 16 ? 16 : filter.probes);
+    filter.bits.assign(static_cast<size_t>(filter.blocks) * (BLOCK_BITS / 64), 0);
+    for (const string& key : keys) {
+        insertKey(filter, keyHash(key));
+    }
+    filter.keys = static_cast<uint32_t>(keys.size());
+
+    Shard& s = shard(page_id);
+    unique_lock<shared_mutex> lock(s.mutex);
+    if (unchanged && !unchanged()) {
+        return;
+    }
+    auto it = s.filters.find(page_id);
+    size_t old_bytes = it != s.filters.end() ? filterBytes(it->second) : 0;
+    if (memory_usage_ - old_bytes + filterBytes(filter) > memory_limit_) {
+        // out of memory: no filter is better than a stale one
+        if (it != s.filters.end()) {
+            s.filters.erase(it);
+            memory_usage_ -= old_bytes;
+        }
+        return;
+    }
+    memory_usage_ += filterBytes(filter);
+    memory_usage_ -= old_bytes;
+    s.filters[page_id] = move(filter);
+}
+
+void LeafFilterTable::add(uint32_t page_id, const string& key) {
+    Shard& s = shard(page_id);
+    unique_lock<shared_mutex> lock(s.mutex);
+    auto it = s.filters.find(page_id);
+    if (it == s.filters.end()) {
+        return;
+    }
+    if (it->second.keys >= it->second.capacity) {
+        memory_usage_ -= filterBytes(it->second);
+        s.filters.erase(it);
+        return;
+    }
+    insertKey(it->second, keyHash(key));
+    it->second.keys++;
+}
+
+void LeafFilterTable::drop(uint32_t page_id) {
+    Shard& s = shard(page_id);
+    unique_lock<shared_mutex> lock(s.mutex);
+    auto it = s.filters.find(page_id);
+    if (it != s.filters.end()) {
+        memory_usage_ -= filterBytes(it->second);
+        s.filters.erase(it);
+    }
+}
+
+void LeafFilterTable::clear() {
+    for (size_t i = 0; i < SHARDS; i++) {
+        unique_lock<shared_mutex> lock(shards_[i].mutex);
+        for (const auto& entry : shards_[i].filters) {
+            memory_usage_ -= filterBytes(entry.second);
+        }
+        shards_[i].filters.clear();
+    }
+}
+
+// probe i sets bit (a + i * b) of the block, top 9 bits of a 32-bit sum (double hashing)
+void LeafFilterTable::insertKey(Filter& filter, uint64_t hash) {
+    uint64_t* block = filter.bits.data() + ((hash >> 32) * filter.blocks >> 32) * (BLOCK_BITS / 64);
+    uint64_t mixed = remix(hash);
+    uint32_t a = static_cast<uint32_t>(mixed);
+    uint32_t b = static_cast<uint32_t>(mixed >> 32) | 1;
+    for (uint32_t i = 0; i < filter.probes; i++) {
+        uint32_t bit = (a + i * b) >> 23;
+        block[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+}
+
+bool LeafFilterTable::containsKey(const Filter& filter, uint64_t hash) {
+    const uint64_t* block = filter.bits.data() + ((hash >> 32) * filter.blocks >> 32) * (BLOCK_BITS / 64);
+    uint64_t mixed = remix(hash);
+    uint32_t a = static_cast<uint32_t>(mixed);
+    uint32_t b = static_cast<uint32_t>(mixed >> 32) | 1;
+    for (uint32_t i = 0; i < filter.probes; i++) {
+        uint32_t bit = (a + i * b) >> 23;
+        if (!((block[bit / 64] >> (bit % 64)) & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
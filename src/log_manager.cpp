@@ -0,0 +1,264 @@
+#include "log_manager.h"
+#include "page_manager.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+LogManager::LogManager(const string& filename)
+    : filename_(filename), file_(new FileManager(filename)), log_end_(0), next_lsn_(1), flushed_lsn_(0), flushing_(false) {
+    // new log, just the header
+    if (file_->size() < PAGE_SIZE) {
+        writeHeader(*file_, 1);
+        file_->sync();
+        log_end_ = file_->size();
+        size_ = log_end_;
+        return;
+    }
+    log_end_ = file_->size();
+    size_ = log_end_;
+
+    // existing log, recover() decides where it really ends
+    Page header;
+    file_->readPage(0, header);
+    if (header.readUint32(0) == LOG_MAGIC && header.readUint64(8) > 0) {
+        next_lsn_ = header.readUint64(8);
+        flushed_lsn_ = next_lsn_ - 1;
+    }
+}
+
+LogManager::~LogManager() {
+    commit();
+}
+
+uint64_t LogManager::logPages(const uint32_t* page_ids, Page* const* pages, size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    uint64_t lsn = next_lsn_++;
+
+    // stamp first so the image in the log carries its own LSN
+    size_t record_start = buffer_.size();
+    buffer_.resize(record_start + RECORD_HEADER_SIZE + count * (4 + PAGE_SIZE));
+    char* body = &buffer_[record_start + RECORD_HEADER_SIZE];
+    for (size_t i = 0; i < count; i++) {
+        pages[i]->setLsn(lsn);
+        memcpy(body, &page_ids[i], 4);
+        memcpy(body + 4, pages[i]->data, PAGE_SIZE);
+        body += 4 + PAGE_SIZE;
+    }
+
+    uint32_t magic = LOG_MAGIC;
+    uint32_t page_count = static_cast<uint32_t>(count);
+    uint32_t sum = checksum(&buffer_[record_start + RECORD_HEADER_SIZE], count * (4 + PAGE_SIZE)) ^ static_cast<uint32_t>(lsn);
+    char* header = &buffer_[record_start];
+    memcpy(header, &magic, 4);
+    memcpy(header + 4, &page_count, 4);
+    memcpy(header + 8, &lsn, 8);
+    memcpy(header + 16, &sum, 4);
+    records_.emplace_back(lsn, log_end_ + record_start);
+    size_ = log_end_ + buffer_.size();
+    return lsn;
+}
+
+void LogManager::flush(uint64_t lsn) {
+    unique_lock<mutex> lock(mutex_);
+
+    // never wait for an LSN that wasn't handed out (pages stamped by an older, truncated log)
+    if (lsn >= next_lsn_) {
+        lsn = next_lsn_ - 1;
+    }
+
+    while (flushed_lsn_ < lsn) {
+        // somebody is already writing, their group may well cover us
+        if (flushing_) {
+            flushed_.wait(lock);
+            continue;
+        }
+
+        // become the leader: take everything buffered so far, write it and sync once for all of it
+        flushing_ = true;
+        string group;
+        group.swap(buffer_);
+        uint64_t group_lsn = next_lsn_ - 1;
+        log_end_ += group.size();
+        lock.unlock();
+
+        if (!group.empty()) {
+            file_->write(group);
+        }
+        file_->sync();
+
+        lock.lock();
+        flushed_lsn_ = group_lsn;
+        flushing_ = false;
+        flushed_.notify_all();
+    }
+}
+
+uint64_t LogManager::commit() {
+    uint64_t lsn;
+    {
+        lock_guard<mutex> lock(mutex_);
+        lsn = next_lsn_ - 1;
+    }
+    flush(lsn);
+    return lsn;
+}
+
+void LogManager::recover(PageManager* page_manager) {
+    lock_guard<mutex> lock(mutex_);
+    uint64_t file_size = file_->size();
+
+    Page header;
+    file_->readPage(0, header);
+    uint64_t first_lsn = header.readUint32(0) == LOG_MAGIC ? header.readUint64(8) : 1;
+    if (first_lsn == 0) {
+        first_lsn = 1;
+    }
+
+    // replay records in order, the last image of a page wins
+    uint64_t position = PAGE_SIZE;
+    uint64_t last_lsn = 0;
+    Page image;
+    while (position + RECORD_HEADER_SIZE <= file_size) {
+        string record_header = file_->read(position, RECORD_HEADER_SIZE);
+        uint32_t magic, page_count, sum;
+        uint64_t lsn;
+        memcpy(&magic, &record_header[0], 4);
+        memcpy(&page_count, &record_header[4], 4);
+        memcpy(&lsn, &record_header[8], 8);
+        memcpy(&sum, &record_header[16], 4);
+        if (magic != LOG_MAGIC || page_count == 0) break;
+
+        uint64_t body_size = static_cast<uint64_t>(page_count) * (4 + PAGE_SIZE);
+        if (position + RECORD_HEADER_SIZE + body_size > file_size) break;  // torn tail
+        string body = file_->read(position + RECORD_HEADER_SIZE, body_size);
+        if ((checksum(body.data(), body.size()) ^ static_cast<uint32_t>(lsn)) != sum) break;
+
+        // records older than the header's LSN were checkpointed already
+        if (lsn >= first_lsn && page_manager) {
+            const char* entry = body.data();
+            for (uint32_t i = 0; i < page_count; i++) {
+                uint32_t page_id;
+                memcpy(&page_id, entry, 4);
+                memcpy(image.data, entry + 4, PAGE_SIZE);
+                page_manager->writePage(page_id, image);
+                page_manager->markAllocated(page_id);
+                entry += 4 + PAGE_SIZE;
+            }
+        }
+        last_lsn = lsn;
+        position += RECORD_HEADER_SIZE + body_size;
+    }
+
+    next_lsn_ = last_lsn + 1 > first_lsn ? last_lsn + 1 : first_lsn;
+    flushed_lsn_ = next_lsn_ - 1;
+    buffer_.clear();
+
+    // everything is in the page file now, make it durable and start over with an empty log
+    if (page_manager) {
+        page_manager->sync();
+        // replay took pages the saved free map still had as free, save the corrected map before the log goes
+        page_manager->saveFreeSpace();
+    }
+    writeHeader(*file_, next_lsn_);
+    file_->truncate(PAGE_SIZE);
+    file_->sync();
+    log_end_ = PAGE_SIZE;
+    records_.clear();
+    size_ = log_end_;
+}
+
+bool LogManager::truncate(uint64_t lsn) {
+    unique_lock<mutex> lock(mutex_);
+    flushed_.wait(lock, [&] { return !flushing_; });
+
+    // only records that are durable themselves can be covered by the page file
+    if (lsn > flushed_lsn_) {
+        lsn = flushed_lsn_;
+    }
+    size_t dropped = 0;
+    while (dropped < records_.size() && records_[dropped].first <= lsn) {
+        dropped++;
+    }
+    if (dropped == 0) {
+        return false;
+    }
+
+    // everything from keep_from on is still needed (nothing is buffered up to lsn, so it's in the file or at log_end_)
+    uint64_t keep_from = dropped < records_.size() ? records_[dropped].second : log_end_;
+    if (keep_from >= log_end_) {
+        // nothing in the file is needed any more
+        // header first: if we crash before the truncate, the old records are skipped as checkpointed
+        writeHeader(*file_, lsn + 1);
+        file_->sync();
+        file_->truncate(PAGE_SIZE);
+        file_->sync();
+    } else {
+        // moving the tail down in place could leave neither the old nor the new log whole after a crash,
+        // so it's written behind a fresh header into a temp file that is renamed over the log
+        string tail = file_->read(keep_from, log_end_ - keep_from);
+        string temp_filename = filename_ + ".tmp";
+        remove(temp_filename.c_str());
+        unique_ptr<FileManager> next(new FileManager(temp_filename));
+        writeHeader(*next, lsn + 1);
+        next->write(tail);
+        next->sync();
+        if (std::rename(temp_filename.c_str(), filename_.c_str()) != 0) {
+            next.reset();
+            remove(temp_filename.c_str());
+            return false;
+        }
+        // records appended from now on go to the new file, the rename has to stick before they do
+        syncDirectory();
+        file_ = move(next);
+    }
+
+    uint64_t shift = keep_from - PAGE_SIZE;
+    records_.erase(records_.begin(), records_.begin() + dropped);
+    for (pair<uint64_t, uint64_t>& record : records_) {
+        record.second -= shift;
+    }
+    log_end_ -= shift;
+    size_ = log_end_ + buffer_.size();
+    return true;
+}
+
+uint64_t LogManager::flushedLsn() {
+    lock_guard<mutex> lock(mutex_);
+    return flushed_lsn_;
+}
+
+uint64_t LogManager::lastLsn() {
+    lock_guard<mutex> lock(mutex_);
+    return next_lsn_ - 1;
+}
+
+void LogManager::writeHeader(FileManager& file, uint64_t first_lsn) {
+    Page header(true);
+    header.writeUint32(0, LOG_MAGIC);
+    header.writeUint64(8, first_lsn);
+    file.writePage(0, header);
+}
+
+void LogManager::syncDirectory() {
+    size_t slash = filename_.rfind('/');
+    string directory = slash == string::npos ? "." : (slash == 0 ? "/" : filename_.substr(0, slash));
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+}
+
+uint32_t LogManager::checksum(const char* data, size_t size) {
+    // FNV-1a, enough to tell a torn or half-written record from a whole one
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
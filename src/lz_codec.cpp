@@ -0,0 +1,166 @@
+#include "lz_codec.h"
+#include <cstring>
+
+static constexpr size_t MIN_MATCH = 4;
+static constexpr size_t MAX_OFFSET = 65535;
+static constexpr uint32_t HASH_BITS = 12;
+static constexpr size_t LAST_LITERALS = 5;  // never start a match this close to the end
+
+static uint32_t load32(const uint8_t* p) {
+    uint32_t value;
+    memcpy(&value, p, 4);
+    return value;
+}
+
+static uint64_t load64(const uint8_t* p) {
+    uint64_t value;
+    memcpy(&value, p, 8);
+    return value;
+}
+
+static uint32_t hashPrefix(uint32_t prefix) {
+    return (prefix * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// 4 bits in the token, the rest as 255-bytes and a remainder
+static bool putLength(uint8_t*& out, const uint8_t* end, size_t length) {
+    while (length >= 255) {
+        if (out >= end) return false;
+        *out++ = 255;
+        length -= 255;
+    }
+    if (out >= end) return false;
+    *out++ = static_cast<uint8_t>(length);
+    return true;
+}
+
+// literals [literal, literal + literal_count), then a match (match_length 0 = last sequence, no match)
+static bool putSequence(uint8_t*& out, const uint8_t* end, const uint8_t* literal, size_t literal_count,
+                        size_t offset, size_t match_length) {
+    if (out >= end) return false;
+    uint8_t* token = out++;
+    size_t match_code = match_length > 0 ? match_length - MIN_MATCH : 0;
+    *token = static_cast<uint8_t>((literal_count < 15 ? literal_count : 15) << 4 | (match_code < 15 ? match_code : 15));
+
+    if (literal_count >= 15 && !putLength(out, end, literal_count - 15)) return false;
+    if (static_cast<size_t>(end - out) < literal_count) return false;
+    memcpy(out, literal, literal_count);
+    out += literal_count;
+
+    if (match_length == 0) {
+        return true;
+    }
+    if (end - out < 2) return false;
+    *out++ = static_cast<uint8_t>(offset);
+    *out++ = static_cast<uint8_t>(offset >> 8);
+    return match_code < 15 || putLength(out, end, match_code - 15);
+}
+
+size_t lzCompress(const char* src, size_t size, char* dst, size_t capacity) {
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+    const uint8_t* out_end = out + capacity;
+
+    // positions + 1, 0 = empty
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    size_t anchor = 0;
+    size_t pos = 0;
+    size_t match_limit = size > LAST_LITERALS + MIN_MATCH ? size - LAST_LITERALS : 0;
+    while (pos + MIN_MATCH <= match_limit) {
+        uint32_t prefix = load32(in + pos);
+        uint32_t h = hashPrefix(prefix);
+        size_t candidate = table[h];
+        table[h] = static_cast<uint32_t>(pos + 1);
+        if (candidate == 0 || pos - (candidate - 1) > MAX_OFFSET || load32(in + candidate - 1) != prefix) {
+            // skip faster through data that doesn't match (the longer since the last match, the bigger the step)
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+        size_t ref = candidate - 1;
+
+        // extend 8 bytes at a time, the first differing byte is the lowest set bit of the xor
+        // (after a mismatch the byte loop stops right away, otherwise it finishes the tail)
+        size_t length = MIN_MATCH;
+        while (pos + length + 8 <= size) {
+            uint64_t diff = load64(in + pos + length) ^ load64(in + ref + length);
+            if (diff != 0) {
+                length += __builtin_ctzll(diff) / 8;
+                break;
+            }
+            length += 8;
+        }
+        while (pos + length < size && in[pos + length] == in[ref + length]) {
+            length++;
+        }
+        if (!putSequence(out, out_end, in + anchor, pos - anchor, pos - ref, length)) {
+            return 0;
+        }
+        pos += length;
+        anchor = pos;
+    }
+
+    if (!putSequence(out, out_end, in + anchor, size - anchor, 0, 0)) {
+        return 0;
+    }
+    return out - reinterpret_cast<uint8_t*>(dst);
+}
+
+// extra length bytes after a nibble of 15, false if the stream ends first
+static bool getLength(const uint8_t*& in, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (in >= end) return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool lzDecompress(const char* src, size_t size, char* dst, size_t out_size) {
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    const uint8_t* in_end = in + size;
+    uint8_t* out = reinterpret_cast<uint8_t*>(dst);
+    uint8_t* out_start = out;
+    uint8_t* out_end = out + out_size;
+
+    while (in < in_end) {
+        uint8_t token = *in++;
+
+        size_t literal_count = token >> 4;
+        if (literal_count == 15 && !getLength(in, in_end, literal_count)) return false;
+        if (static_cast<size_t>(in_end - in) < literal_count || static_cast<size_t>(out_end - out) < literal_count) {
+            return false;
+        }
+        memcpy(out, in, literal_count);
+        in += literal_count;
+        out += literal_count;
+
+        if (in == in_end) {
+            break;  // last sequence
+        }
+
+        if (in_end - in < 2) return false;
+        size_t offset = in[0] | static_cast<size_t>(in[1]) << 8;
+        in += 2;
+        size_t length = token & 15;
+        if (length == 15 && !getLength(in, in_end, length)) return false;
+        length += MIN_MATCH;
+        if (offset == 0 || offset > static_cast<size_t>(out - out_start) || static_cast<size_t>(out_end - out) < length) {
+            return false;
+        }
+
+        // an offset shorter than the match repeats the bytes just written, so those go one at a time
+        const uint8_t* from = out - offset;
+        if (offset >= length) {
+            memcpy(out, from, length);
+            out += length;
+        } else {
+            for (size_t i = 0; i < length; i++) {
+                *out++ = from[i];
+            }
+        }
+    }
+    return out == out_end;
+}
@@ -0,0 +1,117 @@
+#include "mapped_file.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile(const string& filename) : filename_(filename), fd_(-1), current_(nullptr), pattern_(AccessPattern::Random) {
+    fd_ = ::open(filename_.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        return;
+    }
+    remap();
+}
+
+MappedFile::~MappedFile() {
+    for (Mapping* mapping : mappings_) {
+        munmap(mapping->base, mapping->capacity);
+        delete mapping;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+const Page* MappedFile::page(uint32_t page_id) {
+    uint64_t end = (static_cast<uint64_t>(page_id) + 1) * PAGE_SIZE;
+
+    // fast path, no syscall
+    Mapping* mapping = current_.load(memory_order_acquire);
+    if (mapping && end <= mapping->length) {
+        return reinterpret_cast<const Page*>(mapping->base + end - PAGE_SIZE);
+    }
+
+    // past the mapping, the file may have grown since we mapped it
+    mapping = remap();
+    if (mapping && end <= mapping->length) {
+        return reinterpret_cast<const Page*>(mapping->base + end - PAGE_SIZE);
+    }
+    return nullptr;
+}
+
+uint64_t MappedFile::size() const {
+    Mapping* mapping = current_.load(memory_order_acquire);
+    return mapping ? mapping->length.load(memory_order_acquire) : 0;
+}
+
+void MappedFile::advise(AccessPattern pattern) {
+    lock_guard<mutex> lock(remap_mutex_);
+    pattern_ = pattern;
+    Mapping* mapping = current_.load(memory_order_acquire);
+    if (mapping) {
+        applyAdvice(mapping);
+    }
+}
+
+void MappedFile::willNeed(uint32_t first_page_id, uint32_t count) {
+    Mapping* mapping = current_.load(memory_order_acquire);
+    if (!mapping) {
+        return;
+    }
+    uint64_t mapped = mapping->length;
+    uint64_t begin = static_cast<uint64_t>(first_page_id) * PAGE_SIZE;
+    if (begin >= mapped) {
+        return;
+    }
+    uint64_t length = static_cast<uint64_t>(count) * PAGE_SIZE;
+    if (begin + length > mapped) {
+        length = mapped - begin;
+    }
+    madvise(mapping->base + begin, length, MADV_WILLNEED);
+}
+
+MappedFile::Mapping* MappedFile::remap() {
+    lock_guard<mutex> lock(remap_mutex_);
+    Mapping* mapping = current_.load(memory_order_acquire);
+
+    struct stat st;
+    if (fd_ < 0 || fstat(fd_, &st) != 0) {
+        return mapping;
+    }
+
+    // only whole pages are served, a torn tail page would show up as garbage
+    uint64_t length = (static_cast<uint64_t>(st.st_size) / PAGE_SIZE) * PAGE_SIZE;
+    if (length == 0 || (mapping && length <= mapping->length)) {
+        return mapping;
+    }
+
+    // still inside the reservation: the shared mapping sees the new pages already, just hand them out
+    if (mapping && length <= mapping->capacity) {
+        mapping->length.store(length, memory_order_release);
+        return mapping;
+    }
+
+    // reserve at least twice the last mapping, the part past end of file fills in as the file grows
+    uint64_t capacity = mapping && mapping->capacity * 2 > length ? mapping->capacity * 2 : length;
+    void* base = mmap(nullptr, capacity, PROT_READ, MAP_SHARED, fd_, 0);
+    if (base == MAP_FAILED) {
+        return mapping;
+    }
+
+    // the old mapping stays alive, callers may still hold pointers into it
+    Mapping* grown = new Mapping(static_cast<char*>(base), capacity, length);
+    applyAdvice(grown);
+    mappings_.push_back(grown);
+    current_.store(grown, memory_order_release);
+    return grown;
+}
+
+void MappedFile::applyAdvice(Mapping* mapping) {
+    int advice = MADV_NORMAL;
+    if (pattern_ == AccessPattern::Random) {
+        advice = MADV_RANDOM;
+    } else if (pattern_ == AccessPattern::Sequential) {
+        advice = MADV_SEQUENTIAL;
+    }
+    madvise(mapping->base, mapping->capacity, advice);
+}
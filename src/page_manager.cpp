@@ -1,28 +1,576 @@
-#include "page_manager.h"
-
-using namespace std;
-
-PageManager::PageManager(const string& filename) : file_manager_(filename) {
-    uint64_t file_size = file_manager_.size();
-    next_page_id_ = file_size / PAGE_SIZE;
-}
-
-PageManager::~PageManager() {}
-
-uint32_t PageManager::allocatePage() {
-    uint32_t new_page_id = next_page_id_;
-    next_page_id_++;
-    return new_page_id;
-}
-
-void PageManager::readPage(uint32_t page_id, Page& page) {
-    file_manager_.readPage(page_id, page);
-}
-
-void PageManager::writePage(uint32_t page_id, const Page& page) {
-    file_manager_.writePage(page_id, page);
-}
-
-void PageManager::freePage(uint32_t page_id) {
-
-}
\ No newline at end of file
+#include "page_manager.h"
+#include "lz_codec.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+// free map sidecar: page 0 is a header, the bitmap follows from page 1
+// header: magic, number of pages the bitmap covers, checksum of the bitmap pages
+static constexpr uint32_t FREE_SPACE_MAGIC = 0x46534D31;  // "FSM1"
+static constexpr uint32_t BITS_PER_PAGE = PAGE_SIZE * 8;
+
+// page map sidecar: one u64 slot per page id, then a trailer: magic, checksum of the slots, page count
+static constexpr uint32_t PAGE_MAP_MAGIC = 0x31504D50;  // "PMP1"
+static constexpr size_t PAGE_MAP_TRAILER = 16;
+
+// a compressed slot starts with the length of the compressed data
+static constexpr size_t SLOT_HEADER = 4;
+
+// FNV-1a, tells a torn sidecar from a whole one
+static uint32_t sidecarChecksum(const char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+PageManager::PageManager(const string& filename, OpenMode mode)
+    : compressed_(usesCompression(filename, mode)), read_only_(mode == OpenMode::ReadOnlyMmap),
+      file_manager_(filename, read_only_, mode == OpenMode::ReadWriteDirect && !compressed_), free_hint_(0), free_count_(0),
+      end_sector_(0), stored_sectors_(0), page_map_filename_(filename + ".map") {
+    uint64_t file_size = file_manager_.size();
+    next_page_id_ = file_size / PAGE_SIZE;
+
+    if (compressed_) {
+        // a new file gets its (empty) map right away, the map is what marks the file compressed
+        if (!loadPageMap() && file_size == 0) {
+            savePageMap();
+        }
+        next_page_id_ = static_cast<uint32_t>(slots_.size());
+    }
+
+    if (mode == OpenMode::ReadOnlyMmap) {
+        // slots can't be served from a mapping, a compressed file is read through the slot map instead
+        if (!compressed_) {
+            mapped_file_.reset(new MappedFile(filename));
+        }
+    } else {
+        free_space_file_.reset(new FileManager(filename + ".fsm"));
+        loadFreeSpace();
+    }
+}
+
+PageManager::~PageManager() {
+    if (compressed_) {
+        savePageMap();
+    }
+    saveFreeSpace();
+}
+
+bool PageManager::usesCompression(const string& filename, OpenMode mode) {
+    struct stat st;
+    if (stat((filename + ".map").c_str(), &st) == 0) {
+        return true;
+    }
+    return mode == OpenMode::ReadWriteCompressed && (stat(filename.c_str(), &st) != 0 || st.st_size == 0);
+}
+
+uint32_t PageManager::allocatePage(bool reuse_freed) {
+    // freed pages first (lowest first, keeps the file dense at the front), so the file stops growing
+    // once deletes keep up with inserts
+    if (reuse_freed && free_count_ > 0) {
+        lock_guard<mutex> lock(free_mutex_);
+        for (size_t word = free_hint_; word < free_bits_.size(); word++) {
+            if (free_bits_[word] == 0) continue;
+            uint32_t page_id = static_cast<uint32_t>(word * 64 + __builtin_ctzll(free_bits_[word]));
+            clearFree(page_id);
+            free_hint_ = word;
+            return page_id;
+        }
+        free_hint_ = free_bits_.size();
+    }
+
+    uint32_t new_page_id = next_page_id_.fetch_add(1);
+    return new_page_id;
+}
+
+uint32_t PageManager::allocateExtent(uint32_t count, bool reuse_freed) {
+    if (count <= 1) {
+        return allocatePage(reuse_freed);
+    }
+
+    // first run of count free pages, whole empty words skipped at once
+    if (reuse_freed && free_count_ >= count) {
+        lock_guard<mutex> lock(free_mutex_);
+        uint32_t run_start = 0;
+        uint32_t run_length = 0;
+        uint64_t end = static_cast<uint64_t>(free_bits_.size()) * 64;
+        for (uint64_t page = static_cast<uint64_t>(free_hint_) * 64; page < end; page++) {
+            if ((page & 63) == 0 && free_bits_[page / 64] == 0) {
+                run_length = 0;
+                page += 63;
+                continue;
+            }
+            if (!isFree(static_cast<uint32_t>(page))) {
+                run_length = 0;
+                continue;
+            }
+            if (run_length++ == 0) {
+                run_start = static_cast<uint32_t>(page);
+            }
+            if (run_length == count) {
+                for (uint32_t i = 0; i < count; i++) {
+                    clearFree(run_start + i);
+                }
+                return run_start;
+            }
+        }
+    }
+
+    return next_page_id_.fetch_add(count);
+}
+
+void PageManager::markAllocated(uint32_t page_id) {
+    uint32_t current = next_page_id_;
+    while (current <= page_id && !next_page_id_.compare_exchange_weak(current, page_id + 1)) {
+    }
+
+    // a page written by recovery is in use again even if the saved map still has it free
+    if (free_count_ > 0) {
+        lock_guard<mutex> lock(free_mutex_);
+        if (isFree(page_id)) {
+            clearFree(page_id);
+        }
+    }
+}
+
+void PageManager::readPage(uint32_t page_id, Page& page) {
+    if (mapped_file_) {
+        const Page* mapped = mapped_file_->page(page_id);
+        if (mapped) {
+            page = *mapped;
+        } else {
+            page.clear();
+        }
+        return;
+    }
+    if (compressed_) {
+        readCompressed(page_id, page);
+        return;
+    }
+    file_manager_.readPage(page_id, page);
+}
+
+const Page* PageManager::mappedPage(uint32_t page_id) {
+    if (!mapped_file_) {
+        return nullptr;
+    }
+    return mapped_file_->page(page_id);
+}
+
+void PageManager::adviseAccess(AccessPattern pattern) {
+    if (mapped_file_) {
+        mapped_file_->advise(pattern);
+    }
+}
+
+void PageManager::adviseWillNeed(uint32_t first_page_id, uint32_t count) {
+    if (mapped_file_) {
+        mapped_file_->willNeed(first_page_id, count);
+        return;
+    }
+    if (compressed_) {
+        // one hint per run of slots that sit next to each other on disk
+        vector<pair<uint64_t, uint64_t>> runs;
+        {
+            lock_guard<mutex> lock(slot_mutex_);
+            for (uint64_t page_id = first_page_id; page_id < slots_.size() && page_id < first_page_id + static_cast<uint64_t>(count); page_id++) {
+                uint64_t slot = slots_[page_id];
+                if (slot == 0) continue;
+                uint64_t sector = slot >> 4;
+                if (runs.empty() || runs.back().second != sector) {
+                    runs.push_back({sector, sector});
+                }
+                runs.back().second = sector + (slot & 15);
+            }
+        }
+        for (const pair<uint64_t, uint64_t>& run : runs) {
+            file_manager_.adviseWillNeed(run.first * SLOT_SECTOR_SIZE, (run.second - run.first) * SLOT_SECTOR_SIZE);
+        }
+        return;
+    }
+    file_manager_.adviseWillNeed(static_cast<uint64_t>(first_page_id) * PAGE_SIZE, static_cast<uint64_t>(count) * PAGE_SIZE);
+}
+
+uint32_t PageManager::pageCount() {
+    if (compressed_) {
+        lock_guard<mutex> lock(slot_mutex_);
+        return static_cast<uint32_t>(slots_.size());
+    }
+    uint64_t size = mapped_file_ ? mapped_file_->size() : file_manager_.size();
+    return static_cast<uint32_t>((size + PAGE_SIZE - 1) / PAGE_SIZE);
+}
+
+uint64_t PageManager::storedBytes() {
+    if (compressed_) {
+        lock_guard<mutex> lock(slot_mutex_);
+        return stored_sectors_ * SLOT_SECTOR_SIZE;
+    }
+    return mapped_file_ ? mapped_file_->size() : file_manager_.size();
+}
+
+void PageManager::writePage(uint32_t page_id, const Page& page) {
+    if (compressed_) {
+        writeCompressed(page_id, page);
+        return;
+    }
+    file_manager_.writePage(page_id, page);
+}
+
+// compressed mode: consecutive page ids don't mean consecutive slots, so runs and batches go one page at a time
+void PageManager::writePages(uint32_t first_page_id, const Page* const* pages, size_t count) {
+    if (compressed_) {
+        for (size_t i = 0; i < count; i++) {
+            writeCompressed(first_page_id + static_cast<uint32_t>(i), *pages[i]);
+        }
+        return;
+    }
+    file_manager_.writePages(first_page_id, pages, count);
+}
+
+void PageManager::readPageBatch(const uint32_t* page_ids, Page* const* pages, size_t count, uint8_t* failed) {
+    if (mapped_file_ || compressed_) {
+        for (size_t i = 0; i < count; i++) {
+            readPage(page_ids[i], *pages[i]);
+        }
+        if (failed) {
+            memset(failed, 0, count);
+        }
+        return;
+    }
+    file_manager_.readPageBatch(page_ids, pages, count, failed);
+}
+
+void PageManager::writePageBatch(const uint32_t* page_ids, const Page* const* pages, size_t count) {
+    if (compressed_) {
+        for (size_t i = 0; i < count; i++) {
+            writeCompressed(page_ids[i], *pages[i]);
+        }
+        return;
+    }
+    file_manager_.writePageBatch(page_ids, pages, count);
+}
+
+void PageManager::sync() {
+    if (compressed_) {
+        savePageMap();  // syncs the pages itself, before the map goes out
+        return;
+    }
+    file_manager_.sync();
+}
+
+void PageManager::freePage(uint32_t page_id, uint64_t lsn) {
+    // page 0 belongs to the client (tree root, store metadata), pages past the end were never handed out
+    if (page_id == 0 || page_id >= next_page_id_) {
+        return;
+    }
+    lock_guard<mutex> lock(free_mutex_);
+    if (isFree(page_id)) {
+        return;  // freed twice
+    }
+    setFree(page_id);
+    if (lsn > 0) {
+        pending_frees_.push_back({page_id, lsn});
+    }
+}
+
+size_t PageManager::freePageCount() {
+    return free_count_;
+}
+
+bool PageManager::pageIsFree(uint32_t page_id) {
+    if (free_count_ == 0) {
+        return false;
+    }
+    lock_guard<mutex> lock(free_mutex_);
+    return isFree(page_id);
+}
+
+void PageManager::setFree(uint32_t page_id) {
+    size_t word = page_id / 64;
+    if (word >= free_bits_.size()) {
+        free_bits_.resize(word + 1, 0);
+    }
+    free_bits_[word] |= uint64_t(1) << (page_id % 64);
+    if (word < free_hint_) {
+        free_hint_ = word;
+    }
+    free_count_++;
+}
+
+void PageManager::clearFree(uint32_t page_id) {
+    free_bits_[page_id / 64] &= ~(uint64_t(1) << (page_id % 64));
+    free_count_--;
+}
+
+bool PageManager::isFree(uint32_t page_id) const {
+    size_t word = page_id / 64;
+    return word < free_bits_.size() && (free_bits_[word] >> (page_id % 64)) & 1;
+}
+
+void PageManager::saveFreeSpace(uint64_t durable_lsn) {
+    if (!free_space_file_) {
+        return;
+    }
+    lock_guard<mutex> save_lock(save_mutex_);
+
+    // snapshot the map; frees whose log record isn't durable yet stay out of it (and stay pending)
+    uint32_t page_count = next_page_id_;
+    size_t bitmap_pages = (static_cast<size_t>(page_count) + BITS_PER_PAGE - 1) / BITS_PER_PAGE;
+    vector<Page> pages(bitmap_pages + 1);
+    for (Page& page : pages) {
+        page.clear();
+    }
+    {
+        lock_guard<mutex> lock(free_mutex_);
+        vector<uint64_t> bits(free_bits_);
+        size_t kept = 0;
+        for (const pair<uint32_t, uint64_t>& pending : pending_frees_) {
+            if (pending.second <= durable_lsn) continue;
+            bits[pending.first / 64] &= ~(uint64_t(1) << (pending.first % 64));
+            pending_frees_[kept++] = pending;
+        }
+        pending_frees_.resize(kept);
+
+        size_t words = min(bits.size(), bitmap_pages * (PAGE_SIZE / 8));
+        for (size_t word = 0; word < words; word++) {
+            pages[1 + word / (PAGE_SIZE / 8)].writeUint64((word % (PAGE_SIZE / 8)) * 8, bits[word]);
+        }
+    }
+
+    // bitmap first, header (with the checksum) last; a crash in between fails the checksum on open
+    string bitmap;
+    bitmap.reserve(bitmap_pages * PAGE_SIZE);
+    vector<const Page*> bitmap_ptrs;
+    for (size_t i = 1; i < pages.size(); i++) {
+        bitmap.append(pages[i].data, PAGE_SIZE);
+        bitmap_ptrs.push_back(&pages[i]);
+    }
+    if (!bitmap_ptrs.empty()) {
+        free_space_file_->writePages(1, bitmap_ptrs.data(), bitmap_ptrs.size());
+    }
+    pages[0].writeUint32(0, FREE_SPACE_MAGIC);
+    pages[0].writeUint32(4, page_count);
+    pages[0].writeUint32(8, sidecarChecksum(bitmap.data(), bitmap.size()));
+    free_space_file_->writePage(0, pages[0]);
+    free_space_file_->truncate((bitmap_pages + 1) * PAGE_SIZE);
+    free_space_file_->sync();
+}
+
+void PageManager::loadFreeSpace() {
+    if (free_space_file_->size() < PAGE_SIZE) {
+        return;
+    }
+    Page header;
+    free_space_file_->readPage(0, header);
+    if (header.readUint32(0) != FREE_SPACE_MAGIC) {
+        return;
+    }
+    uint32_t page_count = header.readUint32(4);
+    size_t bitmap_pages = (static_cast<size_t>(page_count) + BITS_PER_PAGE - 1) / BITS_PER_PAGE;
+    string bitmap = free_space_file_->read(PAGE_SIZE, bitmap_pages * PAGE_SIZE);
+    if (bitmap.size() != bitmap_pages * PAGE_SIZE ||
+        sidecarChecksum(bitmap.data(), bitmap.size()) != header.readUint32(8)) {
+        return;
+    }
+
+    // only pages that still exist (the file may have been cut short since), never page 0
+    uint32_t limit = min(page_count, static_cast<uint32_t>(next_page_id_));
+    lock_guard<mutex> lock(free_mutex_);
+    for (uint32_t word = 0; word * 64 < limit; word++) {
+        uint64_t bits;
+        memcpy(&bits, bitmap.data() + word * 8, 8);
+        while (bits != 0) {
+            uint32_t page_id = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (page_id == 0 || page_id >= limit) continue;
+            setFree(page_id);
+        }
+    }
+}
+uint64_t PageManager::takeSlot(uint32_t sectors) {
+    if (!free_slots_[sectors].empty()) {
+        uint64_t sector = free_slots_[sectors].back();
+        free_slots_[sectors].pop_back();
+        return sector;
+    }
+    for (uint32_t longer = sectors + 1; longer <= SLOT_MAX_SECTORS; longer++) {
+        if (free_slots_[longer].empty()) continue;
+        uint64_t sector = free_slots_[longer].back();
+        free_slots_[longer].pop_back();
+        free_slots_[longer - sectors].push_back(sector + sectors);
+        return sector;
+    }
+    uint64_t sector = end_sector_;
+    end_sector_ += sectors;
+    return sector;
+}
+
+void PageManager::readCompressed(uint32_t page_id, Page& page) {
+    uint64_t slot = 0;
+    {
+        lock_guard<mutex> lock(slot_mutex_);
+        if (page_id < slots_.size()) {
+            slot = slots_[page_id];
+        }
+    }
+    uint32_t sectors = static_cast<uint32_t>(slot & 15);
+    uint64_t position = (slot >> 4) * SLOT_SECTOR_SIZE;
+    if (sectors == 0) {
+        page.clear();  // never written
+        return;
+    }
+    if (sectors == SLOT_MAX_SECTORS) {
+        file_manager_.readAt(position, page.data, PAGE_SIZE);  // stored raw
+        return;
+    }
+
+    char buffer[PAGE_SIZE];
+    file_manager_.readAt(position, buffer, sectors * SLOT_SECTOR_SIZE);
+    uint32_t length;
+    memcpy(&length, buffer, SLOT_HEADER);
+    // slots are never overwritten, so this only fails on a damaged file; it reads as an empty page then,
+    // like a page past end of file
+    if (length > sectors * SLOT_SECTOR_SIZE - SLOT_HEADER || !lzDecompress(buffer + SLOT_HEADER, length, page.data, PAGE_SIZE)) {
+        page.clear();
+    }
+}
+
+void PageManager::writeCompressed(uint32_t page_id, const Page& page) {
+    if (read_only_) {
+        return;
+    }
+
+    // compressing has to save at least a sector, otherwise the page goes out raw in a full-size slot
+    char buffer[PAGE_SIZE];
+    size_t length = lzCompress(page.data, PAGE_SIZE, buffer + SLOT_HEADER, PAGE_SIZE - SLOT_SECTOR_SIZE - SLOT_HEADER);
+    const char* data = page.data;
+    size_t size = PAGE_SIZE;
+    if (length > 0) {
+        uint32_t stored_length = static_cast<uint32_t>(length);
+        memcpy(buffer, &stored_length, SLOT_HEADER);
+        data = buffer;
+        size = length + SLOT_HEADER;
+    }
+    uint32_t sectors = static_cast<uint32_t>((size + SLOT_SECTOR_SIZE - 1) / SLOT_SECTOR_SIZE);
+
+    // fill a new slot and only then point the map at it; the old slot is what the saved map may point at,
+    // overwriting it in place would leave a torn slot behind a crash
+    uint64_t sector;
+    {
+        lock_guard<mutex> lock(slot_mutex_);
+        sector = takeSlot(sectors);
+    }
+    file_manager_.writeAt(sector * SLOT_SECTOR_SIZE, data, size);
+
+    lock_guard<mutex> lock(slot_mutex_);
+    if (page_id >= slots_.size()) {
+        slots_.resize(page_id + 1, 0);
+    }
+    uint64_t current = slots_[page_id];
+    if (current != 0) {
+        moved_slots_.push_back(current);
+        stored_sectors_ -= current & 15;
+    }
+    slots_[page_id] = sector << 4 | sectors;
+    stored_sectors_ += sectors;
+}
+
+void PageManager::savePageMap() {
+    if (read_only_) {
+        return;
+    }
+    lock_guard<mutex> save_lock(save_mutex_);
+
+    // take the map, then sync: every slot in it was filled before the map pointed at it, so it is on disk
+    // before the map is
+    string map;
+    size_t moved;
+    {
+        lock_guard<mutex> lock(slot_mutex_);
+        map.reserve(slots_.size() * 8 + PAGE_MAP_TRAILER);
+        map.assign(reinterpret_cast<const char*>(slots_.data()), slots_.size() * 8);
+        moved = moved_slots_.size();
+    }
+    file_manager_.sync();
+
+    uint32_t checksum = sidecarChecksum(map.data(), map.size());
+    uint64_t page_count = map.size() / 8;
+    map.append(reinterpret_cast<const char*>(&PAGE_MAP_MAGIC), 4);
+    map.append(reinterpret_cast<const char*>(&checksum), 4);
+    map.append(reinterpret_cast<const char*>(&page_count), 8);
+
+    // written to a temp file and renamed over the old map, a crash leaves one or the other whole
+    string temp_filename = page_map_filename_ + ".tmp";
+    std::remove(temp_filename.c_str());
+    {
+        FileManager file(temp_filename);
+        file.write(map);
+        file.sync();
+    }
+    if (std::rename(temp_filename.c_str(), page_map_filename_.c_str()) != 0) {
+        return;
+    }
+
+    // nothing on disk points at the slots pages moved out of before the map was taken any more
+    lock_guard<mutex> lock(slot_mutex_);
+    for (size_t i = 0; i < moved; i++) {
+        free_slots_[moved_slots_[i] & 15].push_back(moved_slots_[i] >> 4);
+    }
+    moved_slots_.erase(moved_slots_.begin(), moved_slots_.begin() + moved);
+}
+
+bool PageManager::loadPageMap() {
+    FileManager file(page_map_filename_, true);
+    uint64_t size = file.size();
+    if (size < PAGE_MAP_TRAILER || (size - PAGE_MAP_TRAILER) % 8 != 0) {
+        return false;
+    }
+    string map = file.read(0, size);
+    uint32_t magic;
+    uint32_t checksum;
+    uint64_t page_count;
+    memcpy(&magic, map.data() + size - PAGE_MAP_TRAILER, 4);
+    memcpy(&checksum, map.data() + size - PAGE_MAP_TRAILER + 4, 4);
+    memcpy(&page_count, map.data() + size - PAGE_MAP_TRAILER + 8, 8);
+    if (magic != PAGE_MAP_MAGIC || page_count * 8 != size - PAGE_MAP_TRAILER ||
+        sidecarChecksum(map.data(), size - PAGE_MAP_TRAILER) != checksum) {
+        return false;
+    }
+
+    vector<uint64_t> slots(page_count);
+    memcpy(slots.data(), map.data(), page_count * 8);
+
+    // slots in file order; the gaps between them (slots that were moved out of, or filled just before a crash) are free
+    vector<pair<uint64_t, uint32_t>> used;
+    uint64_t stored = 0;
+    for (uint64_t slot : slots) {
+        if (slot == 0) continue;
+        if ((slot & 15) > SLOT_MAX_SECTORS) {
+            return false;
+        }
+        used.push_back({slot >> 4, static_cast<uint32_t>(slot & 15)});
+        stored += slot & 15;
+    }
+    sort(used.begin(), used.end());
+
+    lock_guard<mutex> lock(slot_mutex_);
+    uint64_t end = 0;
+    for (const pair<uint64_t, uint32_t>& run : used) {
+        while (end < run.first) {
+            uint64_t length = min<uint64_t>(run.first - end, SLOT_MAX_SECTORS);
+            free_slots_[length].push_back(end);
+            end += length;
+        }
+        end = max(end, run.first + run.second);
+    }
+    end_sector_ = end;
+    stored_sectors_ = stored;
+    slots_ = move(slots);
+    return true;
+}
@@ -0,0 +1,79 @@
+#include "bplus_tree.h"
+#include "buffer_pool.h"
+#include "page_manager.h"
+#include "test_util.h"
+#include <atomic>
+#include <random>
+#include <thread>
+
+// BPlusTree throughput from 1 to 32 threads on a preloaded tree
+// read-heavy: 95% search, 5% insert; mixed: 50% search, 50% insert
+// searches pick preloaded keys, inserts add new keys spread over the whole key range (splits everywhere)
+// usage: bplus_tree_concurrency_bench [scale], scale multiplies the tree size and operation counts
+
+static string benchKey(uint64_t n) {
+    return numberedKey(n, "user/");
+}
+
+static double run(BPlusTree& tree, uint64_t preloaded, int threads, size_t operations, int insert_percent,
+                  atomic<uint64_t>& next_insert) {
+    vector<thread> workers;
+    Stopwatch watch;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            mt19937_64 rng(t * 31 + insert_percent);
+            size_t count = operations / threads;
+            for (size_t i = 0; i < count; i++) {
+                if (static_cast<int>(rng() % 100) < insert_percent) {
+                    // odd numbers were never preloaded
+                    uint64_t n = next_insert++ * 2 + 1;
+                    tree.insert(benchKey(n * 7919 % (preloaded * 2)), n);
+                } else {
+                    tree.search(benchKey(rng() % preloaded * 2));
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return operations / watch.seconds();
+}
+
+int main(int argc, char** argv) {
+    double scale = benchScale(argc, argv);
+    uint64_t preloaded = static_cast<uint64_t>(1000000 * scale);
+    size_t operations = static_cast<size_t>(1000000 * scale);
+    const string filename = "bplus_tree_bench.db";
+    removeDatabase(filename);
+
+    PageManager pm(filename);
+    BufferPool bp(&pm, 16384, 16);  // 64MB, the tree stays cached
+    BPlusTree tree(&bp, &pm);
+    vector<pair<string, uint64_t>> batch;
+    for (uint64_t n = 0; n < preloaded; n++) {
+        batch.push_back({benchKey(n * 2), n + 1});
+    }
+    Stopwatch load;
+    tree.insertBatch(batch);
+    cout << "preloaded " << preloaded << " keys in " << load.seconds() << "s, hardware threads: "
+         << thread::hardware_concurrency() << endl;
+
+    atomic<uint64_t> next_insert(0);
+    cout << "threads   read-heavy Kops/s  speedup   mixed Kops/s  speedup" << endl;
+    double read_base = 0;
+    double mixed_base = 0;
+    for (int threads : {1, 2, 4, 8, 16, 32}) {
+        double read_heavy = run(tree, preloaded, threads, operations, 5, next_insert);
+        double mixed = run(tree, preloaded, threads, operations, 50, next_insert);
+        if (threads == 1) {
+            read_base = read_heavy;
+            mixed_base = mixed;
+        }
+        printf("%7d   %17.1f  %6.2fx   %12.1f  %6.2fx\n", threads, read_heavy / 1e3, read_heavy / read_base,
+               mixed / 1e3, mixed / mixed_base);
+    }
+
+    removeDatabase(filename);
+    return 0;
+}
@@ -0,0 +1,178 @@
+#include "bplus_tree.h"
+#include "buffer_pool.h"
+#include "page_manager.h"
+#include "test_util.h"
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
+
+// concurrent inserts and searches on one tree, checked against a reference map
+// writers own every WRITERS-th key id, insert their keys in random order (splits all over the tree) and now and
+// then replace one of their churn keys (remove + insert, the tree keeps duplicates); each keeps the reference
+// map of its own keys and checks its own reads exactly. readers pick keys a writer already finished with
+// (churn keys aside, they're briefly gone while replaced) and check their values, and look for keys nobody
+// inserts. at the end the tree must equal the merged reference maps, in order
+// run with a page-sized order (the OLC fast path) and a small order (deep tree, splits on most inserts)
+
+static constexpr int WRITERS = 8;
+static constexpr int READERS = 4;
+static constexpr uint32_t KEYS_PER_WRITER = 6000;
+static constexpr uint32_t TOTAL_KEYS = WRITERS * KEYS_PER_WRITER;
+
+static string treeKey(uint32_t id) {
+    // hierarchical keys share prefixes, like real ones
+    return numberedKey(id, id % 3 == 0 ? "tenant-a/orders/" : "tenant-b/events/");
+}
+
+static uint64_t treeValue(uint32_t id, uint32_t version) {
+    return (static_cast<uint64_t>(id) << 16 | version) + 1;
+}
+
+// one key in 16 may be replaced
+static bool churnKey(uint32_t id) {
+    return (id / WRITERS) % 16 == 15;
+}
+
+static bool runStress(int order) {
+    const string filename = "bplus_tree_stress.db";
+    removeDatabase(filename);
+    PageManager pm(filename);
+    BufferPool bp(&pm, 256, 8);
+    BPlusTree tree(&bp, &pm, order);
+
+    // order[w][i]: id of writer w's i-th insert, done[w]: how many of them finished
+    vector<vector<uint32_t>> insert_order(WRITERS);
+    atomic<uint32_t> done[WRITERS];
+    for (int w = 0; w < WRITERS; w++) {
+        for (uint32_t i = 0; i < KEYS_PER_WRITER; i++) {
+            insert_order[w].push_back(i * WRITERS + w);
+        }
+        shuffle(insert_order[w].begin(), insert_order[w].end(), mt19937(w));
+        done[w] = 0;
+    }
+
+    vector<map<string, uint64_t>> references(WRITERS);
+    atomic<int> errors(0);
+    atomic<bool> writing(true);
+    vector<thread> threads;
+    for (int w = 0; w < WRITERS; w++) {
+        threads.emplace_back([&, w] {
+            mt19937 rng(w + 100);
+            map<string, uint64_t>& reference = references[w];
+            for (uint32_t i = 0; i < KEYS_PER_WRITER && errors == 0; i++) {
+                uint32_t id = insert_order[w][i];
+                string key = treeKey(id);
+                tree.insert(key, treeValue(id, 0));
+                reference[key] = treeValue(id, 0);
+                done[w].store(i + 1, memory_order_release);
+                if (tree.search(key) != reference[key]) {
+                    cout << "FAIL: writer " << w << " can't read back " << key << endl;
+                    errors++;
+                }
+
+                // replace an earlier churn key of ours
+                uint32_t earlier = insert_order[w][rng() % (i + 1)];
+                if (i % 2 == 1 && churnKey(earlier)) {
+                    string earlier_key = treeKey(earlier);
+                    uint64_t value = treeValue(earlier, i);
+                    if (!tree.remove(earlier_key)) {
+                        cout << "FAIL: writer " << w << " can't remove " << earlier_key << endl;
+                        errors++;
+                    }
+                    tree.insert(earlier_key, value);
+                    reference[earlier_key] = value;
+                    if (tree.search(earlier_key) != value) {
+                        cout << "FAIL: writer " << w << " lost its replacement of " << earlier_key << endl;
+                        errors++;
+                    }
+                }
+            }
+        });
+    }
+    for (int r = 0; r < READERS; r++) {
+        threads.emplace_back([&, r] {
+            mt19937 rng(r + 200);
+            while (writing && errors == 0) {
+                int w = rng() % WRITERS;
+                uint32_t finished = done[w].load(memory_order_acquire);
+                uint32_t id = finished > 0 ? insert_order[w][rng() % finished] : 0;
+                if (finished > 0 && !churnKey(id) && tree.search(treeKey(id)) != treeValue(id, 0)) {
+                    cout << "FAIL: reader lost " << treeKey(id) << endl;
+                    errors++;
+                }
+                uint32_t missing = TOTAL_KEYS + rng() % TOTAL_KEYS;
+                if (tree.search(treeKey(missing)) != 0) {
+                    cout << "FAIL: reader found " << treeKey(missing) << ", never inserted" << endl;
+                    errors++;
+                }
+            }
+        });
+    }
+    for (int w = 0; w < WRITERS; w++) {
+        threads[w].join();
+    }
+    writing = false;
+    for (size_t t = WRITERS; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    if (errors > 0) {
+        return false;
+    }
+
+    // the whole tree against the merged reference, both directions and by batch lookup
+    map<string, uint64_t> reference;
+    for (const auto& part : references) {
+        reference.insert(part.begin(), part.end());
+    }
+    auto expected = reference.begin();
+    size_t count = 0;
+    for (BPlusTree::Iterator it = tree.first(); it.valid(); it.next(), ++expected, count++) {
+        if (expected == reference.end() || it.key() != expected->first || it.value() != expected->second) {
+            cout << "FAIL: entry " << count << " is " << it.key() << ", expected "
+                 << (expected == reference.end() ? string("the end") : expected->first) << endl;
+            return false;
+        }
+    }
+    if (count != reference.size()) {
+        cout << "FAIL: " << count << " entries, expected " << reference.size() << endl;
+        return false;
+    }
+    count = 0;
+    for (BPlusTree::Iterator it = tree.last(); it.valid(); it.prev()) {
+        count++;
+    }
+    if (count != reference.size()) {
+        cout << "FAIL: " << count << " entries backwards, expected " << reference.size() << endl;
+        return false;
+    }
+    vector<string> keys;
+    for (const auto& entry : reference) {
+        keys.push_back(entry.first);
+    }
+    vector<uint64_t> values = tree.searchBatch(keys);
+    size_t i = 0;
+    for (const auto& entry : reference) {
+        if (values[i++] != entry.second) {
+            cout << "FAIL: searchBatch got the wrong value for " << entry.first << endl;
+            return false;
+        }
+    }
+
+    removeDatabase(filename);
+    return true;
+}
+
+int main() {
+    for (int order : {0, 6}) {
+        Stopwatch watch;
+        if (!runStress(order)) {
+            cout << "order " << order << " failed" << endl;
+            return 1;
+        }
+        cout << "order " << order << ": " << WRITERS << " writers, " << READERS << " readers, " << TOTAL_KEYS
+             << " keys in " << watch.seconds() << "s" << endl;
+    }
+    cout << "B+ tree stress test passed" << endl;
+    return 0;
+}
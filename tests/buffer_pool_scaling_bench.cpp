@@ -0,0 +1,80 @@
+#include "buffer_pool.h"
+#include "page_manager.h"
+#include "test_util.h"
+#include <random>
+#include <thread>
+
+// BufferPool throughput from 1 to 32 threads
+// hits: the pool holds every page, 90% read guards and 10% write guards (partition latches, frame latches, pins)
+// misses: the page set is 16x the pool and stays in the OS cache, every fetch likely evicts (victim search,
+// reads outside the partition latch)
+// usage: buffer_pool_scaling_bench [scale], scale multiplies the operation counts
+
+static constexpr uint32_t HIT_PAGES = 1024;
+static constexpr uint32_t MISS_PAGES = 8192;
+static constexpr size_t MISS_POOL_FRAMES = MISS_PAGES / 16;
+
+// run operations spread over threads, returns operations per second
+static double run(BufferPool& bp, uint32_t pages, int threads, size_t operations, int write_percent) {
+    vector<thread> workers;
+    Stopwatch watch;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            mt19937 rng(t * 7919 + 1);
+            size_t count = operations / threads;
+            for (size_t i = 0; i < count; i++) {
+                uint32_t page_id = rng() % pages;
+                if (static_cast<int>(rng() % 100) < write_percent) {
+                    WritePageGuard guard = bp.fetchPageWrite(page_id);
+                    guard.page().writeUint64(8, guard.page().readUint64(8) + 1);
+                } else {
+                    ReadPageGuard guard = bp.fetchPage(page_id);
+                    volatile uint64_t sink = guard.page().readUint64(8);
+                    (void)sink;
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    return operations / watch.seconds();
+}
+
+static void fill(BufferPool& bp, uint32_t pages) {
+    for (uint32_t page_id = 0; page_id < pages; page_id++) {
+        WritePageGuard guard = bp.fetchPageWrite(page_id);
+        guard.page().writeUint32(0, page_id);
+    }
+    bp.flushAll();
+}
+
+int main(int argc, char** argv) {
+    double scale = benchScale(argc, argv);
+    size_t hit_operations = static_cast<size_t>(4000000 * scale);
+    size_t miss_operations = static_cast<size_t>(400000 * scale);
+    const string filename = "buffer_pool_bench.db";
+    removeDatabase(filename);
+
+    PageManager pm(filename);
+    BufferPool hit_pool(&pm, HIT_PAGES * 2);
+    fill(hit_pool, MISS_PAGES);
+    BufferPool miss_pool(&pm, MISS_POOL_FRAMES);
+
+    cout << "hardware threads: " << thread::hardware_concurrency() << endl;
+    cout << "threads   hits Mops/s  speedup   misses Kops/s  speedup" << endl;
+    double hit_base = 0;
+    double miss_base = 0;
+    for (int threads : {1, 2, 4, 8, 16, 32}) {
+        double hits = run(hit_pool, HIT_PAGES, threads, hit_operations, 10);
+        double misses = run(miss_pool, MISS_PAGES, threads, miss_operations, 0);
+        if (threads == 1) {
+            hit_base = hits;
+            miss_base = misses;
+        }
+        printf("%7d   %11.2f  %6.2fx   %13.1f  %6.2fx\n", threads, hits / 1e6, hits / hit_base, misses / 1e3, misses / miss_base);
+    }
+
+    removeDatabase(filename);
+    return 0;
+}
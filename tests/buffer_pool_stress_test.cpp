@@ -0,0 +1,90 @@
+#include "buffer_pool.h"
+#include "page_manager.h"
+#include "test_util.h"
+#include <atomic>
+#include <random>
+#include <thread>
+
+// many threads reading and writing through a pool much smaller than the page set, so misses, evictions of
+// dirty frames, the cleaner and flushAll all run at once
+// every page holds its own id at offset 0 and a counter at offset 8: readers check the id (a frame mixed up
+// with another page shows up there), writers bump the counter, and after a reopen every counter must match
+// the number of increments (a lost or stale writeback shows up there)
+
+static constexpr uint32_t PAGES = 512;
+static constexpr size_t POOL_FRAMES = 48;
+static constexpr size_t PARTITIONS = 4;
+static constexpr int THREADS = 8;
+static constexpr int OPERATIONS = 40000;
+
+int main() {
+    const string filename = "buffer_pool_stress.db";
+    removeDatabase(filename);
+
+    atomic<uint64_t> increments[PAGES];
+    for (auto& count : increments) {
+        count = 0;
+    }
+    atomic<int> errors(0);
+
+    {
+        PageManager pm(filename);
+        BufferPool bp(&pm, POOL_FRAMES, PARTITIONS);
+        bp.setDirtyWatermark(POOL_FRAMES / 4);  // keep the cleaner busy
+        for (uint32_t page_id = 0; page_id < PAGES; page_id++) {
+            WritePageGuard guard = bp.fetchPageWrite(page_id);
+            guard.page().writeUint32(0, page_id);
+        }
+
+        vector<thread> threads;
+        for (int t = 0; t < THREADS; t++) {
+            threads.emplace_back([&, t] {
+                mt19937 rng(t);
+                for (int i = 0; i < OPERATIONS; i++) {
+                    uint32_t page_id = rng() % PAGES;
+                    if (rng() % 4 == 0) {
+                        WritePageGuard guard = bp.fetchPageWrite(page_id);
+                        if (!guard.valid() || guard.page().readUint32(0) != page_id) {
+                            errors++;
+                            continue;
+                        }
+                        guard.page().writeUint64(8, guard.page().readUint64(8) + 1);
+                        increments[page_id]++;
+                    } else {
+                        ReadPageGuard guard = bp.fetchPage(page_id);
+                        if (!guard.valid() || guard.page().readUint32(0) != page_id) {
+                            errors++;
+                        }
+                    }
+                    if (t == 0 && i % 10000 == 0) {
+                        bp.flushAll();
+                    }
+                }
+            });
+        }
+        for (auto& th : threads) {
+            th.join();
+        }
+    }
+
+    if (errors > 0) {
+        cout << "FAIL: " << errors << " fetches returned a wrong or missing page" << endl;
+        return 1;
+    }
+
+    // everything must have reached disk through evictions, the cleaner and the final flush
+    PageManager pm(filename);
+    BufferPool bp(&pm, 16);
+    for (uint32_t page_id = 0; page_id < PAGES; page_id++) {
+        ReadPageGuard guard = bp.fetchPage(page_id);
+        if (guard.page().readUint64(8) != increments[page_id]) {
+            cout << "FAIL: page " << page_id << " counter " << guard.page().readUint64(8)
+                 << ", expected " << increments[page_id] << endl;
+            return 1;
+        }
+    }
+
+    removeDatabase(filename);
+    cout << "buffer pool stress test passed (" << THREADS << " threads, " << THREADS * OPERATIONS << " operations)" << endl;
+    return 0;
+}
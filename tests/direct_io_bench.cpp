@@ -0,0 +1,122 @@
+#include "buffer_pool.h"
+#include "page_manager.h"
+#include "test_util.h"
+#include <cstring>
+#include <fcntl.h>
+#include <random>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// buffered I/O against O_DIRECT, for a file bigger than the buffer pool
+// memory: the pool's frames plus whatever of the file the OS page cache holds once the reads are done
+// (mincore on a mapping of the file), buffered I/O keeps pages cached twice, O_DIRECT only in the pool
+// latency: p50/p99 of fetchPage over skewed random reads (90% to a hot quarter of the file), the misses are
+// where the two differ: a page cache hit for buffered I/O, the device for O_DIRECT
+// tmpfs and some other filesystems refuse O_DIRECT, the second row says so when it fell back to buffered
+// usage: direct_io_bench [scale], scale multiplies the file size (64MB at 1) and the number of reads
+
+static constexpr size_t POOL_FRACTION = 8;  // pool holds 1/8 of the file
+static constexpr double HOT_FRACTION = 0.25;
+static constexpr double HOT_READS = 0.9;
+
+// drop the file from the page cache so both modes start cold
+static void dropCache(const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+// bytes of the file in the OS page cache
+static uint64_t cachedBytes(const string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    off_t size = lseek(fd, 0, SEEK_END);
+    void* mapping = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return 0;
+    }
+    long os_page = sysconf(_SC_PAGESIZE);
+    vector<unsigned char> resident((size + os_page - 1) / os_page);
+    uint64_t cached = 0;
+    if (mincore(mapping, size, resident.data()) == 0) {
+        for (unsigned char r : resident) {
+            cached += (r & 1) ? os_page : 0;
+        }
+    }
+    munmap(mapping, size);
+    return cached;
+}
+
+int main(int argc, char** argv) {
+    double scale = benchScale(argc, argv);
+    uint32_t pages = static_cast<uint32_t>(16384 * scale);
+    size_t reads = static_cast<size_t>(200000 * scale);
+    size_t pool_pages = pages / POOL_FRACTION;
+    const string filename = "direct_io_bench.db";
+    removeDatabase(filename);
+
+    // every page stamped with its id, so reads can be checked
+    {
+        PageManager page_manager(filename);
+        Page page;
+        for (uint32_t i = 0; i < pages; i++) {
+            uint32_t page_id = page_manager.allocatePage();
+            memset(page.data, 0, PAGE_SIZE);
+            memcpy(page.data, &page_id, sizeof(page_id));
+            page_manager.writePage(page_id, page);
+        }
+        page_manager.sync();
+    }
+
+    // same read sequence for both modes
+    vector<uint32_t> sequence(reads);
+    mt19937 rng(7);
+    uint32_t hot_pages = static_cast<uint32_t>(pages * HOT_FRACTION);
+    uniform_real_distribution<double> coin(0, 1);
+    for (size_t i = 0; i < reads; i++) {
+        sequence[i] = coin(rng) < HOT_READS ? rng() % hot_pages : hot_pages + rng() % (pages - hot_pages);
+    }
+
+    cout << pages << " pages (" << (static_cast<uint64_t>(pages) * PAGE_SIZE >> 20) << "MB), pool "
+         << pool_pages << " pages (" << (pool_pages * PAGE_SIZE >> 20) << "MB), " << reads << " reads" << endl;
+    cout << "mode        pool MB   page cache MB   total MB   p50 us   p99 us" << endl;
+    for (OpenMode mode : {OpenMode::ReadWrite, OpenMode::ReadWriteDirect}) {
+        dropCache(filename);
+        PageManager page_manager(filename, mode);
+        BufferPool buffer_pool(&page_manager, pool_pages);
+
+        vector<double> latencies;
+        latencies.reserve(reads);
+        Stopwatch watch;
+        for (uint32_t page_id : sequence) {
+            watch.restart();
+            ReadPageGuard guard = buffer_pool.fetchPage(page_id);
+            latencies.push_back(watch.micros());
+            uint32_t stamp;
+            memcpy(&stamp, guard.data(), sizeof(stamp));
+            if (stamp != page_id) {
+                cout << "FAIL: page " << page_id << " read back as " << stamp << endl;
+                removeDatabase(filename);
+                return 1;
+            }
+        }
+
+        double pool_mb = static_cast<double>(pool_pages) * PAGE_SIZE / (1 << 20);
+        double cache_mb = static_cast<double>(cachedBytes(filename)) / (1 << 20);
+        const char* name = mode == OpenMode::ReadWrite ? "buffered" : (page_manager.isDirect() ? "O_DIRECT" : "(buffered)");
+        printf("%-10s %8.1f   %13.1f   %8.1f   %6.1f   %6.1f\n", name, pool_mb, cache_mb, pool_mb + cache_mb,
+               percentile(latencies, 0.5), percentile(latencies, 0.99));
+        if (mode == OpenMode::ReadWriteDirect && !page_manager.isDirect()) {
+            cout << "O_DIRECT not supported on this filesystem, the second row is buffered too" << endl;
+        }
+    }
+
+    removeDatabase(filename);
+    return 0;
+}
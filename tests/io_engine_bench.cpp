@@ -0,0 +1,112 @@
+#include "io_engine.h"
+#include "file_manager.h"
+#include "test_util.h"
+#include <fcntl.h>
+#include <random>
+#include <unistd.h>
+
+// page I/O throughput: one page at a time, synchronously (how every miss and flush went before IoEngine, at
+// queue depth 1), against IoEngine batches keeping up to IO_QUEUE_DEPTH requests in flight, on its thread
+// pool fallback and on io_uring (when the kernel allows it)
+// flush: write every page at a scattered page id, then fdatasync
+// cold scan: sync, drop the file from the page cache (fadvise DONTNEED), read every page in random order
+// (what a cold B+ tree walks look like); on a device that isn't fast at depth 1 the batches pull ahead
+// usage: io_engine_bench [scale], scale multiplies the file size (64MB at 1)
+
+enum class Path { Synchronous, ThreadPool, Uring };
+
+static const char* pathName(Path path) {
+    switch (path) {
+        case Path::Synchronous: return "one page at a time";
+        case Path::ThreadPool: return "IoEngine, thread pool";
+        case Path::Uring: return "IoEngine, io_uring";
+    }
+    return "";
+}
+
+static void dropCache(int fd) {
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+// runs every request on the path, returns seconds (sync included for writes)
+static double runPath(Path path, int fd, vector<IoRequest>& requests) {
+    Stopwatch watch;
+    if (path == Path::Synchronous) {
+        for (IoRequest& request : requests) {
+            if (request.is_write) {
+                request.result = static_cast<int>(pwrite(fd, request.page->data, PAGE_SIZE, request.offset));
+            } else {
+                request.result = static_cast<int>(pread(fd, request.page->data, PAGE_SIZE, request.offset));
+            }
+        }
+    } else {
+        IoEngine engine(fd, IO_QUEUE_DEPTH, path == Path::Uring);
+        if (path == Path::Uring && !engine.usingUring()) {
+            return -1;
+        }
+        vector<IoRequest*> pointers;
+        for (IoRequest& request : requests) {
+            pointers.push_back(&request);
+        }
+        engine.run(pointers.data(), pointers.size());
+    }
+    if (!requests.empty() && requests[0].is_write) {
+        fdatasync(fd);
+    }
+    return watch.seconds();
+}
+
+int main(int argc, char** argv) {
+    double scale = benchScale(argc, argv);
+    uint32_t pages = static_cast<uint32_t>(16384 * scale);
+    const string filename = "io_engine_bench.db";
+    removeDatabase(filename);
+    int fd = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        cout << "can't create " << filename << endl;
+        return 1;
+    }
+
+    // scattered page ids: a permutation, so every page is written once and the file ends up whole
+    vector<uint32_t> page_ids(pages);
+    for (uint32_t i = 0; i < pages; i++) {
+        page_ids[i] = i;
+    }
+    shuffle(page_ids.begin(), page_ids.end(), mt19937(42));
+    vector<Page> buffers(IO_QUEUE_DEPTH * 2);
+    for (size_t i = 0; i < buffers.size(); i++) {
+        memset(buffers[i].data, static_cast<int>(i + 1), PAGE_SIZE);
+    }
+
+    cout << pages << " pages (" << (static_cast<uint64_t>(pages) * PAGE_SIZE >> 20) << "MB), queue depth "
+         << IO_QUEUE_DEPTH << endl;
+    cout << "path                        flush MB/s   cold scan MB/s" << endl;
+    for (Path path : {Path::Synchronous, Path::ThreadPool, Path::Uring}) {
+        vector<IoRequest> requests(pages);
+        for (uint32_t i = 0; i < pages; i++) {
+            requests[i].offset = static_cast<uint64_t>(page_ids[i]) * PAGE_SIZE;
+            requests[i].page = &buffers[i % buffers.size()];
+            requests[i].is_write = true;
+        }
+        dropCache(fd);
+        double flush = runPath(path, fd, requests);
+
+        for (uint32_t i = 0; i < pages; i++) {
+            requests[i].is_write = false;
+        }
+        dropCache(fd);
+        double scan = runPath(path, fd, requests);
+
+        if (flush < 0 || scan < 0) {
+            printf("%-26s  (io_uring not available here)\n", pathName(path));
+            continue;
+        }
+        double megabytes = static_cast<double>(pages) * PAGE_SIZE / (1 << 20);
+        printf("%-26s  %10.1f   %14.1f\n", pathName(path), megabytes / flush, megabytes / scan);
+    }
+
+    close(fd);
+    removeDatabase(filename);
+    return 0;
+}
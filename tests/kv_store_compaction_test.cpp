@@ -0,0 +1,142 @@
+#include "kv_store.h"
+#include "test_util.h"
+
+// space amplification of a BTree-mode KVStore under overwrites stays bounded across restarts
+// every round overwrites the same keys (small values inline, a few big ones in overflow pages), then compact()
+// runs; the file may not keep growing: not in the first session (pages die as their records are overwritten)
+// and not after a reopen and a compact() (the survey has to find the pages whose records all died in a
+// session that never compacted)
+// a value streamed while the survey sweeps the file must come through whole
+
+static constexpr int KEYS = 200;
+static constexpr size_t VALUE_SIZE = 400;
+static constexpr int BIG_KEYS = 5;
+static constexpr size_t BIG_VALUE_SIZE = 20000;
+static constexpr int ROUNDS = 20;
+// a session may add a little on top of the pages the live data needs (append page, tree splits)
+static constexpr uint32_t SESSION_SLACK = 16;
+
+static string valueFor(int key, int round, size_t size) {
+    string value = "k" + to_string(key) + "r" + to_string(round) + ":";
+    value.resize(size, static_cast<char>('a' + (key + round) % 26));
+    return value;
+}
+
+static void overwriteRounds(KVStore& store, int first_round) {
+    for (int round = first_round; round < first_round + ROUNDS; round++) {
+        for (int key = 0; key < KEYS; key++) {
+            store.put(numberedKey(key), valueFor(key, round, VALUE_SIZE));
+        }
+        for (int key = 0; key < BIG_KEYS; key++) {
+            store.put(numberedKey(key, "big"), valueFor(key, round, BIG_VALUE_SIZE));
+        }
+    }
+}
+
+// false (after saying why) if a key doesn't hold what the last round put
+static bool checkValues(KVStore& store, int round) {
+    for (int key = 0; key < KEYS; key++) {
+        if (store.get(numberedKey(key)) != valueFor(key, round, VALUE_SIZE)) {
+            cout << "FAIL: key " << key << " doesn't hold round " << round << endl;
+            return false;
+        }
+    }
+    for (int key = 0; key < BIG_KEYS; key++) {
+        if (store.get(numberedKey(key, "big")) != valueFor(key, round, BIG_VALUE_SIZE)) {
+            cout << "FAIL: big key " << key << " doesn't hold round " << round << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t filePages(const string& filename) {
+    PageManager page_manager(filename);
+    return page_manager.pageCount();
+}
+
+// pages that aren't in the saved free map
+static uint32_t usedPages(const string& filename) {
+    PageManager page_manager(filename);
+    return page_manager.pageCount() - static_cast<uint32_t>(page_manager.freePageCount());
+}
+
+int main() {
+    const string filename = "kv_store_compaction.db";
+    removeDatabase(filename);
+
+    // what the live data takes: inline records packed into data pages, plus the overflow pages
+    uint32_t live_pages = KEYS * (VALUE_SIZE + 20) / (PAGE_SIZE - PAGE_HEADER_SIZE) + 1 +
+                          BIG_KEYS * (BIG_VALUE_SIZE / (PAGE_SIZE - PAGE_HEADER_SIZE - 4) + 1);
+
+    {
+        KVStore store(filename, KVIndexMode::BTree);
+        overwriteRounds(store, 0);
+        store.compact();
+        if (!checkValues(store, ROUNDS - 1)) {
+            return 1;
+        }
+    }
+    uint32_t first_pages = filePages(filename);
+    if (first_pages > 2 * live_pages + SESSION_SLACK) {
+        cout << "FAIL: first session left " << first_pages << " pages for about " << live_pages << " pages of live data" << endl;
+        return 1;
+    }
+
+    // second session: overwrites with no compaction, so the pages they empty aren't counted anywhere
+    // (the file grows), and the session ends with them still allocated
+    {
+        KVStore store(filename);
+        overwriteRounds(store, ROUNDS);
+    }
+    uint32_t second_pages = filePages(filename);
+
+    // third session: survey first (with a streamed value in flight while it sweeps), which has to free what
+    // the second session left behind, then the same overwrites again must fit in that space
+    const string streamed = valueFor(99, 0, BIG_VALUE_SIZE);
+    {
+        KVStore store(filename);
+        KVStore::ValueWriter writer = store.putStream("streamed", streamed.size());
+        writer.write(streamed.data(), streamed.size() / 2);
+        store.compact();
+        writer.write(streamed.data() + streamed.size() / 2, streamed.size() - streamed.size() / 2);
+        if (!writer.commit()) {
+            cout << "FAIL: streamed value didn't commit" << endl;
+            return 1;
+        }
+        overwriteRounds(store, 2 * ROUNDS);
+        store.compact();
+        if (!checkValues(store, 3 * ROUNDS - 1)) {
+            return 1;
+        }
+    }
+    uint32_t third_pages = filePages(filename);
+    if (third_pages > second_pages + SESSION_SLACK) {
+        cout << "FAIL: file grew from " << second_pages << " to " << third_pages << " pages after a reopen and compact()"
+             << endl;
+        return 1;
+    }
+    uint32_t third_used = usedPages(filename);
+    if (third_used > 2 * live_pages + SESSION_SLACK) {
+        cout << "FAIL: " << third_used << " pages still in use after a reopen and compact(), for about " << live_pages
+             << " pages of live data" << endl;
+        return 1;
+    }
+
+    // and everything is still there after another reopen
+    {
+        KVStore store(filename);
+        if (!checkValues(store, 3 * ROUNDS - 1)) {
+            return 1;
+        }
+        if (store.get("streamed") != streamed) {
+            cout << "FAIL: streamed value lost" << endl;
+            return 1;
+        }
+    }
+
+    cout << "pages after each session: " << first_pages << ", " << second_pages << ", " << third_pages << " ("
+         << third_used << " in use, live data about " << live_pages << ")" << endl;
+    removeDatabase(filename);
+    return 0;
+}
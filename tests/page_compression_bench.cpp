@@ -0,0 +1,157 @@
+#include "bplus_tree.h"
+#include "kv_store.h"
+#include "lz_codec.h"
+#include "test_util.h"
+#include <cstring>
+#include <random>
+
+// page compression: codec ratio and speed, and what ReadWriteCompressed saves on disk
+// page sets: B+ tree pages (short keys, 8-byte values), KVStore data pages holding JSON-like records, and
+// random bytes (incompressible, the worst case: every page goes out raw after a failed compression)
+// codec: every page compressed and decompressed REPS times, ratio is page bytes over compressed bytes
+// on disk: the same pages written through a compressed PageManager, storedBytes() counts the 512-byte sectors
+// the slots take, against a plain file of the same pages
+// usage: page_compression_bench [scale], scale multiplies the amount of data behind each page set
+
+static constexpr int REPS = 20;
+
+static vector<string> readAllPages(const string& filename, uint32_t first_page_id) {
+    vector<string> pages;
+    PageManager page_manager(filename);
+    Page page;
+    for (uint32_t page_id = first_page_id; page_id < page_manager.pageCount(); page_id++) {
+        page_manager.readPage(page_id, page);
+        pages.emplace_back(page.data, PAGE_SIZE);
+    }
+    return pages;
+}
+
+static vector<string> treePages(size_t count, mt19937& rng) {
+    const string filename = "page_compression_bench.db";
+    removeDatabase(filename);
+    {
+        PageManager page_manager(filename);
+        BufferPool buffer_pool(&page_manager, 4096);
+        BPlusTree tree(&buffer_pool, &page_manager);
+        for (size_t i = 0; i < count; i++) {
+            tree.insert(numberedKey(rng(), "user:"), rng());
+        }
+        buffer_pool.flushAll();
+    }
+    vector<string> pages = readAllPages(filename, 1);
+    removeDatabase(filename);
+    return pages;
+}
+
+static vector<string> kvPages(size_t count, mt19937& rng) {
+    const string filename = "page_compression_bench.kv";
+    removeDatabase(filename);
+    {
+        KVStore store(filename);
+        for (size_t i = 0; i < count; i++) {
+            char value[160];
+            snprintf(value, sizeof(value), "{\"id\":%zu,\"customer\":\"c%05u\",\"status\":\"%s\",\"total\":%u.%02u}", i,
+                     static_cast<unsigned>(rng() % 50000), i % 3 ? "shipped" : "pending",
+                     static_cast<unsigned>(rng() % 1000), static_cast<unsigned>(rng() % 100));
+            store.put(numberedKey(i, "order:"), value);
+        }
+    }
+    vector<string> pages = readAllPages(filename, 1);
+    removeDatabase(filename);
+    return pages;
+}
+
+static vector<string> randomPages(size_t count, mt19937& rng) {
+    vector<string> pages(count, string(PAGE_SIZE, '\0'));
+    for (string& page : pages) {
+        for (char& c : page) {
+            c = static_cast<char>(rng());
+        }
+    }
+    return pages;
+}
+
+// bytes the pages take on disk in a file opened with mode
+static uint64_t storedBytes(const vector<string>& pages, OpenMode mode) {
+    const string filename = "page_compression_bench.pages";
+    removeDatabase(filename);
+    uint64_t stored;
+    {
+        PageManager page_manager(filename, mode);
+        Page page;
+        for (const string& data : pages) {
+            memcpy(page.data, data.data(), PAGE_SIZE);
+            page_manager.writePage(page_manager.allocatePage(), page);
+        }
+        page_manager.sync();
+        stored = page_manager.storedBytes();
+    }
+    removeDatabase(filename);
+    return stored;
+}
+
+// false if a page didn't decompress to what went in
+static bool report(const char* name, const vector<string>& pages) {
+    vector<string> compressed(pages.size(), string(PAGE_SIZE, '\0'));
+    vector<size_t> lengths(pages.size());
+    Stopwatch watch;
+    for (int rep = 0; rep < REPS; rep++) {
+        for (size_t i = 0; i < pages.size(); i++) {
+            lengths[i] = lzCompress(pages[i].data(), PAGE_SIZE, &compressed[i][0], PAGE_SIZE);
+        }
+    }
+    double compress_seconds = watch.seconds();
+
+    char out[PAGE_SIZE];
+    watch.restart();
+    for (int rep = 0; rep < REPS; rep++) {
+        for (size_t i = 0; i < pages.size(); i++) {
+            if (lengths[i] > 0 && !lzDecompress(compressed[i].data(), lengths[i], out, PAGE_SIZE)) {
+                cout << "FAIL: " << name << " page " << i << " doesn't decompress" << endl;
+                return false;
+            }
+        }
+    }
+    double decompress_seconds = watch.seconds();
+    for (size_t i = 0; i < pages.size(); i++) {
+        if (lengths[i] > 0 && (!lzDecompress(compressed[i].data(), lengths[i], out, PAGE_SIZE) ||
+                               memcmp(out, pages[i].data(), PAGE_SIZE) != 0)) {
+            cout << "FAIL: " << name << " page " << i << " round trip differs" << endl;
+            return false;
+        }
+    }
+
+    uint64_t raw_bytes = static_cast<uint64_t>(pages.size()) * PAGE_SIZE;
+    uint64_t compressed_bytes = 0;
+    size_t compressed_pages = 0;
+    for (size_t length : lengths) {
+        compressed_bytes += length > 0 ? length : PAGE_SIZE;
+        compressed_pages += length > 0;
+    }
+    double megabytes = static_cast<double>(raw_bytes) * REPS / (1 << 20);
+    uint64_t plain = storedBytes(pages, OpenMode::ReadWrite);
+    uint64_t packed = storedBytes(pages, OpenMode::ReadWriteCompressed);
+    // nothing to decompress if no page compressed
+    char decompress_rate[32] = "-";
+    if (compressed_pages > 0) {
+        snprintf(decompress_rate, sizeof(decompress_rate), "%.0f", megabytes / decompress_seconds);
+    }
+    printf("%-8s %7zu  %7.2fx  %10.0f  %11s  %9.1f  %9.1f  %6.2fx\n", name, pages.size(),
+           static_cast<double>(raw_bytes) / compressed_bytes, megabytes / compress_seconds, decompress_rate,
+           plain / 1048576.0, packed / 1048576.0, packed ? static_cast<double>(plain) / packed : 0);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    double scale = benchScale(argc, argv);
+    mt19937 rng(1);
+    vector<string> tree = treePages(static_cast<size_t>(200000 * scale), rng);
+    vector<string> kv = kvPages(static_cast<size_t>(100000 * scale), rng);
+    vector<string> random = randomPages(static_cast<size_t>(2000 * scale), rng);
+
+    cout << "codec: ratio and MB/s of uncompressed page bytes, disk: plain file vs compressed slots" << endl;
+    printf("%-8s %7s  %8s  %10s  %11s  %9s  %9s  %7s\n", "pages", "count", "ratio", "comp MB/s", "decomp MB/s",
+           "plain MB", "slots MB", "on disk");
+    bool ok = report("btree", tree) && report("kv-json", kv) && report("random", random);
+    return ok ? 0 : 1;
+}
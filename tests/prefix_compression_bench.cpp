@@ -0,0 +1,109 @@
+#include "bplus_tree.h"
+#include "test_util.h"
+#include <random>
+
+// what prefix compression and suffix truncation buy on disk
+// builds a tree from each key set, then walks it level by level and adds up, per node, the key bytes the
+// cells would hold uncompressed against what is stored (the shared prefix once, suffixes in the cells)
+// also reports pages, height and fanout, and how long the separators in internal nodes are compared to the
+// keys (suffix truncation pushes up only as much of a key as it takes to tell the halves apart)
+// key sets: hierarchical tenant/region/object-id keys (long shared prefixes), and plain numbered keys
+// usage: prefix_compression_bench [scale], scale multiplies the number of keys (200000 at 1)
+
+struct TreeStats {
+    int height = 0;
+    size_t leaves = 0;
+    size_t internal_nodes = 0;
+    uint64_t leaf_keys = 0;
+    uint64_t separators = 0;
+    uint64_t leaf_key_bytes = 0;
+    uint64_t separator_bytes = 0;
+    uint64_t raw_key_bytes = 0;  // every key in every node, whole
+    uint64_t stored_key_bytes = 0;  // prefixes once per node plus suffixes
+};
+
+// walks from the root in page 0 down, one level at a time
+static TreeStats walkTree(BufferPool& buffer_pool) {
+    TreeStats stats;
+    vector<uint32_t> level;
+    {
+        ReadPageGuard guard = buffer_pool.fetchPage(0);
+        level.push_back(guard.page().readUint32(PAGE_HEADER_SIZE));
+    }
+    while (!level.empty() && level[0] != 0) {
+        stats.height++;
+        vector<uint32_t> next_level;
+        for (uint32_t page_id : level) {
+            Node node;
+            {
+                ReadPageGuard guard = buffer_pool.fetchPage(page_id);
+                node.deserializeFromPage(guard.page());
+            }
+            uint32_t prefix_len = node.prefixLength();
+            uint64_t key_bytes = 0;
+            for (const string& key : node.keys) {
+                key_bytes += key.size();
+            }
+            stats.raw_key_bytes += key_bytes;
+            stats.stored_key_bytes += key_bytes - static_cast<uint64_t>(prefix_len) * node.keys.size() + prefix_len;
+            if (node.is_leaf) {
+                stats.leaves++;
+                stats.leaf_keys += node.keys.size();
+                stats.leaf_key_bytes += key_bytes;
+            } else {
+                stats.internal_nodes++;
+                stats.separators += node.keys.size();
+                stats.separator_bytes += key_bytes;
+                next_level.insert(next_level.end(), node.children_page_ids.begin(), node.children_page_ids.end());
+            }
+        }
+        level.swap(next_level);
+    }
+    return stats;
+}
+
+static void report(const char* name, const vector<string>& keys) {
+    const string filename = "prefix_compression_bench.db";
+    removeDatabase(filename);
+    PageManager page_manager(filename);
+    BufferPool buffer_pool(&page_manager, 1024);
+    BPlusTree tree(&buffer_pool, &page_manager);
+    for (size_t i = 0; i < keys.size(); i++) {
+        tree.insert(keys[i], i + 1);
+    }
+    buffer_pool.flushAll();
+
+    TreeStats stats = walkTree(buffer_pool);
+    double saved = stats.raw_key_bytes - stats.stored_key_bytes;
+    printf("%-13s %8zu  %7.1f  %8.1f  %5.1f%%  %6u  %6d  %9.1f  %9.1f  %8.1f  %8.1f\n", name, keys.size(),
+           stats.raw_key_bytes / 1048576.0, saved / 1048576.0, 100 * saved / stats.raw_key_bytes, page_manager.pageCount(),
+           stats.height, static_cast<double>(stats.leaf_keys) / stats.leaves,
+           stats.internal_nodes ? static_cast<double>(stats.separators + stats.internal_nodes) / stats.internal_nodes : 0,
+           static_cast<double>(stats.leaf_key_bytes) / stats.leaf_keys,
+           stats.separators ? static_cast<double>(stats.separator_bytes) / stats.separators : 0);
+    removeDatabase(filename);
+}
+
+int main(int argc, char** argv) {
+    size_t count = static_cast<size_t>(200000 * benchScale(argc, argv));
+    mt19937_64 rng(7);
+
+    vector<string> hierarchical;
+    for (size_t i = 0; i < count; i++) {
+        char key[96];
+        snprintf(key, sizeof(key), "tenant-%04u/region-us-east-%02u/object-%016llx", static_cast<unsigned>(rng() % 20),
+                 static_cast<unsigned>(rng() % 8), static_cast<unsigned long long>(rng()));
+        hierarchical.push_back(key);
+    }
+    vector<string> numbered;
+    for (size_t i = 0; i < count; i++) {
+        numbered.push_back(numberedKey(rng() % (count * 10)));
+    }
+
+    cout << "key MB: whole keys in all nodes, saved: bytes the node prefixes take out of the cells" << endl;
+    printf("%-13s %8s  %7s  %8s  %6s  %6s  %6s  %9s  %9s  %8s  %8s\n", "keys", "count", "key MB", "saved MB", "saved",
+           "pages", "height", "leaf fan", "inner fan", "key len", "sep len");
+    report("hierarchical", hierarchical);
+    report("numbered", numbered);
+    return 0;
+}
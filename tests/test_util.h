@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// helpers shared by the stress tests and benchmarks in this directory
+// tests print what went wrong and return non-zero from main, ctest only looks at the exit code
+
+// drop a scratch database file and every sidecar the engine may have left next to it
+inline void removeDatabase(const string& filename) {
+    for (const char* suffix : {"", ".fsm", ".idx", ".mode", ".map", ".map.tmp", ".idx.tmp"}) {
+        remove((filename + suffix).c_str());
+    }
+}
+
+// fixed-width keys sort like the numbers they hold
+inline string numberedKey(uint64_t n, const char* prefix = "key") {
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%s%012llu", prefix, static_cast<unsigned long long>(n));
+    return buffer;
+}
+
+// optional first argument: scale a benchmark's work up or down (1.0 if missing)
+inline double benchScale(int argc, char** argv) {
+    double scale = argc > 1 ? atof(argv[1]) : 1.0;
+    return scale > 0 ? scale : 1.0;
+}
+
+class Stopwatch {
+public:
+    Stopwatch() : start_(chrono::steady_clock::now()) {}
+    void restart() { start_ = chrono::steady_clock::now(); }
+    double seconds() const { return chrono::duration<double>(chrono::steady_clock::now() - start_).count(); }
+    double micros() const { return chrono::duration<double, micro>(chrono::steady_clock::now() - start_).count(); }
+
+private:
+    chrono::steady_clock::time_point start_;
+};
+
+// value at fraction (0-1) of the sorted samples, e.g. 0.99 for p99
+inline double percentile(vector<double> samples, double fraction) {
+    if (samples.empty()) {
+        return 0;
+    }
+    size_t index = static_cast<size_t>(fraction * (samples.size() - 1));
+    nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples[index];
+}
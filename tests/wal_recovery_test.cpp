@@ -0,0 +1,111 @@
+#include "bplus_tree.h"
+#include "test_util.h"
+#include <sys/wait.h>
+#include <unistd.h>
+
+// crash recovery through the write-ahead log, with the log kept short by checkpoints along the way
+// every session is a forked child inserting KEYS keys through a small pool (evictions, splits, the cleaner
+// checkpointing whenever the log passes CHECKPOINT_BYTES), committing every COMMIT_EVERY inserts, then a few
+// more that are never committed, and _exit without flushing anything: the crash
+// the parent recovers and every committed key of every session so far has to be there; the log may not have
+// grown much past the checkpoint size at any point
+
+static constexpr int SESSIONS = 3;
+static constexpr int KEYS = 20000;
+static constexpr int COMMIT_EVERY = 100;
+static constexpr int UNCOMMITTED = 50;
+static constexpr size_t POOL_PAGES = 64;
+static constexpr uint64_t CHECKPOINT_BYTES = 1 << 20;
+// the cleaner checkpoints behind the writers, so the log gets somewhat past the limit before it's cut
+static constexpr uint64_t LOG_LIMIT = 8 * CHECKPOINT_BYTES;
+
+static uint64_t fileSize(const string& filename) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file) {
+        return 0;
+    }
+    fseek(file, 0, SEEK_END);
+    uint64_t size = static_cast<uint64_t>(ftell(file));
+    fclose(file);
+    return size;
+}
+
+// the child: insert one session's keys and crash, exit status 1 if the log outgrew LOG_LIMIT
+static void crashingSession(const string& filename, const string& log_filename, int session) {
+    LogManager log_manager(log_filename);
+    PageManager page_manager(filename);
+    BufferPool buffer_pool(&page_manager, POOL_PAGES, 0, &log_manager);
+    buffer_pool.setCheckpointLogSize(CHECKPOINT_BYTES);
+    BPlusTree tree(&buffer_pool, &page_manager);
+
+    uint64_t largest_log = 0;
+    int first_key = session * (KEYS + UNCOMMITTED);
+    for (int i = 0; i < KEYS; i++) {
+        tree.insert(numberedKey(first_key + i), first_key + i + 1);
+        if (i % COMMIT_EVERY == COMMIT_EVERY - 1) {
+            log_manager.commit();
+        }
+        largest_log = max(largest_log, log_manager.size());
+    }
+    log_manager.commit();
+    for (int i = KEYS; i < KEYS + UNCOMMITTED; i++) {
+        tree.insert(numberedKey(first_key + i), first_key + i + 1);
+    }
+    if (largest_log > LOG_LIMIT) {
+        cout << "FAIL: session " << session << " log reached " << largest_log << " bytes" << endl;
+        _exit(1);
+    }
+    _exit(0);  // no flushAll, no destructors
+}
+
+int main() {
+    const string filename = "wal_recovery.db";
+    const string log_filename = filename + ".wal";
+    removeDatabase(filename);
+    remove(log_filename.c_str());
+    remove((log_filename + ".tmp").c_str());
+
+    for (int session = 0; session < SESSIONS; session++) {
+        cout.flush();
+        pid_t pid = fork();
+        if (pid == 0) {
+            crashingSession(filename, log_filename, session);
+        }
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            cout << "FAIL: session " << session << " didn't run to its crash" << endl;
+            return 1;
+        }
+        uint64_t crashed_log = fileSize(log_filename);
+        if (crashed_log > LOG_LIMIT) {
+            cout << "FAIL: session " << session << " left a " << crashed_log << " byte log" << endl;
+            return 1;
+        }
+
+        // recovery runs in the pool's constructor
+        LogManager log_manager(log_filename);
+        PageManager page_manager(filename);
+        BufferPool buffer_pool(&page_manager, POOL_PAGES, 0, &log_manager);
+        BPlusTree tree(&buffer_pool, &page_manager);
+        for (int s = 0; s <= session; s++) {
+            int first_key = s * (KEYS + UNCOMMITTED);
+            for (int i = 0; i < KEYS; i++) {
+                if (tree.search(numberedKey(first_key + i)) != static_cast<uint64_t>(first_key + i + 1)) {
+                    cout << "FAIL: committed key " << first_key + i << " of session " << s << " lost after crash "
+                         << session << endl;
+                    return 1;
+                }
+            }
+        }
+        if (log_manager.size() != PAGE_SIZE) {
+            cout << "FAIL: log holds " << log_manager.size() << " bytes after recovery" << endl;
+            return 1;
+        }
+        cout << "session " << session << ": log " << crashed_log << " bytes at the crash, " << page_manager.pageCount()
+             << " pages" << endl;
+    }
+
+    removeDatabase(filename);
+    remove(log_filename.c_str());
+    return 0;
+}